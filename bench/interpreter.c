@@ -0,0 +1,209 @@
+/*
+ *  Measures tokenize(), parse() and interpret() on generated command lines from 1 to 1M lines.
+ *  Programs are never started, valery_exec_program() and valery_exec_capture() are stubbed out,
+ *  so the numbers only cover the work the shell itself does.
+ *
+ *  Prints one tab separated row per phase and input size:
+ *  phase lines reps tokens ns_per_line ns_per_token lines_per_sec allocs_per_line
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "valery/valery.h"
+#include "valery/env.h"
+#include "valery/interpreter/lexer.h"
+#include "valery/interpreter/parser.h"
+#include "valery/interpreter/parser_utils.h"
+#include "valery/interpreter/interpreter.h"
+#include "valery/interpreter/impl/exec.h"
+#include "valery/interpreter/impl/glob.h"
+#include "builtins/builtins.h"
+#include "lib/nicc/nicc.h"
+
+#define BENCH_MAX_LINES 1000000
+/* small inputs are run again until at least this many lines have been processed */
+#define BENCH_MIN_TOTAL_LINES 100000
+#define BENCH_LINE_MAX 128
+
+
+/* the benchmark is linked with --wrap, so every allocation the shell makes passes through here */
+static uint64_t allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    allocations++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+
+/* exec.c is not linked in, programs are "run" by these */
+int valery_exec_program(int argc, char *argv[], char *envp[], int fd_in)
+{
+    (void)argc; (void)argv; (void)envp; (void)fd_in;
+    return 0;
+}
+
+int valery_exec_capture(int argc, char *argv[], char *envp[], int fd_in,
+                        struct capture_t *capture)
+{
+    (void)argc; (void)argv; (void)envp; (void)fd_in; (void)capture;
+    return 0;
+}
+
+
+struct phase_t {
+    const char *name;
+    uint64_t ns;
+    uint64_t allocations;
+};
+
+/*
+ * a mix of what interactive use and scripts look like: expansions, strings, assignments,
+ * here-strings and command substitution. no command name is an alias, so every token in
+ * the list is owned by the list.
+ */
+static char *generate(size_t lines)
+{
+    size_t capacity = lines * BENCH_LINE_MAX + 1;
+    char *source = vmalloc(capacity);
+    size_t len = 0;
+    for (size_t i = 0; i < lines; i++) {
+        switch (i % 4) {
+            case 0:
+                len += snprintf(source + len, capacity - len,
+                                "echo word%zu \"a string $HOME\" ${UNSET:-fallback}\n", i);
+                break;
+            case 1:
+                len += snprintf(source + len, capacity - len,
+                                "FOO=bar%zu printenv FOO && echo ok\n", i);
+                break;
+            case 2:
+                len += snprintf(source + len, capacity - len, "cat <<<here%zu\n", i);
+                break;
+            case 3:
+                len += snprintf(source + len, capacity - len, "X=%zu; echo $X $(echo nested)\n", i);
+                break;
+        }
+    }
+    return source;
+}
+
+static void tokens_free(struct tokenlist_t *tl)
+{
+    for (size_t i = 0; i < tl->size; i++) {
+        vfree(tl->tokens[i]->lexeme);
+        vfree(tl->tokens[i]->literal);
+    }
+    tokenlist_free(tl);
+}
+
+static void phase_begin(struct phase_t *phase)
+{
+    phase->allocations -= allocations;
+    phase->ns -= bench_now_ns();
+}
+
+static void phase_end(struct phase_t *phase)
+{
+    phase->ns += bench_now_ns();
+    phase->allocations += allocations;
+}
+
+static void report(struct phase_t *phase, size_t lines, size_t reps, size_t tokens)
+{
+    double total_lines = (double)lines * reps;
+    double ns_per_line = phase->ns / total_lines;
+    printf("%s\t%zu\t%zu\t%zu\t%.1f\t%.2f\t%.0f\t%.2f\n", phase->name, lines, reps, tokens,
+           ns_per_line, phase->ns / ((double)tokens * reps), NS_PER_SEC / ns_per_line,
+           phase->allocations / total_lines);
+}
+
+static void bench(size_t lines)
+{
+    char *source = generate(lines);
+    size_t reps = lines >= BENCH_MIN_TOTAL_LINES ? 1 : BENCH_MIN_TOTAL_LINES / lines;
+    size_t tokens = 0;
+    struct phase_t lex = { "tokenize", 0, 0 };
+    struct phase_t syntax = { "parse", 0, 0 };
+    struct phase_t run = { "interpret", 0, 0 };
+
+    for (size_t r = 0; r < reps; r++) {
+        ast_arena_init();
+
+        phase_begin(&lex);
+        struct tokenlist_t *tl = tokenize(source);
+        phase_end(&lex);
+        tokens = tl->size;
+
+        phase_begin(&syntax);
+        struct darr_t *statements = parse(tl);
+        phase_end(&syntax);
+
+        phase_begin(&run);
+        interpret(statements);
+        phase_end(&run);
+
+        glob_cache_clear();
+        ast_arena_release();
+        free(darr_raw_ret(statements));
+        tokens_free(tl);
+    }
+
+    report(&lex, lines, reps, tokens);
+    report(&syntax, lines, reps, tokens);
+    report(&run, lines, reps, tokens);
+    fflush(stdout);
+    vfree(source);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t max_lines = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_MAX_LINES;
+
+    struct env_t *env = env_malloc();
+    builtins_init(env, NULL);
+    interpret_init(env);
+
+    printf("phase\tlines\treps\ttokens\tns_per_line\tns_per_token\tlines_per_sec\tallocs_per_line\n");
+    for (size_t lines = 1; lines <= max_lines; lines *= 10)
+        bench(lines);
+
+    interpret_free();
+    env_free(env);
+    return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ *  Measures keystroke to render latency of the interactive prompt. Starts valery under a
+ *  pseudo-terminal with a scratch HOME holding a history file of a given size, replays
+ *  keystrokes and timestamps when the echo of each of them has reached the master side.
+ *
+ *  Every key but enter is rendered by prompt_update(), enter is measured until the next
+ *  prompt() has printed the PS1. Prints one tab separated row per history size and scenario:
+ *  history scenario function samples p50_us p99_us max_us
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // posix_openpt, ptsname, mkdtemp, clock_gettime, realpath
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BENCH_PS1 "vbench"
+/* the shell prints the PS1 followed by a space */
+#define BENCH_PROMPT BENCH_PS1 " "
+/* what prompt_update() starts every render with */
+#define BENCH_FLUSH_LINE "\33[2K\r"
+#define BENCH_ARROW_UP "\033[A"
+#define BENCH_ARROW_DOWN "\033[B"
+#define BENCH_ARROW_LEFT "\033[D"
+#define BENCH_BACKSPACE "\177"
+
+/* a render is done when nothing more has arrived for this long */
+#define BENCH_IDLE_MS 3
+#define BENCH_TIMEOUT_MS 5000
+#define BENCH_TYPED_LINES 4
+#define BENCH_HISTORY_STEPS 200
+/* longer than any generated history line */
+#define BENCH_HISTORY_LINE_MAX 64
+#define BENCH_EDITS 20
+#define BENCH_PASTES 10
+#define BENCH_PASTE_LEN 512
+#define BENCH_ENTERS 100
+
+static const size_t history_sizes[] = { 0, 1000, 10000, 100000 };
+static const char typed_line[] = "echo the quick brown fox jumps over the lazy dog";
+
+
+struct samples_t {
+    const char *scenario;
+    const char *function;
+    uint64_t *ns;
+    size_t len;
+    size_t capacity;
+};
+
+struct session_t {
+    pid_t pid;
+    int master;
+};
+
+
+static void die(const char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+static void samples_add(struct samples_t *samples, uint64_t ns)
+{
+    if (samples->len == samples->capacity) {
+        samples->capacity = samples->capacity == 0 ? 64 : samples->capacity * 2;
+        samples->ns = realloc(samples->ns, samples->capacity * sizeof(uint64_t));
+        if (samples->ns == NULL)
+            die("realloc");
+    }
+    samples->ns[samples->len++] = ns;
+}
+
+static int ns_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(struct samples_t *samples, double p)
+{
+    size_t i = (size_t)(p * (samples->len - 1) + 0.5);
+    return samples->ns[i] / 1000.0;
+}
+
+static void report(size_t history, struct samples_t *samples)
+{
+    if (samples->len == 0)
+        return;
+    qsort(samples->ns, samples->len, sizeof(uint64_t), ns_cmp);
+    printf("%zu\t%s\t%s\t%zu\t%.1f\t%.1f\t%.1f\n", history, samples->scenario, samples->function,
+           samples->len, percentile_us(samples, 0.50), percentile_us(samples, 0.99),
+           percentile_us(samples, 1.0));
+    fflush(stdout);
+    samples->len = 0;
+}
+
+/*
+ * reads until marker has been seen and then nothing more has arrived for BENCH_IDLE_MS.
+ * returns when the last byte arrived. markers never start over within themselves, so matching
+ * them one char at a time is enough.
+ */
+static uint64_t await_render(int master, const char *marker)
+{
+    char buf[4096];
+    size_t matched = 0;
+    size_t marker_len = strlen(marker);
+    bool seen = false;
+    uint64_t last = 0;
+    struct pollfd pfd = { .fd = master, .events = POLLIN };
+
+    while (1) {
+        int ready = poll(&pfd, 1, seen ? BENCH_IDLE_MS : BENCH_TIMEOUT_MS);
+        if (ready == 0) {
+            if (seen)
+                return last;
+            fprintf(stderr, "latency: no render after %d ms\n", BENCH_TIMEOUT_MS);
+            exit(1);
+        }
+        if (ready < 0)
+            die("poll");
+
+        ssize_t len = read(master, buf, sizeof(buf));
+        if (len <= 0) {
+            fprintf(stderr, "latency: valery went away\n");
+            exit(1);
+        }
+        last = bench_now_ns();
+        for (ssize_t i = 0; i < len && !seen; i++) {
+            if (buf[i] == marker[matched])
+                matched++;
+            else
+                matched = buf[i] == marker[0];
+            seen = matched == marker_len;
+        }
+    }
+}
+
+static void send_keys(int master, const char *keys, size_t len)
+{
+    while (len > 0) {
+        ssize_t written = write(master, keys, len);
+        if (written < 0)
+            die("write");
+        keys += written;
+        len -= written;
+    }
+}
+
+/* sends one key and returns how long it took until its echo had been rendered */
+static uint64_t key(int master, const char *keys, const char *marker)
+{
+    uint64_t start = bench_now_ns();
+    send_keys(master, keys, strlen(keys));
+    return await_render(master, marker) - start;
+}
+
+/* empties the line, untimed */
+static void clear_line(int master, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        send_keys(master, BENCH_BACKSPACE, 1);
+    await_render(master, BENCH_FLUSH_LINE);
+}
+
+static void write_file(const char *dir, const char *name, size_t lines, const char *content)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        die(path);
+    if (content != NULL)
+        fputs(content, fp);
+    for (size_t i = 0; i < lines; i++)
+        fprintf(fp, "echo history entry %zu\n", i);
+    fclose(fp);
+}
+
+static void remove_file(const char *dir, const char *name)
+{
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    unlink(path);
+}
+
+static struct session_t session_start(const char *valery, const char *home)
+{
+    struct session_t session;
+    session.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (session.master == -1 || grantpt(session.master) == -1 || unlockpt(session.master) == -1)
+        die("posix_openpt");
+    char *slave_name = ptsname(session.master);
+    if (slave_name == NULL)
+        die("ptsname");
+
+    session.pid = fork();
+    if (session.pid == -1)
+        die("fork");
+    if (session.pid == 0) {
+        setsid();
+        int slave = open(slave_name, O_RDWR);
+        if (slave == -1)
+            _exit(127);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        close(slave);
+        close(session.master);
+        setenv("HOME", home, 1);
+        if (chdir(home) == -1)
+            _exit(127);
+        execl(valery, valery, (char *)NULL);
+        _exit(127);
+    }
+
+    await_render(session.master, BENCH_PROMPT);
+    return session;
+}
+
+static void session_end(struct session_t *session)
+{
+    send_keys(session->master, "exit\n", 5);
+    int status;
+    if (waitpid(session->pid, &status, 0) == -1)
+        die("waitpid");
+    close(session->master);
+}
+
+static void bench(const char *valery, size_t history)
+{
+    char template[] = "/tmp/valery-latency-XXXXXX";
+    char *home = mkdtemp(template);
+    if (home == NULL)
+        die("mkdtemp");
+    write_file(home, ".valeryrc", 0, "PS1=" BENCH_PS1 "\nPATH=/usr/bin:/bin\n");
+    /* the plain text format, valery imports it into its history files on startup */
+    write_file(home, ".valery_hist", history, NULL);
+
+    struct session_t session = session_start(valery, home);
+    int master = session.master;
+    struct samples_t samples = { 0 };
+    char keystroke[2] = { 0 };
+
+    /* typing a line one key at a time */
+    samples.scenario = "type";
+    samples.function = "prompt_update";
+    for (size_t n = 0; n < BENCH_TYPED_LINES; n++) {
+        for (size_t i = 0; i < sizeof(typed_line) - 1; i++) {
+            keystroke[0] = typed_line[i];
+            samples_add(&samples, key(master, keystroke, BENCH_FLUSH_LINE));
+        }
+        clear_line(master, sizeof(typed_line) - 1);
+    }
+    report(history, &samples);
+
+    /* walking up through the history and back down again */
+    samples.scenario = "history";
+    for (size_t i = 0; i < BENCH_HISTORY_STEPS; i++)
+        samples_add(&samples, key(master, BENCH_ARROW_UP, BENCH_FLUSH_LINE));
+    for (size_t i = 0; i < BENCH_HISTORY_STEPS; i++)
+        samples_add(&samples, key(master, BENCH_ARROW_DOWN, BENCH_FLUSH_LINE));
+    report(history, &samples);
+    clear_line(master, BENCH_HISTORY_LINE_MAX);
+
+    /* moving into the middle of a line, inserting and deleting there */
+    samples.scenario = "edit";
+    send_keys(master, typed_line, sizeof(typed_line) - 1);
+    await_render(master, BENCH_FLUSH_LINE);
+    for (size_t i = 0; i < BENCH_EDITS; i++) {
+        samples_add(&samples, key(master, BENCH_ARROW_LEFT, BENCH_FLUSH_LINE));
+        samples_add(&samples, key(master, "x", BENCH_FLUSH_LINE));
+        samples_add(&samples, key(master, BENCH_BACKSPACE, BENCH_FLUSH_LINE));
+    }
+    report(history, &samples);
+    clear_line(master, sizeof(typed_line) - 1);
+
+    /* a paste arrives as one write, the sample is until the last of its renders is done */
+    samples.scenario = "paste";
+    char paste[BENCH_PASTE_LEN + 1];
+    for (size_t i = 0; i < BENCH_PASTE_LEN; i++)
+        paste[i] = 'a' + i % 26;
+    paste[BENCH_PASTE_LEN] = 0;
+    for (size_t i = 0; i < BENCH_PASTES; i++) {
+        samples_add(&samples, key(master, paste, BENCH_FLUSH_LINE));
+        clear_line(master, BENCH_PASTE_LEN);
+    }
+    report(history, &samples);
+
+    /* an empty line, from enter until the next prompt() has printed the PS1 */
+    samples.scenario = "enter";
+    samples.function = "prompt";
+    for (size_t i = 0; i < BENCH_ENTERS; i++)
+        samples_add(&samples, key(master, "\n", BENCH_PROMPT));
+    report(history, &samples);
+
+    session_end(&session);
+    free(samples.ns);
+    remove_file(home, ".valeryrc");
+    remove_file(home, ".valery_hist");
+    remove_file(home, ".valery_history");
+    remove_file(home, ".valery_history_strings");
+    remove_file(home, ".valery_snapshot");
+    rmdir(home);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "./valery";
+    /* the child changes into the scratch HOME before it execs, so a relative path would break */
+    char valery[PATH_MAX];
+    if (realpath(path, valery) == NULL || access(valery, X_OK) == -1)
+        die(path);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("history\tscenario\tfunction\tsamples\tp50_us\tp99_us\tmax_us\n");
+    for (size_t i = 0; i < sizeof(history_sizes) / sizeof(history_sizes[0]); i++)
+        bench(valery, history_sizes[i]);
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ *  Measures how fast valery_exec_program() starts and waits for a program that does nothing,
+ *  with fork(), vfork() and posix_spawn(), while the shell holds heaps of different sizes.
+ *  fork() has to copy the page tables of the whole heap, the others do not.
+ *
+ *  Prints one tab separated row per heap size and strategy:
+ *  heap_mb strategy spawns commands_per_sec sys_us_per_spawn child_sys_us_per_spawn
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // clock_gettime
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+#include "valery/valery.h"
+#include "valery/interpreter/impl/exec.h"
+
+#define BENCH_SPAWNS 1000
+#define BENCH_PROGRAM "/bin/true"
+
+static const size_t heap_sizes_mb[] = { 0, 64, 256, 1024 };
+
+extern char **environ;
+
+
+static uint64_t timeval_us(struct timeval tv)
+{
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* system time used so far by the benchmark itself and by its waited for children */
+static void sys_time(uint64_t *self_us, uint64_t *children_us)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    *self_us = timeval_us(usage.ru_stime);
+    getrusage(RUSAGE_CHILDREN, &usage);
+    *children_us = timeval_us(usage.ru_stime);
+}
+
+static void bench(size_t heap_mb, enum exec_strategy_t strategy, char *program, size_t spawns)
+{
+    char *argv[] = { program, NULL };
+    uint64_t self_start, children_start, self_end, children_end;
+
+    exec_strategy = strategy;
+    sys_time(&self_start, &children_start);
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < spawns; i++) {
+        if (valery_exec_program(1, argv, environ, -1) != 0) {
+            fprintf(stderr, "spawn: %s did not exit successfully\n", program);
+            exit(1);
+        }
+    }
+    uint64_t ns = bench_now_ns() - start;
+    sys_time(&self_end, &children_end);
+
+    printf("%zu\t%s\t%zu\t%.0f\t%.1f\t%.1f\n", heap_mb, exec_strategy_names[strategy], spawns,
+           spawns / ((double)ns / NS_PER_SEC), (double)(self_end - self_start) / spawns,
+           (double)(children_end - children_start) / spawns);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    char *program = argc > 1 ? argv[1] : BENCH_PROGRAM;
+    size_t spawns = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_SPAWNS;
+
+    printf("heap_mb\tstrategy\tspawns\tcommands_per_sec\tsys_us_per_spawn\tchild_sys_us_per_spawn\n");
+    for (size_t i = 0; i < sizeof(heap_sizes_mb) / sizeof(heap_sizes_mb[0]); i++) {
+        /* touched, so every page is mapped and fork() has to copy its page table entry */
+        char *heap = NULL;
+        if (heap_sizes_mb[i] > 0) {
+            heap = vmalloc(MB(heap_sizes_mb[i]));
+            memset(heap, 1, MB(heap_sizes_mb[i]));
+        }
+        for (int strategy = 0; strategy < EXEC_STRATEGY_COUNT; strategy++)
+            bench(heap_sizes_mb[i], strategy, program, spawns);
+        vfree(heap);
+    }
+    return 0;
+}
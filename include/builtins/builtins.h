@@ -19,27 +19,45 @@
 #define BUILTINS
 
 #include <stdbool.h>
+#include <stdio.h>
 
 #include "valery/histfile.h"
+#include "valery/env.h"
 
 #define COMMAND_IN_PATH         0
 #define COMMAND_NOT_FOUND       1
 #define COMMAND_IS_BUILTIN      2
 #define COMMAND_IS_PATH         3
 
-#define total_builtin_functions 5
+#define total_builtin_functions 10
 extern char *builtin_names[total_builtin_functions];
 
 
 /* functions */
 
+/*
+ * gives the builtins access to the shell state they operate on.
+ * hist may be NULL when the shell is not interactive.
+ */
+void builtins_init(struct env_t *env, struct hist_t *hist);
+
+/* returns true if program_name is a shell builtin */
+bool is_builtin(char *program_name);
+
+/*
+ * runs the builtin argv[0] inside the shell process.
+ * all output the builtin produces is written to out.
+ * returns the exit code of the builtin.
+ */
+int builtin_exec(int argc, char **argv, FILE *out);
+
 /*
  * which builtin that is meant to be used interactively.
  * calls which_single() on all program_names and prints where program executable
- * is located, what type of program it is, or could not find.
+ * is located, what type of program it is, or could not find, to out.
  * returns 0 if all program were found, else 1.
  */
-int which(char **program_names, int program_count, char **paths, int path_count);
+int which(char **program_names, int program_count, char **paths, int path_count, FILE *out);
 
 /*
  * if which is used interactively, pass NULL as the path_result argument.
@@ -56,10 +74,12 @@ int which_single(char *program_name, char **paths, int path_count, char **path_r
 int cd(char *directory);
 
 /*
- * if print_all is true, program prints entire hist file.
- * if not, program prints the 15 most recent hist lines.
+ * prints the 15 most recent hist lines, or every one with '-a'. '-v' adds when each command ran,
+ * how long it took and its exit code. '--failed', '--since <n>[smhd]' and '--cwd' only print
+ * commands that failed, ran within the given time or ran in the current directory.
+ * returns 1 on a bad argument or an empty history, else 0.
  */
-int history(struct hist_t *hist, bool print_all);
+int history(struct hist_t *hist, char **args, int arg_count, FILE *out);
 
 /*
  * if result is NULL, program prints the current working directory.
@@ -67,7 +87,44 @@ int history(struct hist_t *hist, bool print_all);
  */
 int pwd(char result[4096]);
 
-int help(void);
+int help(FILE *out);
+
+/*
+ * without args, prints every alias to out. an arg on the form name=value sets the alias,
+ * and an arg without a '=' prints the alias of that name.
+ * returns 1 if an alias to print was not found, else 0.
+ */
+int alias(struct env_table_t *aliases, char **args, int arg_count, FILE *out);
+
+/*
+ * removes the aliases named in args, or every alias if the only arg is '-a'.
+ * returns 1 if an alias was not found, else 0.
+ */
+int unalias(struct env_table_t *aliases, char **args, int arg_count);
+
+/*
+ * without args, prints whether commands are traced. 'on' and 'off' toggle tracing, 'dump'
+ * writes the recorded commands to out, 'clear' forgets them and 'fd <n>' also writes every
+ * traced command to the file descriptor n until 'fd off'.
+ * returns 1 on a bad argument, else 0.
+ */
+int trace(char **args, int arg_count, FILE *out);
+
+/*
+ * prints the n, or STATS_DEFAULT_TOP, programs started in this session that used the most cpu
+ * time and memory, summed per command name. 'clear' forgets what has been recorded.
+ * returns 1 on a bad argument, else 0.
+ */
+int stats(char **args, int arg_count, FILE *out);
+
+/*
+ * prints the live bytes, peak bytes and number of allocations, resizes and frees per subsystem
+ * of the shell. 'clear' sets the counts to zero and the peaks to what is live now, so running
+ * 'memstats' after 'memstats clear' and one command line shows what that line allocated.
+ * only counts anything when valery is built with VALERY_MEMSTATS.
+ * returns 1 on a bad argument or if nothing is counted, else 0.
+ */
+int memstats(char **args, int arg_count, FILE *out);
 
 void license(void);
 
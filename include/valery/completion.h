@@ -0,0 +1,113 @@
+/*
+ *  Tab completion of command names.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPLETION
+#define COMPLETION
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "valery/valery.h"
+#include "valery/env.h"
+
+/* max amount of candidates listed when a prefix is ambiguous */
+#define COMPLETION_MAX_LISTED 128
+#define COMPLETION_NO_NODE UINT32_MAX
+/* the least recently used directory listing is evicted when either limit is reached */
+#define DIR_CACHE_SIZE 64
+#define DIR_CACHE_MAX_BYTES MB(8)
+
+
+/* types */
+/*
+ * the trie is stored as one array of nodes. the children of a node are a linked list of
+ * siblings sorted by c, so a node is only 12 bytes and the whole trie is one allocation.
+ */
+struct trie_node_t {
+    uint32_t child;         /* index of the first child, or COMPLETION_NO_NODE */
+    uint32_t sibling;       /* index of the next sibling, or COMPLETION_NO_NODE */
+    char c;
+    uint16_t refs;          /* the builtin and the PATH directories a name ending here is in */
+};
+
+struct trie_t {
+    struct trie_node_t *nodes;  /* nodes[0] is the root */
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t free;          /* nodes removed with their last name, linked by sibling */
+    size_t names;           /* amount of distinct names stored */
+};
+
+struct completion_t {
+    size_t len;             /* the amount of chars the prefix can be extended with */
+    size_t candidates;      /* amount of names that start with the prefix */
+    bool unique;            /* the extended prefix is a complete name and no other name continues it */
+    bool directory;         /* the unique name is a directory */
+};
+
+
+/* functions */
+/*
+ * copies the paths and starts the thread that builds the trie of all executables in paths
+ * and the builtins. returns without waiting for the thread.
+ */
+void completion_init(struct paths_t *paths);
+
+/*
+ * asks the completion thread to read the PATH directories that have changed since the last
+ * refresh again, and to insert and remove their names in the trie. the directories are watched
+ * with inotify, only the ones that can not be watched are checked for a new mtime.
+ * does not block.
+ * cwd is the directory relative paths are completed from until the next refresh.
+ */
+void completion_refresh(const char *cwd);
+
+/* stops the completion thread and frees the trie and the cached directory listings */
+void completion_free(void);
+
+/*
+ * completes the command name prefix of length len.
+ * the chars the prefix can be extended with are written to extension, at most extension_size - 1
+ * of them, and the result is NUL terminated.
+ * if the trie is not built yet, no completion is done and candidates is 0.
+ */
+struct completion_t complete_command(const char *prefix, size_t len, char *extension,
+                                     size_t extension_size);
+
+/*
+ * writes at most max names that start with prefix to out, one per line in alphabetical order.
+ * returns the amount of names written.
+ */
+size_t completion_list(const char *prefix, size_t len, size_t max, FILE *out);
+
+/*
+ * like complete_command(), but completes the last component of the path word of length len
+ * from the names in its directory.
+ * directory listings are cached and kept fresh by inotify, so completing in a directory that
+ * has not changed since the last tab makes no syscalls.
+ */
+struct completion_t complete_path(const char *word, size_t len, char *extension,
+                                  size_t extension_size);
+
+/* like completion_list() for the names complete_path() would complete word to */
+size_t completion_list_paths(const char *word, size_t len, size_t max, FILE *out);
+
+#endif
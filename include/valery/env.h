@@ -19,6 +19,8 @@
 #define ENV
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "lib/nicc/nicc.h"      // hashtable implementation
@@ -30,17 +32,56 @@
 #define SYM_USR '$'
 #define MAX_ENV_LEN 4096
 #define STARTING_PATHS 5
-#define ENV_HT_SIZE 64
-#define ALIASES_HT_SIZE 32
+#define ENV_STARTING_CAPACITY 64
+#define ENV_OVERLAY_CAPACITY 4
+#define ALIASES_STARTING_CAPACITY 32
+#define ENV_SLOT_EMPTY 0
+#define ENV_SLOT_TOMBSTONE UINT32_MAX
 
 
 /* types */
+/*
+ * key and value are stored together as "KEY=VALUE", so the entry can be handed to execve()
+ * as is. the value starts at pair + key_len + 1.
+ */
+struct env_entry_t {
+    char *pair;         /* NULL if the entry has been removed */
+    size_t key_len;
+    uint64_t hash;
+};
+
+struct env_slot_t {
+    uint64_t hash;
+    uint32_t entry;     /* index into entries + 1, ENV_SLOT_EMPTY or ENV_SLOT_TOMBSTONE */
+};
+
+/*
+ * open addressing table with linear probing. the slots store the full hash so most probes
+ * never touch an entry, and the entries are kept dense and in insertion order.
+ */
+struct env_table_t {
+    struct env_slot_t *slots;
+    size_t slots_capacity;      /* power of two */
+    size_t tombstones;
+    struct env_entry_t *entries;
+    size_t entries_len;         /* including removed entries */
+    size_t entries_capacity;
+    size_t live;
+};
+
+/*
+ * the environment is a stack of scopes. the global environment has no parent, an overlay on top
+ * of it only stores the variables that were set or removed in it, and looks everything else up
+ * in its parent. overlays are used for 'FOO=1 cmd' and subshells, so neither copies the table.
+ */
 struct env_vars_t {
-    struct ht_t *ht;    /* the hashtable that stores the environment variables */
-    char **environ;     /* list of environment variables on the form: ["KEY=VALUE", ... ] */
-    int size;
-    int capacity;
-    bool update;        /* set to true if an environment variable has changed, and environ is not outdated */
+    struct env_table_t *table;  /* the table that stores the environment variables */
+    struct env_table_t *unset;  /* variables removed in this overlay, NULL for the global scope */
+    struct env_vars_t *parent;
+    char **environ;     /* NULL terminated list of environment variables on the form: ["KEY=VALUE", ... ] */
+    size_t size;
+    size_t capacity;
+    bool update;        /* set to true if an environment variable has changed, and environ is outdated */
 };
 
 
@@ -54,7 +95,7 @@ struct paths_t {
 struct env_t {
     struct env_vars_t *env_vars;
     struct paths_t *paths;  /* unwrapped PATH environment variable */
-    struct ht_t *aliases;
+    struct env_table_t *aliases;
 
     char ps1[MAX_ENV_LEN];
     uid_t uid;
@@ -62,36 +103,65 @@ struct env_t {
 
 
 /* functions */
+struct env_table_t *env_table_malloc(size_t capacity);
+
+void env_table_free(struct env_table_t *table);
+
+/* returns the value stored under key, or NULL. len is strlen(key) and hash is env_hash(key, len) */
+char *env_table_get(struct env_table_t *table, const char *key, size_t len, uint64_t hash);
+
+void env_table_set(struct env_table_t *table, const char *key, size_t len, uint64_t hash,
+                   const char *value);
+
+/* returns true if key was in the table */
+bool env_table_rm(struct env_table_t *table, const char *key, size_t len, uint64_t hash);
+
 struct env_t *env_malloc(void);
 
 void env_free(struct env_t *env);
 
 void env_update(struct env_t *env);
 
+/* expands the escapes in PS1 into ps1. slow segments come from the last time they were computed */
+void env_update_ps1(struct env_t *env);
+
 void path_increase(struct paths_t *p, int new_len);
 
-/* returns a pointer to allocated memory for the corresponding value to the given key */
+/*
+ * returns a pointer to allocated memory for the corresponding value to the given key.
+ * the pointer is valid until the variable is set or removed.
+ */
 char *env_get(struct env_vars_t *env_vars, char *key);
 
+char *alias_get(struct env_t *env, char *key);
+
+/* returns the 64-bit FNV-1a hash of the first len bytes of key */
+uint64_t env_hash(const char *key, size_t len);
+
 /*
- * returns a pointer to the first allocated ht_item_t corresponding to the given key.
- * note: there may be multiple items allocated under the same hash.
+ * like env_get(), but for keys that are looked up over and over again, f.ex. the parameters of
+ * a compiled word. len is strlen(key) and hash is env_hash(key, len), both computed once by the
+ * caller. the hash probes the table of every scope directly, the key is never hashed again.
  */
-struct ht_item_t *env_geth(struct env_vars_t *env_vars, unsigned int hash);
+char *env_get_hashed(struct env_vars_t *env_vars, const char *key, size_t len, uint64_t hash);
 
-/* calls ht_rm() */
 void env_rm(struct env_vars_t *env_vars, char *key);
 
-/* calls ht_set() */
+/* starts a scope on top of parent. changes made to the overlay are not seen by parent */
+struct env_vars_t *env_overlay(struct env_vars_t *parent);
+
+/* throws away the overlay and everything set in it */
+void env_overlay_free(struct env_vars_t *overlay);
+
 void env_set(struct env_vars_t *env_vars, char *key, char *value);
 
 /*
- * generates the environment variables needed when executing a program on the form:
- * "KEY=VALUE". This is stored in env->environ.
- * The given env_str argument is populated with pointers to the all entries of
- * env->environ. Last entry in env_str is set to NULL.
+ * returns the environment variables needed when executing a program on the form "KEY=VALUE",
+ * in the order they were first set. the last entry is NULL.
+ * for the global scope the list is only rebuilt if a variable has changed since the last call.
+ * for an overlay the scopes are merged in a single pass over their tables.
  */
-void env_gen(struct env_vars_t *env_vars, char *env_str[env_vars->capacity]);
+char **env_gen(struct env_vars_t *env_vars);
 
 struct env_t *env_init(void);
 
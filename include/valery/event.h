@@ -0,0 +1,83 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef EVENT
+#define EVENT
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#define EVENT_MAX_PER_WAIT 16
+#define EVENT_STARTING_CAPACITY 8
+
+
+/* types */
+/* called when fd is readable */
+typedef void (*event_fd_callback_t)(void *arg, int fd);
+
+typedef void (*event_signal_callback_t)(void *arg, int signo);
+
+
+/* functions */
+/*
+ * starts the event loop. SIGINT, SIGCHLD and SIGWINCH are blocked and read from a signalfd
+ * instead, so it has to be called before any thread is started, or the threads could still
+ * receive them.
+ */
+void event_init(void);
+
+void event_free(void);
+
+/* calls callback with arg every time fd is readable. returns -1 if fd can not be polled */
+int event_add_fd(int fd, event_fd_callback_t callback, void *arg);
+
+void event_rm_fd(int fd);
+
+/*
+ * calls callback with arg once, after ms milliseconds.
+ * returns the timer, which has to be removed with event_rm_timer(), or -1.
+ */
+int event_add_timer(uint64_t ms, event_fd_callback_t callback, void *arg);
+
+void event_rm_timer(int timer);
+
+/* calls callback with arg when the signal is received, NULL ignores it */
+void event_on_signal(int signo, event_signal_callback_t callback, void *arg);
+
+/*
+ * waits up to timeout_ms milliseconds, -1 for ever, for at least one event and calls the
+ * callbacks of all events that happened.
+ */
+void event_run_once(int timeout_ms);
+
+/*
+ * reaps the child pid, handling other events until it exits. signals without a callback are
+ * dropped while waiting, the child gets its own SIGINT from the terminal.
+ * returns the result of wait4().
+ */
+pid_t event_wait_child(pid_t pid, int *status, struct rusage *usage);
+
+/*
+ * the signal mask programs have to be started with, or NULL if the loop is not running.
+ * safe to call between vfork() and execve().
+ */
+const sigset_t *event_child_sigmask(void);
+
+#endif /* !EVENT */
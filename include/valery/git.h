@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GIT
+#define GIT
+
+#include <stdbool.h>
+#include <sys/inotify.h>
+
+#include "valery/watch.h"
+
+#define GIT_CACHE_SIZE 8
+#define GIT_HEAD_MAX 256
+/* with more directories than this, the work tree is stat'ed on every prompt instead */
+#define GIT_MAX_WATCHED_DIRS 128
+#define GIT_DIRTY_SYM '*'
+
+/* git replaces HEAD and the index by renaming a lock file over them */
+#define GIT_DIR_CHANGES (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | \
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define GIT_TREE_CHANGES (WATCH_DIR_CHANGES | IN_MODIFY | IN_CLOSE_WRITE)
+
+
+/* functions */
+/*
+ * returns the branch checked out in the repository that pwd is in, the short commit hash if
+ * HEAD is detached, or NULL outside a repository. with dirty, GIT_DIRTY_SYM is appended if a
+ * tracked file differs from the index.
+ * git is never run: HEAD and the index are read directly and cached per repository until
+ * the watch thread sees them change. the string is valid until the next call.
+ */
+const char *git_prompt(const char *pwd, bool dirty);
+
+void git_free(void);
+
+#endif /* !GIT */
@@ -1,5 +1,5 @@
 /*
- *  Copyright (C) 2022 Nicolai Brand 
+ *  Copyright (C) 2022 Nicolai Brand
  *
  *  This program is free software: you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -18,12 +18,21 @@
 #ifndef HISTFILE
 #define HISTFILE
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "valery.h"
+#include "suggest.h"
 
 #define MAX_COMMANDS_BEFORE_WRITE 50
 
+#define HIST_MAGIC "VHST"
+#define HIST_VERSION 1
+/* the exit code of commands imported from the old plain text history */
+#define HIST_EXIT_UNKNOWN -1
+
 
 /* types */
 enum histaction_t {
@@ -33,68 +42,110 @@ enum histaction_t {
 
 enum readfrom_t {
     READ_FROM_MEMORY = -1,
-    READ_FROM_HIST = -2, 
-    DID_NOT_READ = -3 
+    READ_FROM_HIST = -2,
+    DID_NOT_READ = -3
+};
+
+/* starts the records file, followed by the records themselves */
+struct hist_header_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
 };
 
 /*
- * Holds recently typed in commands in and a connection to the hist file for previously
- * typed in commands.
- * 
- * pos is initialized to total_stored_commands + f_len and can move up to zero.
- * f_pos is initialized to f_len.
- * 
- * Operations on hist_t:
- * HIST_UP: decrements pos by one.
- * HIST_DOWN: increments pos by one.
+ * one command. the records file is append-only and every record has the same size, so
+ * record i is found without reading the ones before it.
+ */
+struct hist_record_t {
+    int64_t time;           /* unix time the command was started */
+    uint32_t duration_ms;
+    int32_t exit_code;
+    uint64_t cwd_id;        /* env_hash() of the working directory the command ran in */
+    uint64_t command;       /* offset of the command in the string heap */
+};
+
+/*
+ * Holds recently typed in commands and the history files mapped into memory.
  *
- * use init_history() and hist_t_free() to create and free hist_t types.
+ * The history is f_len records in the file followed by s_len records in memory that have not
+ * been written yet. pos is the absolute position in that queue and can move from zero up to
+ * the line being typed, one past the newest command.
+ *
+ * use hist_init() and hist_free() to create and free hist_t types.
  */
 struct hist_t {
-    FILE *fp;
-    char **stored_commands; /* newest last */
+    int records_fd;         /* -1 if the history files could not be opened */
+    int strings_fd;
+    void *records_map;
+    size_t records_map_size;
+    char *strings;          /* the string heap, NUL terminated commands */
+    size_t strings_size;
+    struct hist_record_t *records;
+    size_t f_len;           /* records in the file */
+
+    struct hist_record_t stored[MAX_COMMANDS_BEFORE_WRITE];
+    char **stored_commands; /* newest last, stored[i] belongs to stored_commands[i] */
     size_t s_len;           /* total stored commands in memory */
     size_t pos;             /* absolute position in history queue */
-    size_t f_pos;           /* position of file pointer in history queue */
-    size_t f_len;           /* amount of lines in hist file */
-    long f_chars;           /* amount of chars in hist file */
+
+    bool pending;           /* the last line given to hist_save() was stored and has not finished */
+    uint64_t started_ns;
+
+    struct suggest_t *suggest; /* every command in the history by prefix */
 };
 
 
 /* functions */
 
-/* returns a pointer of type hist_t with malloced data */
-struct hist_t *hist_malloc(char *full_pat_to_hist_file);
+/*
+ * returns a pointer of type hist_t with malloced data. if the records file is new, the plain
+ * text history at text_path is imported into it.
+ */
+struct hist_t *hist_malloc(char *records_path, char *strings_path, char *text_path);
 
 /* frees the data associated with the hist_t pointer passed in */
 void hist_free(struct hist_t *hist);
 
-/* moves file pointer to the end and resets position counters */
+/* moves the position back to the line being typed */
 void hist_reset_pos(struct hist_t *hist);
 
-/* stores the input buffer into memory */
+/* stores the input buffer into memory, blank lines are not stored */
 void hist_save(struct hist_t *hist, char buf[MAX_COMMAND_LEN]);
 
-/* 
- * writes the stored commands to the hist file connection and clears
- * data from memory.
+/* records how the command last given to hist_save() went */
+void hist_finish(struct hist_t *hist, int exit_code);
+
+/*
+ * appends the stored commands to the history files and clears them from memory.
+ * the files are locked while writing, so several shells can share them.
  */
 void hist_write(struct hist_t *hist);
 
+/* the amount of commands in the history, in the files and in memory */
+size_t hist_len(struct hist_t *hist);
+
+/* the record of command i, 0 is the oldest */
+struct hist_record_t *hist_record(struct hist_t *hist, size_t i);
+
+/* the command i without a trailing newline, 0 is the oldest */
+const char *hist_command(struct hist_t *hist, size_t i);
+
 /*
- * traverses the hist one line in the given direction.
- * NB: function does not make sure direction does not cause
- * hist to go out of bounds.
+ * returns the command from the history that is most likely meant when len chars of prefix
+ * have been typed, or NULL. see suggest.h for how commands are ranked.
  */
-long hist_traverse(struct hist_t *hist, enum histaction_t direction);
+const char *hist_suggest(struct hist_t *hist, const char *prefix, size_t len);
 
 /*
  * puts the current hist line into the buf argument.
- * returns where it got the hist line from (see definitions on the 
+ * returns where it got the hist line from (see definitions on the
  * top of the file).
  */
 enum readfrom_t hist_get_line(struct hist_t *hist, char buf[MAX_COMMAND_LEN], enum histaction_t action);
 
+/* opens the history files in home_folder */
 struct hist_t *hist_init(char *home_folder);
 
 #endif
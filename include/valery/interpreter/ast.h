@@ -18,8 +18,13 @@
 #ifndef VALERY_INTERPRETER_AST_H
 #define VALERY_INTERPRETER_AST_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "lexer.h"
 #include "lib/nicc/nicc.h"
+#include "valery/interpreter/impl/function.h"
 
 /* types */
 enum ExprType {
@@ -27,6 +32,11 @@ enum ExprType {
     EXPR_BINARY,
     EXPR_LITERAL,
     EXPR_COMMAND,
+    EXPR_WORD,
+    EXPR_GLOB,
+    EXPR_SUBSHELL,
+    EXPR_FUNCTION,
+    EXPR_RETURN,
     EXPR_ENUM_COUNT
 };
 
@@ -49,6 +59,7 @@ struct Expr {
 
 struct Stmt {
     enum StmtType type;
+    size_t line;
 };
 
 /* expressions */
@@ -71,9 +82,76 @@ struct LiteralExpr {
     enum LiteralType value_type; //TODO: THIS UGLY!!!!!
 };
 
+/* 2.9.1 a NAME=value prefix of a simple command */
+struct Assignment {
+    char *name;
+    struct Expr *value;         /* literal or word, without the quotes */
+    struct Assignment *next;
+};
+
 struct CommandExpr {
     struct Expr head;
+    struct Assignment *assignments;     /* linked list in source order, NULL if none */
     struct darr_t *exprs;       /* dynamic array of ast nodes */
+    char *here;                 /* here-document fed to stdin, NULL if none */
+    size_t here_len;
+    struct Expr *here_string;   /* word of a here-string fed to stdin, NULL if none */
+    struct function_t *function;    /* the function the command name resolved to, or NULL */
+    uint32_t function_version;      /* function_version when it was resolved, 0 if never */
+};
+
+/*
+ * a word that needs expansion, compiled once at parse time into a plan of parts.
+ * evaluating the word resolves each part in order and concatenates the results, so the
+ * original word is never scanned again.
+ */
+enum WordPartType {
+    WORD_LITERAL,           /* slice of the word that is copied as is */
+    WORD_PARAM,             /* $NAME, ${NAME}, ${NAME:-fallback} or ${NAME-fallback} */
+    WORD_POSITIONAL,        /* $0 to $9 or ${N}, the number is stored in len */
+    WORD_ARG_COUNT,         /* $# */
+    WORD_ALL_ARGS,          /* $@ and $*, the positional parameters separated by spaces */
+    WORD_COMMAND_SUBST      /* $(...) */
+};
+
+struct WordPart {
+    enum WordPartType type;
+    char *str;                      /* literal slice, or NUL terminated parameter name */
+    size_t len;
+    uint64_t hash;                  /* precomputed hash of the parameter name */
+    struct WordExpr *fallback;      /* used when the parameter is unset, NULL if none */
+    bool fallback_if_empty;         /* ':-' also uses the fallback for empty parameters */
+    struct darr_t *statements;      /* parsed body of a command substitution */
+};
+
+struct WordExpr {
+    struct Expr head;
+    struct WordPart *parts;
+    size_t parts_len;
+};
+
+/* a word with wildcards, expands to every path matching it */
+struct GlobExpr {
+    struct Expr head;
+    struct glob_pattern_t *pattern;     /* compiled once at parse time */
+};
+
+/* '(' list ')', runs the statements with an environment and working directory of their own */
+struct SubshellExpr {
+    struct Expr head;
+    struct darr_t *statements;
+};
+
+/* fname '(' ')' function_body, defines the function when it is evaluated */
+struct FunctionExpr {
+    struct Expr head;
+    struct function_t *function;
+};
+
+/* 'return [n]', n is NULL if the exit code of the last command is returned */
+struct ReturnExpr {
+    struct Expr head;
+    struct Expr *code;
 };
 
 struct VariableExpr {
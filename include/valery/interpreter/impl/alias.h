@@ -0,0 +1,80 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VALERY_INTERPRETER_IMPL_ALIAS_H
+#define VALERY_INTERPRETER_IMPL_ALIAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "valery/env.h"
+#include "valery/interpreter/lexer.h"
+
+#define ALIAS_CACHE_STARTING_CAPACITY 16
+/* an alias can expand to another alias at most this many times */
+#define ALIAS_MAX_DEPTH 16
+#define ALIAS_NO_NEXT SIZE_MAX
+
+
+/* types */
+/* an alias changed inside a scope and the value it had before, NULL if it was not set */
+struct alias_undo_t {
+    char *name;
+    char *previous;
+};
+
+
+/* functions */
+/*
+ * aliases are looked up in the given table, which the alias and unalias builtins change.
+ * the tokens of an alias value are cached the first time it is used.
+ */
+void alias_init(struct env_table_t *aliases);
+
+void alias_free(void);
+
+/*
+ * forgets the cached tokens of the alias name.
+ * must be called every time the alias is set or removed.
+ */
+void alias_invalidate(const char *name);
+
+/*
+ * remembers the current value of the alias name, so the scope it is changed in can be undone.
+ * must be called before the alias is set or removed.
+ */
+void alias_save(const char *name, size_t len, uint64_t hash);
+
+/*
+ * starts a scope, f.ex. a subshell. aliases set or removed until alias_scope_end() is called
+ * with the returned mark get back the value they had before.
+ */
+size_t alias_scope_begin(void);
+
+void alias_scope_end(size_t mark);
+
+/*
+ * 2.3.1
+ * if the word at tokenlist->pos names an alias, it is replaced by the tokens of the alias value.
+ * the first word of the value is expanded again unless it is an alias that is already being
+ * expanded, and if a value ends with a blank the word after it is expanded as well.
+ * the replacement tokens are copied onto the ast arena, so the value is not lexed again.
+ */
+void alias_expand(struct tokenlist_t *tokenlist);
+
+#endif /* !VALERY_INTERPRETER_IMPL_ALIAS_H */
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (C) 2023 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VALERY_INTERPRETER_IMPL_CAPTURE_H
+#define VALERY_INTERPRETER_IMPL_CAPTURE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define CAPTURE_READ_SIZE 65536
+
+/* types */
+/*
+ * growable buffer that the output of command substitutions is captured into.
+ * the buffer is used like a stack: a nested substitution starts capturing at the current end
+ * and gives the space back once its result has been taken out, so a single buffer serves all
+ * substitutions and is never shrunk.
+ */
+struct capture_t {
+    char *buf;
+    size_t len;
+    size_t capacity;
+    FILE *stream;       /* unbuffered stream that writes straight into buf */
+};
+
+
+/* functions */
+struct capture_t *capture_malloc(void);
+
+void capture_free(struct capture_t *capture);
+
+/* appends n bytes of data to the end of the capture buffer */
+void capture_write(struct capture_t *capture, const char *data, size_t n);
+
+/*
+ * reads from fd until end of file straight into the capture buffer.
+ * @returns 0 on success, else 1
+ */
+int capture_read_fd(struct capture_t *capture, int fd);
+
+/*
+ * starts a new capture.
+ * @returns a mark that must be given to capture_end()
+ */
+size_t capture_begin(struct capture_t *capture);
+
+/*
+ * ends the capture started at mark. trailing newlines are trimmed in place.
+ * the captured output is terminated and returned, and is valid until the next write.
+ * the space is then handed back, so the caller has to copy it somewhere before that.
+ */
+char *capture_end(struct capture_t *capture, size_t mark, size_t *len);
+
+#endif /* !VALERY_INTERPRETER_IMPL_CAPTURE_H */
@@ -18,7 +18,40 @@
 #ifndef VALERY_INTERPRETER_IMPL_EXEC_H
 #define VALERY_INTERPRETER_IMPL_EXEC_H
 
+#include "valery/interpreter/impl/capture.h"
 
-int valery_exec_program(int argc, char *argv[]);
+
+/* types */
+/* the ways a program can be started, they differ in how much of the shell the kernel copies */
+enum exec_strategy_t {
+    EXEC_FORK,
+    EXEC_VFORK,
+    EXEC_POSIX_SPAWN,
+    EXEC_STRATEGY_COUNT
+};
+
+
+/* globals */
+/* how programs are started, EXEC_FORK unless changed. only the benchmarks change it */
+extern enum exec_strategy_t exec_strategy;
+
+extern const char *exec_strategy_names[EXEC_STRATEGY_COUNT];
+
+
+/* functions */
+/*
+ * starts the program given by argv[0] with the environment envp and waits for it to finish.
+ * if fd_in is not -1, it is used as stdin for the program.
+ * @returns 0 if the program exited successfully, else 1
+ */
+int valery_exec_program(int argc, char *argv[], char *envp[], int fd_in);
+
+/*
+ * like valery_exec_program(), but the stdout of the program is read into the capture buffer
+ * through a pipe.
+ * @returns 0 if the program exited successfully, else 1
+ */
+int valery_exec_capture(int argc, char *argv[], char *envp[], int fd_in,
+                        struct capture_t *capture);
 
 #endif /* !VALERY_INTERPRETER_IMPL_EXEC_H */
@@ -0,0 +1,69 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VALERY_INTERPRETER_IMPL_FUNCTION_H
+#define VALERY_INTERPRETER_IMPL_FUNCTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lib/nicc/nicc.h"
+
+#define FUNCTION_STARTING_CAPACITY 64
+/* deeper recursion is an error instead of a stack overflow */
+#define FUNCTION_MAX_DEPTH 1000
+
+
+/* types */
+/* a function and its body live on the persistent ast arena, so they never move or go away */
+struct function_t {
+    char *name;
+    uint64_t hash;
+    struct darr_t *statements;  /* the body, parsed once when the definition was parsed */
+};
+
+
+/* a function_define() inside a scope and the function it replaced, NULL if none */
+struct function_undo_t {
+    struct function_t *defined;
+    struct function_t *previous;
+};
+
+
+/* globals */
+/* incremented every time a function is defined, so cached lookups know they may be outdated */
+extern uint32_t function_version;
+
+
+/* functions */
+/* makes the name of the function refer to it, replacing any earlier function of that name */
+void function_define(struct function_t *function);
+
+/*
+ * starts a scope, f.ex. a subshell. functions defined until function_scope_end() is called with
+ * the returned mark are forgotten then, and the ones they replaced are back.
+ */
+size_t function_scope_begin(void);
+
+void function_scope_end(size_t mark);
+
+/* returns the function named name, or NULL */
+struct function_t *function_get(const char *name);
+
+void function_free(void);
+
+#endif /* !VALERY_INTERPRETER_IMPL_FUNCTION_H */
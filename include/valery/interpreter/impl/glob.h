@@ -0,0 +1,79 @@
+/*
+ *  Copyright (C) 2023 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VALERY_INTERPRETER_IMPL_GLOB_H
+#define VALERY_INTERPRETER_IMPL_GLOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "lib/nicc/nicc.h"
+
+/* buffer size for each getdents64 call, large enough to read most directories in one go */
+#define GLOB_DIRENT_BUF_SIZE (1 << 20)
+
+/* types */
+/*
+ * one '/' separated component of a pattern.
+ * prefix_len and suffix_len are the fixed chars before the first and after the last wildcard,
+ * they are compared first so most names are rejected without running the matcher.
+ */
+struct glob_segment_t {
+    char *text;
+    size_t len;
+    bool literal;           /* contains no wildcards */
+    size_t prefix_len;
+    size_t suffix_len;
+};
+
+struct glob_pattern_t {
+    char *word;             /* the pattern as written, used as is if nothing matches */
+    bool absolute;
+    bool dirs_only;         /* the pattern ends with a '/', so only directories match */
+    struct glob_segment_t *segments;
+    size_t segments_len;
+};
+
+
+/* functions */
+/* returns true if the word contains any of the wildcards '*' and '?' */
+bool glob_has_wildcard(const char *word);
+
+/*
+ * splits the pattern into segments and precomputes what is needed to match them.
+ * the compiled pattern is allocated on the ast arena.
+ */
+struct glob_pattern_t *glob_compile(char *word);
+
+/*
+ * 2.13.3
+ * appends the sorted paths that match the pattern to results. the paths are allocated on the
+ * ast arena. if nothing matches, the pattern itself is appended.
+ * @returns the amount of matches
+ */
+size_t glob_expand(struct glob_pattern_t *pattern, struct darr_t *results);
+
+/*
+ * forgets all directories read by glob_expand(). the words of one command share the listings,
+ * so this is called once they are expanded, before the command can change the directories.
+ */
+void glob_cache_clear(void);
+
+/* forgets the directories and frees the buffer they are read into */
+void glob_free(void);
+
+#endif /* !VALERY_INTERPRETER_IMPL_GLOB_H */
@@ -0,0 +1,33 @@
+/*
+ *  Copyright (C) 2023 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VALERY_INTERPRETER_IMPL_HEREDOC_H
+#define VALERY_INTERPRETER_IMPL_HEREDOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* functions */
+/*
+ * writes the body of a here-document or here-string into an anonymous memory backed file.
+ * the file is sealed against further modification and rewound, so it can be used as stdin.
+ * if append_newline is true, a newline is written after the body.
+ * @returns the file descriptor, or -1 on error. the caller closes it.
+ */
+int heredoc_open(const char *body, size_t len, bool append_newline);
+
+#endif /* !VALERY_INTERPRETER_IMPL_HEREDOC_H */
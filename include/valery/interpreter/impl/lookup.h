@@ -0,0 +1,45 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand 
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VALERY_INTERPRETER_IMPL_LOOKUP_H
+#define VALERY_INTERPRETER_IMPL_LOOKUP_H
+
+#include <stddef.h>
+
+#include "valery/env.h"
+
+#define LOOKUP_STARTING_CAPACITY 128
+#define LOOKUP_NOT_FOUND -1
+
+/*
+ * watches every directory in the PATH of env, or its parent if it does not exist yet, so cached
+ * lookups are forgotten as soon as executables are added to or removed from it.
+ * when PATH has changed, the next lookup starts over with the directories of the new one.
+ * if watch_init() has not been called, nothing is cached and every lookup searches PATH.
+ */
+void lookup_init(struct env_t *env);
+
+void lookup_free(void);
+
+/*
+ * finds the executable the command name refers to. names containing a '/' are used as is.
+ * the path of the executable is written to result.
+ * @returns COMMAND_IN_PATH, COMMAND_IS_PATH or COMMAND_NOT_FOUND
+ */
+int command_lookup(const char *name, char *result, size_t result_size);
+
+#endif /* !VALERY_INTERPRETER_IMPL_LOOKUP_H */
@@ -18,11 +18,18 @@
 #define VALERY_INTERPRETER_INTERPRETER_H
 
 #include "parser.h"
+#include "valery/env.h"
 
 /*
  * interprets a list of statements
- * @returns exit code of the interpreter
+ * @returns the exit code of the last command executed
  */
 int interpret(struct darr_t *statements);
 
+/* gives the interpreter the environment that words are expanded against */
+void interpret_init(struct env_t *env);
+
+/* frees the memory the interpreter keeps between calls to interpret() */
+void interpret_free(void);
+
 #endif /* VALERY_INTERPRETER_INTERPRETER_H */
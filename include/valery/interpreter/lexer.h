@@ -60,6 +60,8 @@ enum tokentype_t {
     T_GREATER_EQUAL,
     T_LESS,
     T_LESS_EQUAL,
+    T_DLESS,
+    T_TLESS,
     T_LBRACKET,
     T_LBRACKET_LBRACKET,
     T_RBRACKET,
@@ -86,6 +88,7 @@ enum tokentype_t {
 
 struct token_t {
     enum tokentype_t type;
+    size_t line;            /* of the source the token starts on, counting from 1 */
     char *lexeme;
     void *literal;
     size_t literal_size;
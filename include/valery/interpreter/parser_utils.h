@@ -23,6 +23,8 @@
 #include "valery/valery.h"              // VA_NUMBER_OF_ARGS
 #include "valery/interpreter/parser.h"
 
+struct m_arena;                         // lib/sac/sac.h
+
 /* functions */
 bool check_single(enum tokentype_t type);
 
@@ -53,13 +55,28 @@ void *consume(enum tokentype_t type, char *err_msg);
 
 /*
  * @returns an Expr/Stmt object based on the provided type.
- * some Expr/Stmt types need the token to f.ex. grab the literal value
+ * some Expr/Stmt types need the token to f.ex. grab the literal value,
+ * statements take the line they start on from it.
  */
 struct Expr *expr_alloc(enum ExprType type, struct token_t *token);
 struct Stmt *stmt_alloc(enum StmtType type, struct token_t *token);
 
+/*
+ * allocates memory that lives as long as the abstract syntax tree of the current command line
+ */
+void *ast_arena_alloc(size_t size);
+
 void ast_arena_init();
 void ast_arena_clear();
 void ast_arena_release();
 
+/*
+ * makes ast_arena_alloc() allocate in the arena that is only released when the shell exits,
+ * until ast_arena_persist_end() is called with what this returned.
+ * used for nodes that must outlive the command line, like the bodies of functions.
+ */
+struct m_arena *ast_arena_persist_begin(void);
+void ast_arena_persist_end(struct m_arena *previous);
+void ast_arena_persist_release(void);
+
 #endif /* VALERY_INTERPRETER_PARSER_UTILS_H */
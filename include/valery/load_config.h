@@ -22,8 +22,19 @@
 
 #include "valery/env.h"
 
+#define SNAPSHOT_MAGIC "VALSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HASH_SEED 0xcbf29ce484222325
+#define SNAPSHOT_ENV 'E'
+
 /* functions */
 
+/*
+ * sets the environment variables and PATH from the config.
+ * the variables the config sets are saved in a snapshot next to the config, which is mapped
+ * instead of parsing the config again on the next start as long as the config has the same
+ * size, mtime and contents. PATH is unwrapped from the environment every time.
+ */
 int parse_config(struct env_vars_t *env_vars, struct paths_t *p);
 
 /*
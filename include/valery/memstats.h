@@ -0,0 +1,61 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMSTATS
+#define MEMSTATS
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "valery/valery.h"
+
+#define MEMSTATS_STARTING_CAPACITY 1024
+
+
+/* types */
+struct memstats_t {
+    size_t live;            /* bytes allocated and not yet freed */
+    size_t peak;            /* the most live bytes at any point */
+    uint64_t allocs;
+    uint64_t reallocs;
+    uint64_t frees;
+};
+
+
+/* functions */
+/*
+ * records that ptr holds size bytes allocated by a file of the subsystem tag.
+ * resized is true if ptr came from resizing an allocation memstats_free() was called on.
+ */
+void memstats_alloc(void *ptr, size_t size, enum mem_tag_t tag, bool resized);
+
+/*
+ * forgets the allocation at ptr, memory that was not counted is ignored.
+ * has to be called before ptr is freed or resized, or another thread could be given the same
+ * address first.
+ */
+void memstats_free(void *ptr, bool resized);
+
+/* prints the counters of every subsystem that allocated anything to out */
+void memstats_print(FILE *out);
+
+/* sets the counts to zero and the peaks to what is live now */
+void memstats_clear(void);
+
+#endif /* !MEMSTATS */
@@ -0,0 +1,71 @@
+/*
+ *  Times the phases of running a command line, enabled by VALERY_PROFILE=1 or --profile.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PROFILE
+#define PROFILE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define PROFILE_ENV "VALERY_PROFILE"
+/* bucket i of a histogram counts durations from 2^i up to 2^(i+1) microseconds */
+#define PROFILE_BUCKETS 32
+
+
+/* types */
+enum profile_phase_t {
+    PROFILE_TOKENIZE,
+    PROFILE_PARSE,
+    PROFILE_INTERPRET,
+    PROFILE_SPAWN,      /* fork(), vfork() or posix_spawn() as seen from the shell */
+    PROFILE_WAIT,       /* waiting for the program to exit */
+    PROFILE_PHASE_COUNT
+};
+
+
+/* globals */
+/* checked before anything is timed, so a disabled profiler costs a branch per phase */
+extern bool profile_enabled;
+
+
+/* functions */
+/* enables the profiler if VALERY_PROFILE is set to anything but 0 */
+void profile_init(void);
+
+/* monotonic clock in nanoseconds, for anything in the shell that measures a duration */
+uint64_t profile_now(void);
+
+/* adds the time since start to the phase of the current line */
+void profile_add(enum profile_phase_t phase, uint64_t start);
+
+/*
+ * profile_begin() returns a timestamp to pass to profile_end(), or 0 if the profiler is disabled.
+ * they are macros so a disabled profiler does not even make a call.
+ */
+#define profile_begin() (profile_enabled ? profile_now() : 0)
+#define profile_end(phase, start) do { if (profile_enabled) profile_add((phase), (start)); } while (0)
+
+/* prints how long each phase of the line took to stderr and adds them to the histograms */
+void profile_line_end(void);
+
+/* prints a histogram per phase of every line so far */
+void profile_report(FILE *out);
+
+#endif /* !PROFILE */
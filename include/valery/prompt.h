@@ -20,10 +20,14 @@
 #ifndef PROMPT
 #define PROMPT
 
+#include <stdbool.h>
 #include <termios.h>
 #include "valery/histfile.h"
 #include "valery/env.h"
 
+#define PROMPT_INPUT_BUF_SIZE 256
+
+
 /* types */
 struct termconf_t {
     struct termios original;
@@ -35,11 +39,24 @@ struct prompt_t {
     unsigned int buf_size;
     unsigned int buf_capacity;
     unsigned int cursor_position;
+    const char *suggestion; /* a command from the history starting with buf, or NULL */
     struct termconf_t *termconf;
+
+    /* read from the terminal but not handled yet, may outlive one prompt() */
+    char input[PROMPT_INPUT_BUF_SIZE];
+    unsigned int input_pos;
+    unsigned int input_len;
+    bool input_polled;      /* false if the terminal can not be waited on with the event loop */
+    bool input_eof;
+
+    /* only valid while prompt() runs */
+    struct env_t *env;
+    bool interrupted;
+    int deadline_timer;     /* until it fires, fresh segments of PS1 are drawn */
 };
 
 /* handles all the logic when receiving input from the user */
-void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1);
+void prompt(struct prompt_t *prompt, struct hist_t *hist, struct env_t *env);
 
 struct prompt_t *prompt_malloc(void);
 
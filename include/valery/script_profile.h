@@ -0,0 +1,65 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCRIPT_PROFILE
+#define SCRIPT_PROFILE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define SCRIPT_PROFILE_STARTING_CAPACITY 64
+#define SCRIPT_PROFILE_DEFAULT_TOP 20
+/* source shown per line in the report and in the frames of the collapsed stacks */
+#define SCRIPT_PROFILE_TEXT_MAX 48
+#define SCRIPT_PROFILE_FOLDED_SUFFIX ".folded"
+
+
+/* globals */
+/* set by script_profile_init() */
+extern bool script_profile_enabled;
+
+
+/* functions */
+/* enables the profiler for the script at path, source is its contents and has to outlive it */
+void script_profile_init(const char *path, const char *source);
+
+/* starts measuring a statement that starts on line of the script */
+void script_profile_push(size_t line);
+
+/* stops measuring the statement of the last script_profile_push() */
+void script_profile_pop(void);
+
+/* counts a process started by the current statement */
+void script_profile_spawned(void);
+
+/* script_profile_begin() and script_profile_end() go around every statement */
+#define script_profile_begin(line) do { if (script_profile_enabled) script_profile_push(line); } while (0)
+#define script_profile_end() do { if (script_profile_enabled) script_profile_pop(); } while (0)
+
+/* prints the lines that took the most wall time, including what they called, to out */
+void script_profile_report(FILE *out, size_t top);
+
+/*
+ * writes the self time of every stack of lines in microseconds to out in the collapsed format
+ * flamegraph.pl and speedscope read, one 'script;12: f;3: sleep 1 1000512' per line.
+ */
+void script_profile_collapsed(FILE *out);
+
+void script_profile_free(void);
+
+#endif /* !SCRIPT_PROFILE */
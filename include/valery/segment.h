@@ -0,0 +1,61 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SEGMENT
+#define SEGMENT
+
+#include "valery/git.h"
+
+#define SEGMENT_MAX (GIT_HEAD_MAX + 1)
+/* how long after the prompt is drawn a fresh segment may still redraw it */
+#define SEGMENT_DEFAULT_DEADLINE_MS 500
+
+
+/* types */
+/* the parts of PS1 that may be too slow to compute while the user waits */
+enum segment_kind_t {
+    SEGMENT_GIT,            /* \G */
+    SEGMENT_GIT_DIRTY,      /* \g */
+    SEGMENT_COUNT
+};
+
+
+/* functions */
+/*
+ * starts the thread that computes segments.
+ * if it can not be started, segment_get() computes them itself.
+ */
+void segment_init(void);
+
+void segment_free(void);
+
+/*
+ * returns the last value of the segment computed for pwd, or "" if there is none yet, and asks
+ * the segment thread for a fresh value. the string is valid until the next call with kind.
+ */
+const char *segment_get(enum segment_kind_t kind, const char *pwd);
+
+/*
+ * returns a file descriptor that becomes readable when a segment got a value that differs from
+ * the one segment_get() returned, or -1 if there is no segment thread.
+ */
+int segment_fd(void);
+
+/* empties segment_fd() */
+void segment_clear_fd(void);
+
+#endif /* !SEGMENT */
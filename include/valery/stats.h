@@ -0,0 +1,51 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS
+#define STATS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#define STATS_STARTING_CAPACITY 64
+#define STATS_DEFAULT_TOP 10
+
+
+/* types */
+/* the resources used by every run of one command name in this session */
+struct stats_entry_t {
+    char *name;
+    uint64_t runs;
+    uint64_t user_us;
+    uint64_t sys_us;
+    long max_rss_kb;        /* of the single largest run */
+    uint64_t ctx_switches;  /* voluntary and involuntary */
+};
+
+
+/* functions */
+/* adds the resources a finished program used, as reported by wait4(), to its command name */
+void stats_record(const char *name, struct rusage *usage);
+
+/* prints the top commands by cpu time and by max rss to out */
+void stats_print(FILE *out, size_t top);
+
+void stats_free(void);
+
+#endif /* !STATS */
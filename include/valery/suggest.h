@@ -0,0 +1,76 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SUGGEST
+#define SUGGEST
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SUGGEST_STARTING_CAPACITY 1024
+/* every use of a command counts half as much after this many seconds */
+#define SUGGEST_HALF_LIFE (3 * 24 * 60 * 60)
+#define SUGGEST_NONE UINT32_MAX
+
+
+/* types */
+/* a trie node, children are a linked list through next_sibling */
+struct suggest_node_t {
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t best;          /* the entry with the highest score in this subtree */
+    uint32_t entry;         /* the entry that ends at this node, or SUGGEST_NONE */
+    char c;
+};
+
+/*
+ * the score of a command is log2 of the sum of 2^(t / SUGGEST_HALF_LIFE) over the times t it
+ * was used. that is frequency weighted by recency, but as time passes every score decays by the
+ * same factor, so the order of commands never changes and the best entry of a subtree only has
+ * to be updated when one of its commands is used.
+ */
+struct suggest_entry_t {
+    char *command;
+    double score;
+};
+
+/* a prefix index of every distinct command in the history */
+struct suggest_t {
+    struct suggest_node_t *nodes;
+    uint32_t nodes_len;
+    uint32_t nodes_capacity;
+    struct suggest_entry_t *entries;
+    uint32_t entries_len;
+    uint32_t entries_capacity;
+};
+
+
+/* functions */
+struct suggest_t *suggest_malloc(void);
+
+void suggest_free(struct suggest_t *suggest);
+
+/* records a use of the command at unix time, in time proportional to len */
+void suggest_add(struct suggest_t *suggest, const char *command, size_t len, int64_t time);
+
+/*
+ * returns the command with the highest score that starts with the len chars of prefix, or NULL.
+ * takes time proportional to len, no matter how many commands there are.
+ */
+const char *suggest_get(struct suggest_t *suggest, const char *prefix, size_t len);
+
+#endif /* !SUGGEST */
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TABLE
+#define TABLE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "valery/valery.h"
+
+#define TABLE_SLOT_EMPTY 0
+
+#ifdef VALERY_MEM_TAG
+#       define TABLE_MEM_TAG VALERY_MEM_TAG
+#else
+#       define TABLE_MEM_TAG MEM_OTHER
+#endif
+
+/*
+ * an empty table of items of item_type. the slots are allocated on the first table_put(), and
+ * are counted towards the subsystem of the file the table is defined in.
+ */
+#define TABLE_INIT(item_type, capacity) { .item_size = sizeof(item_type), \
+                                          .starting_capacity = (capacity), .tag = TABLE_MEM_TAG }
+
+
+/* types */
+/*
+ * open addressing with linear probing, keeping at most half of the slots in use.
+ * the items are stored in the slots, next to the hash of their key, so most probes never
+ * compare a key. removing an item moves the items after it back instead of leaving a tombstone.
+ * any table_put() or table_rm() may move the items, pointers to them are only valid until then.
+ */
+struct table_t {
+    uint64_t *hashes;           /* TABLE_SLOT_EMPTY if the slot is empty */
+    char *items;
+    size_t item_size;
+    size_t len;
+    size_t capacity;            /* power of two, or 0 until the first table_put() */
+    size_t starting_capacity;   /* power of two */
+    enum mem_tag_t tag;
+    /* allocated with calloc() and free(), so the table of memstats does not count itself */
+    bool uncounted;
+};
+
+/* returns true if item has the key */
+typedef bool (*table_eq_t)(const void *item, const void *key);
+
+
+/* functions */
+/* returns the item with key, or NULL */
+void *table_get(struct table_t *table, uint64_t hash, const void *key, table_eq_t eq);
+
+/*
+ * returns the item with key. if there is none, a zeroed item is added first and *added is set,
+ * and the caller has to fill in the key.
+ * @returns NULL if an uncounted table could not grow
+ */
+void *table_put(struct table_t *table, uint64_t hash, const void *key, table_eq_t eq,
+                bool *added);
+
+/* removes item, which table_get() or table_put() returned */
+void table_rm(struct table_t *table, void *item);
+
+/*
+ * removes every item keep returns false for. keep may free what the item points to before
+ * returning false.
+ */
+void table_filter(struct table_t *table, bool (*keep)(void *item, void *arg), void *arg);
+
+/*
+ * returns the first item in slot *i or after, and moves *i past it, or NULL once all items have
+ * been seen. start with *i = 0.
+ */
+void *table_next(struct table_t *table, size_t *i);
+
+/* frees the slots, the table is empty afterwards and may be used again */
+void table_free(struct table_t *table);
+
+#endif /* !TABLE */
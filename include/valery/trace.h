@@ -0,0 +1,71 @@
+/*
+ *  Records every executed command into a ring buffer, like 'set -x' but kept in memory.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE
+#define TRACE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "valery/profile.h"
+
+/* a power of two, the oldest entries are overwritten */
+#define TRACE_CAPACITY 256
+/* the expanded argv is joined by spaces and cut off at this length */
+#define TRACE_ARGV_MAX 160
+
+
+/* types */
+/* fixed size, so recording a command never allocates */
+struct trace_entry_t {
+    uint64_t seq;
+    uint64_t duration_ns;
+    int exit_code;
+    char argv[TRACE_ARGV_MAX];
+};
+
+
+/* globals */
+/* switched by the trace builtin */
+extern bool trace_enabled;
+
+
+/* functions */
+/* adds the command to the ring buffer, and writes it to the stream fd if one is set */
+void trace_record(int argc, char **argv, int exit_code, uint64_t start);
+
+/* writes the entries in the ring buffer to out, oldest first */
+void trace_dump(FILE *out);
+
+void trace_clear(void);
+
+/* every recorded entry is also written to fd from now on, -1 stops it */
+void trace_stream(int fd);
+
+/*
+ * trace_begin() returns a timestamp to pass to trace_end(), or 0 if tracing is disabled.
+ * a command is only recorded if tracing was enabled both before and after it ran.
+ */
+#define trace_begin() (trace_enabled ? profile_now() : 0)
+#define trace_end(argc, argv, exit_code, start) \
+    do { if (trace_enabled && (start) != 0) trace_record((argc), (argv), (exit_code), (start)); } \
+    while (0)
+
+#endif /* !TRACE */
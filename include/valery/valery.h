@@ -22,7 +22,11 @@
 /* variables */
 #define MAX_COMMAND_LEN 1024
 #define CONFIG_NAME ".valeryrc"
-#define HISTFILE_NAME ".valery_hist"
+#define HISTFILE_NAME ".valery_history"
+#define HISTFILE_STRINGS_NAME ".valery_history_strings"
+/* the plain text history of earlier versions */
+#define HISTFILE_TEXT_NAME ".valery_hist"
+#define SNAPSHOT_NAME ".valery_snapshot"
 
 #ifdef DEBUG_VERBOSE
 //#       define DEBUG_ENV
@@ -69,9 +73,40 @@ void _valery_error(const char *msg, const char *file, const char *func, const in
 #ifndef VALLOC_IMPLEMENTATION
 #       define VALLOC_IMPLEMENTATION
 #endif
+
+/*
+ * built with VALERY_MEMSTATS, every allocation is counted towards the subsystem of the file it
+ * is made in. a file picks its subsystem by defining VALERY_MEM_TAG before its first include.
+ */
+enum mem_tag_t {
+    MEM_OTHER,
+    MEM_LEXER,
+    MEM_PARSER,
+    MEM_INTERPRETER,
+    MEM_ENV,
+    MEM_HISTORY,
+    MEM_PROMPT,
+    MEM_TAG_COUNT
+};
+
+#ifdef VALERY_MEMSTATS
+#       ifndef VALERY_MEM_TAG
+#               define VALERY_MEM_TAG MEM_OTHER
+#       endif
+void *_vmalloc(size_t size, enum mem_tag_t tag);
+void *_vcalloc(size_t nitems, size_t size, enum mem_tag_t tag);
+void *_vrealloc(void *ptr, size_t size, enum mem_tag_t tag);
+#       define vmalloc(s) _vmalloc(s, VALERY_MEM_TAG)
+#       define vcalloc(n, s) _vcalloc(n, s, VALERY_MEM_TAG)
+#       define vrealloc(p, s) _vrealloc(p, s, VALERY_MEM_TAG)
+#else
 void *vmalloc(size_t size);
 void *vcalloc(size_t nitems, size_t size);
 void *vrealloc(void *ptr, size_t size);
+#endif /* VALERY_MEMSTATS */
+
+/* frees memory from the functions above, or from anywhere else */
+void vfree(void *ptr);
 
 
 #endif /* VALERY_H */
@@ -0,0 +1,65 @@
+/*
+ *  Tells interested parts of the shell when watched directories change.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef WATCH
+#define WATCH
+
+#include <stdint.h>
+#include <sys/inotify.h>
+
+/* the changes to a directory that make a listing of it outdated */
+#define WATCH_DIR_CHANGES (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                           IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+#define WATCH_EVENT_BUF_SIZE 4096
+#define WATCH_STARTING_CAPACITY 32
+
+
+/* types */
+/*
+ * called from the watch thread with the inotify mask of the event.
+ * if the kernel's event queue overflowed, every callback is called with IN_Q_OVERFLOW in the mask,
+ * and has to assume anything it watches has changed.
+ * the callback must be quick and must not call watch_add() or watch_rm().
+ */
+typedef void (*watch_callback_t)(void *arg, uint32_t mask);
+
+
+/* functions */
+/*
+ * starts the thread that reads inotify events.
+ * if inotify is not available, watch_add() fails and callers have to poll instead.
+ */
+void watch_init(void);
+
+void watch_free(void);
+
+/*
+ * calls callback with arg every time an event in mask happens to path.
+ * several callbacks may watch the same path.
+ * returns the watch descriptor, or -1 if the path could not be watched.
+ */
+int watch_add(const char *path, uint32_t mask, watch_callback_t callback, void *arg);
+
+/*
+ * stops calling callback with arg for the watch descriptor wd.
+ * when watch_rm() returns, the callback is not running and will not be called again.
+ */
+void watch_rm(int wd, watch_callback_t callback, void *arg);
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "builtins/builtins.h"
+#include "valery/env.h"
+#include "valery/interpreter/impl/alias.h"
+
+
+static void alias_print(char *pair, size_t key_len, FILE *out)
+{
+    fprintf(out, "alias %.*s='%s'\n", (int)key_len, pair, pair + key_len + 1);
+}
+
+int alias(struct env_table_t *aliases, char **args, int arg_count, FILE *out)
+{
+    if (arg_count == 0) {
+        for (size_t i = 0; i < aliases->entries_len; i++) {
+            struct env_entry_t *entry = &aliases->entries[i];
+            if (entry->pair != NULL)
+                alias_print(entry->pair, entry->key_len, out);
+        }
+        return 0;
+    }
+
+    int rc = 0;
+    for (int i = 0; i < arg_count; i++) {
+        char *equal = strchr(args[i], '=');
+        size_t len = equal != NULL ? (size_t)(equal - args[i]) : strlen(args[i]);
+        uint64_t hash = env_hash(args[i], len);
+
+        if (equal == NULL) {
+            char *value = env_table_get(aliases, args[i], len, hash);
+            if (value == NULL) {
+                fprintf(stderr, "alias: %s: not found\n", args[i]);
+                rc = 1;
+            } else {
+                fprintf(out, "alias %s='%s'\n", args[i], value);
+            }
+            continue;
+        }
+
+        if (len == 0) {
+            fprintf(stderr, "alias: '%s': invalid alias name\n", args[i]);
+            rc = 1;
+            continue;
+        }
+        alias_save(args[i], len, hash);
+        *equal = 0;
+        env_table_set(aliases, args[i], len, hash, equal + 1);
+        alias_invalidate(args[i]);
+        *equal = '=';
+    }
+    return rc;
+}
+
+int unalias(struct env_table_t *aliases, char **args, int arg_count)
+{
+    if (arg_count == 1 && strcmp(args[0], "-a") == 0) {
+        for (size_t i = 0; i < aliases->entries_len; i++) {
+            struct env_entry_t *entry = &aliases->entries[i];
+            if (entry->pair == NULL)
+                continue;
+            alias_save(entry->pair, entry->key_len, entry->hash);
+            entry->pair[entry->key_len] = 0;
+            alias_invalidate(entry->pair);
+            entry->pair[entry->key_len] = '=';
+            env_table_rm(aliases, entry->pair, entry->key_len, entry->hash);
+        }
+        return 0;
+    }
+
+    int rc = 0;
+    for (int i = 0; i < arg_count; i++) {
+        size_t len = strlen(args[i]);
+        uint64_t hash = env_hash(args[i], len);
+        alias_save(args[i], len, hash);
+        if (!env_table_rm(aliases, args[i], len, hash)) {
+            fprintf(stderr, "unalias: %s: not found\n", args[i]);
+            rc = 1;
+            continue;
+        }
+        alias_invalidate(args[i]);
+    }
+    return rc;
+}
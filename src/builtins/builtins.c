@@ -16,9 +16,130 @@
  */
 
 #include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
 
+#include "builtins/builtins.h"
+#include "valery/env.h"
+#include "valery/histfile.h"
 
-char *builtin_names[] = {"cd", "which", "history", "help", "pwd"};
+
+char *builtin_names[] = {"cd", "which", "history", "help", "pwd", "alias", "unalias", "trace", "stats",
+                        "memstats"};
+
+/* shell state set by builtins_init() */
+static struct env_t *builtin_env = NULL;
+static struct hist_t *builtin_hist = NULL;
+
+
+static int builtin_cd(int argc, char **argv, FILE *out)
+{
+    (void)out;
+    char *directory = argc > 1 ? argv[1] : env_get(builtin_env->env_vars, "HOME");
+    if (directory == NULL || cd(directory) != 0) {
+        fprintf(stderr, "cd: %s: no such directory\n", directory == NULL ? "HOME" : directory);
+        return 1;
+    }
+    return 0;
+}
+
+static int builtin_which(int argc, char **argv, FILE *out)
+{
+    return which(argv + 1, argc - 1, builtin_env->paths->paths, builtin_env->paths->size, out);
+}
+
+static int builtin_history(int argc, char **argv, FILE *out)
+{
+    if (builtin_hist == NULL)
+        return 1;
+    return history(builtin_hist, argv + 1, argc - 1, out);
+}
+
+static int builtin_help(int argc, char **argv, FILE *out)
+{
+    (void)argc;
+    (void)argv;
+    return help(out);
+}
+
+static int builtin_pwd(int argc, char **argv, FILE *out)
+{
+    (void)argc;
+    (void)argv;
+    char cwd[4096];
+    if (pwd(cwd) != 0)
+        return 1;
+    fprintf(out, "%s\n", cwd);
+    return 0;
+}
+
+static int builtin_alias(int argc, char **argv, FILE *out)
+{
+    return alias(builtin_env->aliases, argv + 1, argc - 1, out);
+}
+
+static int builtin_unalias(int argc, char **argv, FILE *out)
+{
+    (void)out;
+    return unalias(builtin_env->aliases, argv + 1, argc - 1);
+}
+
+static int builtin_trace(int argc, char **argv, FILE *out)
+{
+    return trace(argv + 1, argc - 1, out);
+}
+
+static int builtin_stats(int argc, char **argv, FILE *out)
+{
+    return stats(argv + 1, argc - 1, out);
+}
+
+static int builtin_memstats(int argc, char **argv, FILE *out)
+{
+    return memstats(argv + 1, argc - 1, out);
+}
+
+/* same order as builtin_names */
+static int (*builtin_functions[total_builtin_functions])(int argc, char **argv, FILE *out) = {
+    builtin_cd,
+    builtin_which,
+    builtin_history,
+    builtin_help,
+    builtin_pwd,
+    builtin_alias,
+    builtin_unalias,
+    builtin_trace,
+    builtin_stats,
+    builtin_memstats
+};
+
+static int builtin_index(char *program_name)
+{
+    for (int i = 0; i < total_builtin_functions; i++) {
+        if (strcmp(builtin_names[i], program_name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void builtins_init(struct env_t *env, struct hist_t *hist)
+{
+    builtin_env = env;
+    builtin_hist = hist;
+}
+
+bool is_builtin(char *program_name)
+{
+    return builtin_index(program_name) != -1;
+}
+
+int builtin_exec(int argc, char **argv, FILE *out)
+{
+    int i = builtin_index(argv[0]);
+    if (i == -1)
+        return 1;
+    return builtin_functions[i](argc, argv, out);
+}
 
 
 void license(void)
@@ -19,22 +19,31 @@
 
 #include "builtins/builtins.h"
 
-int help(void)
+int help(FILE *out)
 {
-    printf("valery - Unix-like shell written by Nicolai Brand (https://lytix.dev) 2022\n"
-           "\nThe goal of the project is to be a playground in order to learn how to write memory-safe, "
-           "efficient, readable and useful C code.\n");
+    fprintf(out, "valery - Unix-like shell written by Nicolai Brand (https://lytix.dev) 2022\n"
+                 "\nThe goal of the project is to be a playground in order to learn how to write memory-safe, "
+                 "efficient, readable and useful C code.\n");
 
-    printf("\nOn startup, valery reads the '.valeryrc' file in the $HOME folder to customize the environment."
-           "Typed in commands are stored in '.valery_hist' in the $HOME folder.\n");
+    fprintf(out, "\nOn startup, valery reads the '.valeryrc' file in the $HOME folder to customize the environment."
+                 "Typed in commands are stored in '.valery_history' in the $HOME folder.\n"
+                 "While typing, the command from the history used most often and most recently that starts "
+                 "with the line is shown faint after it, press the right arrow to accept it.\n"
+                 "In PS1, \\G is the current git branch and \\g the branch marked with '*' if tracked "
+                 "files have changed. They are computed in the background and the prompt is redrawn "
+                 "when they are ready, for up to PS1_DEADLINE milliseconds (500 by default).\n");
 
-    printf("\nList of shell builtins:\n");
+    fprintf(out, "\nList of shell builtins:\n");
     for (int i = 0; i < total_builtin_functions; i++) {
-        printf("%s  ", builtin_names[i]);
+        fprintf(out, "%s  ", builtin_names[i]);
     }
 
-    printf("\n\nUse the -c option to execute a command directly when invoking valery. Example: './valery -c \"ls\"'\n");
+    fprintf(out, "\n\nUse the -c option to execute a command directly when invoking valery. Example: './valery -c \"ls\"'\n");
+    fprintf(out, "Use --profile as the first option, or set VALERY_PROFILE=1, to print how long each phase of "
+                 "every command line took.\n");
+    fprintf(out, "Use --profile-script <script> to run a script and print the lines that took the most time. "
+                 "The stacks of lines are written to <script>.folded for flame graphs.\n");
 
-    printf("\n");
+    fprintf(out, "\n");
     return 0;
 }
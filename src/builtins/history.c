@@ -1,5 +1,6 @@
 /*
- *  Prints the 15 most recent typed in commands to stdout.
+ *  Prints the 15 most recent typed in commands, or every one, optionally filtered by how they
+ *  went, when or where they ran.
  *   
  *  Copyright (C) 2022 Nicolai Brand 
  *
@@ -17,46 +18,131 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE             // localtime_r, PATH_MAX
+#define VALERY_MEM_TAG MEM_HISTORY
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "valery/env.h"
 #include "valery/histfile.h"
 
 #define LINES 15
 
 
-int history(struct hist_t *hist, bool print_all)
+/* types */
+struct hist_filter_t {
+    bool failed;
+    int64_t since;          /* 0 for no limit */
+    bool cwd;
+    uint64_t cwd_id;
+};
+
+
+/* only looks at the fixed size fields of the record, never at the command */
+static bool hist_match(struct hist_record_t *record, struct hist_filter_t *filter)
 {
-    if (hist->fp == NULL)
-        return 1;
+    if (filter->failed && (record->exit_code == 0 || record->exit_code == HIST_EXIT_UNKNOWN))
+        return false;
+    if (filter->since != 0 && record->time < filter->since)
+        return false;
+    if (filter->cwd && record->cwd_id != filter->cwd_id)
+        return false;
+    return true;
+}
 
-    char buf[MAX_COMMAND_LEN];
-    long rc;
-    size_t i;
-    size_t len;
-    size_t histlines = hist->s_len + hist->f_len;
-    if (histlines == 0)
+/* parses a duration on the form <n>[smhd] into the unix time that long ago */
+static int parse_since(const char *arg, int64_t *since)
+{
+    char *end;
+    long n = strtol(arg, &end, 10);
+    long unit;
+    switch (*end) {
+        case 0:
+        case 's': unit = 1; break;
+        case 'm': unit = 60; break;
+        case 'h': unit = 60 * 60; break;
+        case 'd': unit = 24 * 60 * 60; break;
+        default: return 1;
+    }
+    if (end == arg || n < 0 || (*end != 0 && end[1] != 0))
         return 1;
+    *since = (int64_t)time(NULL) - n * unit;
+    return 0;
+}
 
-    hist_reset_pos(hist);
+static void hist_print(struct hist_t *hist, size_t i, bool verbose, FILE *out)
+{
+    if (!verbose) {
+        fprintf(out, "%6zu %s\n", i, hist_command(hist, i));
+        return;
+    }
 
-    if (print_all)
-        len = histlines;
+    struct hist_record_t *record = hist_record(hist, i);
+    char date[32] = "-";
+    time_t t = record->time;
+    struct tm tm;
+    if (t != 0 && localtime_r(&t, &tm) != NULL)
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+    if (record->exit_code == HIST_EXIT_UNKNOWN)
+        fprintf(out, "%6zu %-19s %9s %4s  %s\n", i, date, "-", "-", hist_command(hist, i));
     else
-        /* only read valid amount of histlines */
-        len = histlines >= LINES ? LINES : histlines;
-
-    for (i = len; i > 0; i--)
-        hist_traverse(hist, HIST_UP); 
-
-    for (i = len; i > 1; i--) {
-        rc = hist_get_line(hist, buf, HIST_DOWN);
-        /* chop off new line character */
-        if (rc == READ_FROM_HIST)
-            buf[strlen(buf) - 1] = 0;
-        printf("%6ld %s\n", hist->pos, buf);
+        fprintf(out, "%6zu %-19s %8.3fs %4d  %s\n", i, date, record->duration_ms / 1000.0,
+                record->exit_code, hist_command(hist, i));
+}
+
+static int history_usage(void)
+{
+    fprintf(stderr, "usage: history [-a] [-v] [--failed] [--since <n>[smhd]] [--cwd]\n");
+    return 1;
+}
+
+int history(struct hist_t *hist, char **args, int arg_count, FILE *out)
+{
+    bool print_all = false;
+    bool verbose = false;
+    struct hist_filter_t filter = { 0 };
+
+    for (int i = 0; i < arg_count; i++) {
+        if (strcmp(args[i], "-a") == 0) {
+            print_all = true;
+        } else if (strcmp(args[i], "-v") == 0) {
+            verbose = true;
+        } else if (strcmp(args[i], "--failed") == 0) {
+            filter.failed = true;
+        } else if (strcmp(args[i], "--since") == 0) {
+            if (i + 1 == arg_count || parse_since(args[++i], &filter.since) != 0)
+                return history_usage();
+        } else if (strcmp(args[i], "--cwd") == 0) {
+            char cwd[PATH_MAX];
+            if (getcwd(cwd, sizeof(cwd)) == NULL)
+                return 1;
+            filter.cwd = true;
+            filter.cwd_id = env_hash(cwd, strlen(cwd));
+        } else {
+            return history_usage();
+        }
+    }
+
+    size_t histlines = hist_len(hist);
+    if (histlines == 0)
+        return 1;
+
+    /* newest first until enough have matched, then printed oldest first */
+    size_t limit = print_all ? histlines : LINES;
+    size_t *matches = vmalloc(MIN(limit, histlines) * sizeof(size_t));
+    size_t found = 0;
+    for (size_t i = histlines; i > 0 && found < limit; i--) {
+        if (hist_match(hist_record(hist, i - 1), &filter))
+            matches[found++] = i - 1;
     }
+    while (found > 0)
+        hist_print(hist, matches[--found], verbose, out);
 
+    vfree(matches);
     return 0;
 }
@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "builtins/builtins.h"
+#include "valery/memstats.h"
+
+
+int memstats(char **args, int arg_count, FILE *out)
+{
+#ifndef VALERY_MEMSTATS
+    (void)args;
+    (void)arg_count;
+    (void)out;
+    fprintf(stderr, "memstats: allocations are not counted, build valery with 'make memstats'\n");
+    return 1;
+#else
+    if (arg_count == 0) {
+        memstats_print(out);
+        return 0;
+    }
+
+    if (arg_count == 1 && strcmp(args[0], "clear") == 0) {
+        memstats_clear();
+        return 0;
+    }
+
+    fprintf(stderr, "usage: memstats [clear]\n");
+    return 1;
+#endif /* VALERY_MEMSTATS */
+}
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins/builtins.h"
+#include "valery/stats.h"
+
+
+int stats(char **args, int arg_count, FILE *out)
+{
+    if (arg_count == 0) {
+        stats_print(out, STATS_DEFAULT_TOP);
+        return 0;
+    }
+
+    if (arg_count == 1 && strcmp(args[0], "clear") == 0) {
+        stats_free();
+        return 0;
+    }
+
+    char *end;
+    long top = strtol(args[0], &end, 10);
+    if (arg_count > 1 || *end != 0 || top <= 0) {
+        fprintf(stderr, "usage: stats [<n> | clear]\n");
+        return 1;
+    }
+    stats_print(out, (size_t)top);
+    return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtins/builtins.h"
+#include "valery/trace.h"
+
+
+static int trace_usage(void)
+{
+    fprintf(stderr, "usage: trace [on | off | dump | clear | fd <n> | fd off]\n");
+    return 1;
+}
+
+int trace(char **args, int arg_count, FILE *out)
+{
+    if (arg_count == 0) {
+        fprintf(out, "trace: %s\n", trace_enabled ? "on" : "off");
+        return 0;
+    }
+
+    if (strcmp(args[0], "on") == 0) {
+        trace_enabled = true;
+    } else if (strcmp(args[0], "off") == 0) {
+        trace_enabled = false;
+    } else if (strcmp(args[0], "dump") == 0) {
+        trace_dump(out);
+    } else if (strcmp(args[0], "clear") == 0) {
+        trace_clear();
+    } else if (strcmp(args[0], "fd") == 0 && arg_count == 2) {
+        if (strcmp(args[1], "off") == 0) {
+            trace_stream(-1);
+            return 0;
+        }
+        char *end;
+        long fd = strtol(args[1], &end, 10);
+        if (*end != 0 || fd < 0 || fcntl((int)fd, F_GETFD) == -1) {
+            fprintf(stderr, "trace: %s: not an open file descriptor\n", args[1]);
+            return 1;
+        }
+        trace_stream((int)fd);
+    } else {
+        return trace_usage();
+    }
+    return 0;
+}
@@ -90,15 +90,26 @@ not_found:
     return COMMAND_NOT_FOUND;
 }
 
-int which(char **program_names, int program_count, char **paths, int path_count)
+int which(char **program_names, int program_count, char **paths, int path_count, FILE *out)
 {
     int rc = 0;
-    int rc_tmp;
+    char *path;
 
     for (int i = 0; i < program_count; i++) {
-        rc_tmp = which_single(program_names[i], paths, path_count, NULL);
-        if (rc_tmp == COMMAND_NOT_FOUND)
-            rc = 1;
+        switch (which_single(program_names[i], paths, path_count, &path)) {
+            case COMMAND_IN_PATH:
+                fprintf(out, "%s/%s\n", path, program_names[i]);
+                break;
+            case COMMAND_IS_PATH:
+                fprintf(out, "%s\n", program_names[i]);
+                break;
+            case COMMAND_IS_BUILTIN:
+                fprintf(out, "%s: shell builtin\n", program_names[i]);
+                break;
+            default:
+                fprintf(stderr, "%s: not found\n", program_names[i]);
+                rc = 1;
+        }
     }
     return rc;
 }
@@ -18,6 +18,7 @@
 #include <stdio.h>
 
 #include "valery/valery.h"
+#include "valery/memstats.h"
 
 
 void valery_exit(int exit_code)
@@ -56,6 +57,38 @@ void _valery_error(const char *msg, const char *file, const char *func, const in
     putchar('\n');
 }
 
+#ifdef VALERY_MEMSTATS
+void *_vmalloc(size_t size, enum mem_tag_t tag)
+{
+    void *tmp = malloc(size);
+    if (tmp == NULL)
+        valery_exit_internal_error("memory allocation error");
+    memstats_alloc(tmp, size, tag, false);
+    return tmp;
+}
+
+void *_vcalloc(size_t nitems, size_t size, enum mem_tag_t tag)
+{
+    void *tmp = calloc(nitems, size);
+    if (tmp == NULL)
+        valery_exit_internal_error("memory allocation error");
+    memstats_alloc(tmp, nitems * size, tag, false);
+    return tmp;
+}
+
+void *_vrealloc(void *ptr, size_t size, enum mem_tag_t tag)
+{
+    /* before the old address can be handed out to another thread */
+    if (ptr != NULL)
+        memstats_free(ptr, true);
+    void *tmp = realloc(ptr, size);
+    if (tmp == NULL)
+        valery_exit_internal_error("memory allocation error");
+    memstats_alloc(tmp, size, tag, ptr != NULL);
+    return tmp;
+}
+
+#else
 void *vmalloc(size_t size)
 {
 #ifdef VALLOC_IMPLEMENTATION
@@ -88,3 +121,13 @@ void *vrealloc(void *ptr, size_t size)
 #endif /* VALLOC_IMPLEMENTATION*/
     return realloc(ptr, size);
 }
+#endif /* VALERY_MEMSTATS */
+
+void vfree(void *ptr)
+{
+#ifdef VALERY_MEMSTATS
+    if (ptr != NULL)
+        memstats_free(ptr, false);
+#endif /* VALERY_MEMSTATS */
+    free(ptr);
+}
@@ -0,0 +1,783 @@
+/*
+ *  Tab completion of command names and paths. The names of all executables in PATH and the
+ *  builtins are kept in a prefix trie that is built by a background thread, so completing
+ *  never has to wait for the file system. Paths are completed from cached directory listings
+ *  that inotify tells us when to read again.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // fstatat, st_mtim, strdup
+#define VALERY_MEM_TAG MEM_PROMPT
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "valery/valery.h"
+#include "valery/completion.h"
+#include "valery/watch.h"
+#include "builtins/builtins.h"
+
+
+#define TRIE_STARTING_NODES 4096
+
+/* types */
+/* the executables found in one PATH directory the last time it was read */
+struct path_dir_t {
+    char *path;
+    int wd;                 /* -1 if neither the directory nor its parent could be watched */
+    bool watching_parent;   /* the directory did not exist, so its parent is watched instead */
+    bool exists;            /* only kept up to date for directories that are not watched */
+    struct timespec mtime;  /* likewise */
+    char *names;            /* NUL separated names */
+    size_t names_len;
+    size_t names_capacity;
+};
+
+/* one name in a cached directory listing */
+struct dir_entry_t {
+    uint32_t offset;        /* where the name starts in names */
+    bool dir;               /* a directory, or a symlink to one */
+};
+
+/* the listing of one directory, sorted by name */
+struct dir_cache_t {
+    char *path;             /* absolute path ending with a '/', NULL if the slot is free */
+    int wd;                 /* the inotify watch, -1 if the directory could not be watched */
+    uint64_t last_used;
+    char *names;            /* NUL separated names */
+    size_t names_len;
+    size_t names_capacity;
+    struct dir_entry_t *entries;
+    size_t entries_len;
+    size_t entries_capacity;
+};
+
+
+/* guards everything below that is shared between the prompt and the completion thread */
+static pthread_mutex_t completion_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t completion_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t completion_thread;
+static bool completion_running = false;
+static bool refresh_requested = false;
+static bool stop_requested = false;
+static struct trie_t *trie = NULL;
+
+/* only used by the completion thread */
+static struct path_dir_t *dirs = NULL;
+static int dirs_len = 0;
+
+/* set by the watch thread when a PATH directory changes */
+static pthread_mutex_t dirs_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool *dirs_stale = NULL;
+static bool *dirs_lost = NULL;      /* the kernel dropped the watch */
+
+/* only used by the prompt */
+static struct dir_cache_t dir_cache[DIR_CACHE_SIZE];
+static size_t dir_cache_bytes = 0;
+static uint64_t dir_cache_tick = 0;
+static char completion_cwd[PATH_MAX] = ".";
+static char *sort_names = NULL;                 /* qsort() has no argument for the names */
+
+/* set by the watch thread when a cached directory changes */
+static pthread_mutex_t dir_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool dir_cache_stale[DIR_CACHE_SIZE];
+
+
+static struct trie_t *trie_malloc(void)
+{
+    struct trie_t *t = vmalloc(sizeof(struct trie_t));
+    t->capacity = TRIE_STARTING_NODES;
+    t->nodes = vmalloc(t->capacity * sizeof(struct trie_node_t));
+    t->nodes[0] = (struct trie_node_t){ .child = COMPLETION_NO_NODE,
+                                        .sibling = COMPLETION_NO_NODE };
+    t->size = 1;
+    t->free = COMPLETION_NO_NODE;
+    t->names = 0;
+    return t;
+}
+
+static void trie_free(struct trie_t *t)
+{
+    if (t == NULL)
+        return;
+    vfree(t->nodes);
+    vfree(t);
+}
+
+/*
+ * returns the child of node that holds c, or COMPLETION_NO_NODE if there is none.
+ * if create is true, a missing child is inserted so the siblings stay sorted.
+ */
+static uint32_t trie_child(struct trie_t *t, uint32_t node, char c, bool create)
+{
+    uint32_t prev = COMPLETION_NO_NODE;
+    uint32_t cur = t->nodes[node].child;
+    while (cur != COMPLETION_NO_NODE && (unsigned char)t->nodes[cur].c < (unsigned char)c) {
+        prev = cur;
+        cur = t->nodes[cur].sibling;
+    }
+    if (cur != COMPLETION_NO_NODE && t->nodes[cur].c == c)
+        return cur;
+    if (!create)
+        return COMPLETION_NO_NODE;
+
+    uint32_t new = t->free;
+    if (new != COMPLETION_NO_NODE) {
+        t->free = t->nodes[new].sibling;
+    } else {
+        if (t->size == t->capacity) {
+            t->capacity *= 2;
+            t->nodes = vrealloc(t->nodes, t->capacity * sizeof(struct trie_node_t));
+        }
+        new = t->size++;
+    }
+    t->nodes[new] = (struct trie_node_t){ .child = COMPLETION_NO_NODE, .sibling = cur, .c = c };
+    if (prev == COMPLETION_NO_NODE)
+        t->nodes[node].child = new;
+    else
+        t->nodes[prev].sibling = new;
+    return new;
+}
+
+static void trie_insert(struct trie_t *t, const char *name)
+{
+    uint32_t node = 0;
+    for (; *name != 0; name++)
+        node = trie_child(t, node, *name, true);
+    if (t->nodes[node].refs++ == 0)
+        t->names++;
+}
+
+/* takes node out of the children of parent and puts it on the free list */
+static void trie_unlink(struct trie_t *t, uint32_t parent, uint32_t node)
+{
+    uint32_t *link = &t->nodes[parent].child;
+    while (*link != node)
+        link = &t->nodes[*link].sibling;
+    *link = t->nodes[node].sibling;
+    t->nodes[node].sibling = t->free;
+    t->free = node;
+}
+
+/* undoes one trie_insert() of name, the nodes no other name goes through are removed */
+static void trie_remove(struct trie_t *t, const char *name)
+{
+    uint32_t path[NAME_MAX + 1] = { 0 };
+    size_t depth = 0;
+    for (; *name != 0 && depth < NAME_MAX; name++) {
+        path[depth + 1] = trie_child(t, path[depth], *name, false);
+        if (path[++depth] == COMPLETION_NO_NODE)
+            return;
+    }
+    if (*name != 0 || t->nodes[path[depth]].refs == 0 || --t->nodes[path[depth]].refs > 0)
+        return;
+
+    t->names--;
+    for (; depth > 0; depth--) {
+        struct trie_node_t *node = &t->nodes[path[depth]];
+        if (node->refs > 0 || node->child != COMPLETION_NO_NODE)
+            break;
+        trie_unlink(t, path[depth - 1], path[depth]);
+    }
+}
+
+/* returns the node the prefix ends at, or COMPLETION_NO_NODE if no name starts with it */
+static uint32_t trie_find(struct trie_t *t, const char *prefix, size_t len)
+{
+    uint32_t node = 0;
+    for (size_t i = 0; i < len && node != COMPLETION_NO_NODE; i++)
+        node = trie_child(t, node, prefix[i], false);
+    return node;
+}
+
+/* amount of names in the subtree of node */
+static size_t trie_count(struct trie_t *t, uint32_t node)
+{
+    size_t count = t->nodes[node].refs > 0;
+    for (uint32_t c = t->nodes[node].child; c != COMPLETION_NO_NODE; c = t->nodes[c].sibling)
+        count += trie_count(t, c);
+    return count;
+}
+
+/* writes the names in the subtree of node in order, name holds the chars up to node */
+static void trie_list(struct trie_t *t, uint32_t node, char *name, size_t len, size_t *left,
+                      FILE *out)
+{
+    if (*left == 0)
+        return;
+    if (t->nodes[node].refs > 0) {
+        fprintf(out, "%.*s\n", (int)len, name);
+        (*left)--;
+    }
+    if (len == NAME_MAX)
+        return;
+    for (uint32_t c = t->nodes[node].child; c != COMPLETION_NO_NODE; c = t->nodes[c].sibling) {
+        name[len] = t->nodes[c].c;
+        trie_list(t, c, name, len + 1, left, out);
+    }
+}
+
+
+static void path_dir_add_name(struct path_dir_t *dir, const char *name)
+{
+    size_t len = strlen(name) + 1;
+    if (dir->names_len + len > dir->names_capacity) {
+        dir->names_capacity = MAX(dir->names_capacity * 2, dir->names_len + len);
+        dir->names = vrealloc(dir->names, dir->names_capacity);
+    }
+    memcpy(dir->names + dir->names_len, name, len);
+    dir->names_len += len;
+}
+
+/* forgets the old names of the directory and reads the executables in it again */
+static void path_dir_read(struct path_dir_t *dir)
+{
+    dir->names_len = 0;
+    DIR *d = opendir(dir->path);
+    if (d == NULL)
+        return;
+
+    int fd = dirfd(d);
+    struct dirent *entry;
+    struct stat st;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' || entry->d_type == DT_DIR)
+            continue;
+        /* follows symlinks, most of /usr/bin is links */
+        if (fstatat(fd, entry->d_name, &st, 0) != 0)
+            continue;
+        if (S_ISREG(st.st_mode) && (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
+            path_dir_add_name(dir, entry->d_name);
+    }
+    closedir(d);
+}
+
+static void path_dir_changed(void *arg, uint32_t mask)
+{
+    pthread_mutex_lock(&dirs_lock);
+    dirs_stale[(uintptr_t)arg] = true;
+    if (mask & IN_IGNORED)
+        dirs_lost[(uintptr_t)arg] = true;
+    pthread_mutex_unlock(&dirs_lock);
+}
+
+/* watches PATH directory i, or its parent so we learn when the directory is created */
+static void path_dir_watch(int i)
+{
+    struct path_dir_t *dir = &dirs[i];
+    void *arg = (void *)(uintptr_t)i;
+
+    watch_rm(dir->wd, path_dir_changed, arg);
+    dir->watching_parent = false;
+    dir->wd = watch_add(dir->path, WATCH_DIR_CHANGES, path_dir_changed, arg);
+    if (dir->wd != -1)
+        return;
+
+    char parent[PATH_MAX];
+    snprintf(parent, PATH_MAX, "%s", dir->path);
+    char *slash = strrchr(parent, '/');
+    if (slash == NULL)
+        return;
+    slash[slash == parent] = 0;
+    dir->wd = watch_add(parent, WATCH_DIR_CHANGES, path_dir_changed, arg);
+    dir->watching_parent = dir->wd != -1;
+}
+
+/* for a directory that is not watched, returns true if its mtime has changed since last time */
+static bool path_dir_polled_change(struct path_dir_t *dir)
+{
+    struct stat st;
+    bool exists = stat(dir->path, &st) == 0;
+    if (exists == dir->exists && (!exists || (st.st_mtim.tv_sec == dir->mtime.tv_sec &&
+                                              st.st_mtim.tv_nsec == dir->mtime.tv_nsec)))
+        return false;
+
+    dir->exists = exists;
+    if (exists)
+        dir->mtime = st.st_mtim;
+    return true;
+}
+
+/*
+ * reads the PATH directories that changed since they were last read again, and moves the trie
+ * from their old names to their new ones. the other directories and the builtins are left alone.
+ */
+static void path_dirs_update(void)
+{
+    bool stale[dirs_len + 1];
+    bool rewatch[dirs_len + 1];
+
+    pthread_mutex_lock(&dirs_lock);
+    for (int i = 0; i < dirs_len; i++) {
+        stale[i] = dirs_stale[i];
+        rewatch[i] = stale[i] && (dirs_lost[i] || dirs[i].watching_parent);
+        dirs_stale[i] = dirs_lost[i] = false;
+    }
+    pthread_mutex_unlock(&dirs_lock);
+
+    for (int i = 0; i < dirs_len; i++) {
+        struct path_dir_t *dir = &dirs[i];
+        if (dir->wd == -1 && path_dir_polled_change(dir))
+            stale[i] = rewatch[i] = true;
+        if (!stale[i])
+            continue;
+        /* before reading, so no change can happen unnoticed in between */
+        if (rewatch[i])
+            path_dir_watch(i);
+
+        char *old = dir->names;
+        size_t old_len = dir->names_len;
+        dir->names = NULL;
+        dir->names_len = dir->names_capacity = 0;
+        path_dir_read(dir);
+
+        /* the new names go in first, so the nodes of names that stayed are not removed */
+        pthread_mutex_lock(&completion_lock);
+        for (char *name = dir->names; name < dir->names + dir->names_len;
+             name += strlen(name) + 1)
+            trie_insert(trie, name);
+        for (char *name = old; name < old + old_len; name += strlen(name) + 1)
+            trie_remove(trie, name);
+        pthread_mutex_unlock(&completion_lock);
+        vfree(old);
+    }
+}
+
+/* builds a new trie from the names of all directories read so far and the builtins */
+static struct trie_t *trie_build(void)
+{
+    struct trie_t *t = trie_malloc();
+    for (int i = 0; i < total_builtin_functions; i++)
+        trie_insert(t, builtin_names[i]);
+
+    for (int i = 0; i < dirs_len; i++) {
+        char *name = dirs[i].names;
+        char *end = name + dirs[i].names_len;
+        for (; name < end; name += strlen(name) + 1)
+            trie_insert(t, name);
+    }
+    return t;
+}
+
+static void *completion_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < dirs_len; i++) {
+        path_dir_watch(i);
+        if (dirs[i].wd == -1)
+            path_dir_polled_change(&dirs[i]);
+        path_dir_read(&dirs[i]);
+    }
+    /* the prompt only reads the trie while holding the lock, so it can be built without it */
+    struct trie_t *built = trie_build();
+
+    pthread_mutex_lock(&completion_lock);
+    trie = built;
+    while (!stop_requested) {
+        while (!refresh_requested && !stop_requested)
+            pthread_cond_wait(&completion_cond, &completion_lock);
+        if (stop_requested)
+            break;
+        refresh_requested = false;
+        pthread_mutex_unlock(&completion_lock);
+
+        path_dirs_update();
+
+        pthread_mutex_lock(&completion_lock);
+    }
+    pthread_mutex_unlock(&completion_lock);
+    return NULL;
+}
+
+static void dir_cache_changed(void *arg, uint32_t mask)
+{
+    (void)mask;
+    pthread_mutex_lock(&dir_cache_lock);
+    dir_cache_stale[(uintptr_t)arg] = true;
+    pthread_mutex_unlock(&dir_cache_lock);
+}
+
+static size_t dir_cache_size(struct dir_cache_t *dir)
+{
+    return dir->names_capacity + dir->entries_capacity * sizeof(struct dir_entry_t);
+}
+
+static void dir_cache_clear(size_t i)
+{
+    struct dir_cache_t *dir = &dir_cache[i];
+    watch_rm(dir->wd, dir_cache_changed, (void *)(uintptr_t)i);
+    dir_cache_bytes -= dir_cache_size(dir);
+    vfree(dir->path);
+    vfree(dir->names);
+    vfree(dir->entries);
+    *dir = (struct dir_cache_t){ .wd = -1 };
+}
+
+/* frees the least recently used listing other than keep */
+static bool dir_cache_evict(size_t keep)
+{
+    size_t lru = DIR_CACHE_SIZE;
+    for (size_t i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (i == keep || dir_cache[i].path == NULL)
+            continue;
+        if (lru == DIR_CACHE_SIZE || dir_cache[i].last_used < dir_cache[lru].last_used)
+            lru = i;
+    }
+    if (lru == DIR_CACHE_SIZE)
+        return false;
+    dir_cache_clear(lru);
+    return true;
+}
+
+static void dir_cache_add_name(struct dir_cache_t *dir, const char *name, bool is_dir)
+{
+    size_t len = strlen(name) + 1;
+    if (dir->names_len + len > dir->names_capacity) {
+        dir->names_capacity = MAX(dir->names_capacity * 2, dir->names_len + len);
+        dir->names = vrealloc(dir->names, dir->names_capacity);
+    }
+    if (dir->entries_len == dir->entries_capacity) {
+        dir->entries_capacity = dir->entries_capacity == 0 ? 64 : dir->entries_capacity * 2;
+        dir->entries = vrealloc(dir->entries, dir->entries_capacity * sizeof(struct dir_entry_t));
+    }
+    dir->entries[dir->entries_len++] = (struct dir_entry_t){ .offset = dir->names_len,
+                                                             .dir = is_dir };
+    memcpy(dir->names + dir->names_len, name, len);
+    dir->names_len += len;
+}
+
+static int dir_entry_cmp(const void *a, const void *b)
+{
+    const struct dir_entry_t *ea = a;
+    const struct dir_entry_t *eb = b;
+    return strcmp(sort_names + ea->offset, sort_names + eb->offset);
+}
+
+/*
+ * reads the directory of slot i again. the watch is added before reading so no change can
+ * happen unnoticed in between.
+ * returns false if the directory could not be read.
+ */
+static bool dir_cache_fill(size_t i)
+{
+    struct dir_cache_t *dir = &dir_cache[i];
+    pthread_mutex_lock(&dir_cache_lock);
+    dir_cache_stale[i] = false;
+    pthread_mutex_unlock(&dir_cache_lock);
+
+    /* the old watch may have been dropped by the kernel if the directory was moved */
+    watch_rm(dir->wd, dir_cache_changed, (void *)(uintptr_t)i);
+    dir->wd = watch_add(dir->path, WATCH_DIR_CHANGES, dir_cache_changed, (void *)(uintptr_t)i);
+
+    size_t size_before = dir_cache_size(dir);
+    dir->names_len = 0;
+    dir->entries_len = 0;
+    DIR *d = opendir(dir->path);
+    if (d == NULL)
+        return false;
+
+    int fd = dirfd(d);
+    struct dirent *entry;
+    struct stat st;
+    while ((entry = readdir(d)) != NULL) {
+        char *name = entry->d_name;
+        if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+            continue;
+        bool is_dir = entry->d_type == DT_DIR;
+        /* resolved now so completing never has to stat */
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+            is_dir = fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+        dir_cache_add_name(dir, name, is_dir);
+    }
+    closedir(d);
+
+    sort_names = dir->names;
+    qsort(dir->entries, dir->entries_len, sizeof(struct dir_entry_t), dir_entry_cmp);
+    /* the buffers are reused, so they only ever grow */
+    dir_cache_bytes += dir_cache_size(dir) - size_before;
+    return true;
+}
+
+/* returns the up to date listing of the directory path, or NULL if it can not be read */
+static struct dir_cache_t *dir_cache_get(const char *path)
+{
+    size_t i;
+    size_t free_slot = DIR_CACHE_SIZE;
+    dir_cache_tick++;
+
+    for (i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (dir_cache[i].path == NULL) {
+            if (free_slot == DIR_CACHE_SIZE)
+                free_slot = i;
+        } else if (strcmp(dir_cache[i].path, path) == 0) {
+            break;
+        }
+    }
+
+    if (i < DIR_CACHE_SIZE) {
+        pthread_mutex_lock(&dir_cache_lock);
+        bool stale = dir_cache_stale[i] || dir_cache[i].wd == -1;
+        pthread_mutex_unlock(&dir_cache_lock);
+        if (stale && !dir_cache_fill(i)) {
+            dir_cache_clear(i);
+            return NULL;
+        }
+    } else {
+        if (free_slot == DIR_CACHE_SIZE) {
+            dir_cache_evict(DIR_CACHE_SIZE);
+            for (free_slot = 0; dir_cache[free_slot].path != NULL; free_slot++)
+                ;
+        }
+        i = free_slot;
+        dir_cache[i] = (struct dir_cache_t){ .path = strdup(path), .wd = -1 };
+        if (!dir_cache_fill(i)) {
+            dir_cache_clear(i);
+            return NULL;
+        }
+    }
+
+    while (dir_cache_bytes > DIR_CACHE_MAX_BYTES && dir_cache_evict(i))
+        ;
+    dir_cache[i].last_used = dir_cache_tick;
+    return &dir_cache[i];
+}
+
+/* index of the first name in dir that is not less than the first len chars of prefix */
+static size_t dir_cache_lower_bound(struct dir_cache_t *dir, const char *prefix, size_t len)
+{
+    size_t lo = 0;
+    size_t hi = dir->entries_len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(dir->names + dir->entries[mid].offset, prefix, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * splits word into the directory part and the name being completed.
+ * returns the listing of the directory, or NULL if it can not be read.
+ */
+static struct dir_cache_t *path_dir(const char *word, size_t len, size_t *dir_len)
+{
+    char path[PATH_MAX];
+    int n;
+
+    *dir_len = 0;
+    for (size_t i = len; i > 0; i--) {
+        if (word[i - 1] == '/') {
+            *dir_len = i;
+            break;
+        }
+    }
+
+    if (*dir_len > 0 && word[0] == '/')
+        n = snprintf(path, PATH_MAX, "%.*s", (int)*dir_len, word);
+    else
+        n = snprintf(path, PATH_MAX, "%s%s%.*s", completion_cwd,
+                     completion_cwd[strlen(completion_cwd) - 1] == '/' ? "" : "/",
+                     (int)*dir_len, word);
+    if (n < 0 || n >= PATH_MAX)
+        return NULL;
+    return dir_cache_get(path);
+}
+
+/* hidden names are only completed if the name being completed starts with a dot */
+static inline bool path_hidden(const char *name, const char *prefix, size_t len)
+{
+    return name[0] == '.' && (len == 0 || prefix[0] != '.');
+}
+
+void completion_init(struct paths_t *paths)
+{
+    dirs_len = paths->size;
+    dirs = vcalloc(dirs_len + 1, sizeof(struct path_dir_t));
+    dirs_stale = vcalloc(dirs_len + 1, sizeof(bool));
+    dirs_lost = vcalloc(dirs_len + 1, sizeof(bool));
+    for (int i = 0; i < dirs_len; i++)
+        dirs[i] = (struct path_dir_t){ .path = strdup(paths->paths[i]), .wd = -1 };
+
+    if (pthread_create(&completion_thread, NULL, completion_worker, NULL) != 0) {
+        valery_error("could not start the completion thread, tab completion is disabled");
+        return;
+    }
+    completion_running = true;
+}
+
+void completion_refresh(const char *cwd)
+{
+    if (cwd != NULL)
+        snprintf(completion_cwd, PATH_MAX, "%s", cwd);
+
+    pthread_mutex_lock(&completion_lock);
+    refresh_requested = true;
+    pthread_cond_signal(&completion_cond);
+    pthread_mutex_unlock(&completion_lock);
+}
+
+void completion_free(void)
+{
+    if (completion_running) {
+        pthread_mutex_lock(&completion_lock);
+        stop_requested = true;
+        pthread_cond_signal(&completion_cond);
+        pthread_mutex_unlock(&completion_lock);
+        pthread_join(completion_thread, NULL);
+        completion_running = false;
+    }
+
+    trie_free(trie);
+    trie = NULL;
+    for (int i = 0; i < dirs_len; i++) {
+        watch_rm(dirs[i].wd, path_dir_changed, (void *)(uintptr_t)i);
+        vfree(dirs[i].path);
+        vfree(dirs[i].names);
+    }
+    vfree(dirs);
+    vfree(dirs_stale);
+    vfree(dirs_lost);
+    dirs = NULL;
+    dirs_stale = dirs_lost = NULL;
+    dirs_len = 0;
+
+    for (size_t i = 0; i < DIR_CACHE_SIZE; i++) {
+        if (dir_cache[i].path != NULL)
+            dir_cache_clear(i);
+    }
+}
+
+struct completion_t complete_command(const char *prefix, size_t len, char *extension,
+                                     size_t extension_size)
+{
+    struct completion_t result = { 0 };
+    extension[0] = 0;
+
+    pthread_mutex_lock(&completion_lock);
+    uint32_t node = trie == NULL ? COMPLETION_NO_NODE : trie_find(trie, prefix, len);
+    if (node == COMPLETION_NO_NODE)
+        goto done;
+
+    result.candidates = trie_count(trie, node);
+    /* extend while there is only one way to continue */
+    while (trie->nodes[node].refs == 0 && result.len + 1 < extension_size) {
+        uint32_t child = trie->nodes[node].child;
+        if (child == COMPLETION_NO_NODE || trie->nodes[child].sibling != COMPLETION_NO_NODE)
+            break;
+        extension[result.len++] = trie->nodes[child].c;
+        node = child;
+    }
+    extension[result.len] = 0;
+    result.unique = trie->nodes[node].refs > 0 && trie->nodes[node].child == COMPLETION_NO_NODE;
+
+done:
+    pthread_mutex_unlock(&completion_lock);
+    return result;
+}
+
+size_t completion_list(const char *prefix, size_t len, size_t max, FILE *out)
+{
+    char name[NAME_MAX + 1];
+    size_t left = max;
+    if (len > NAME_MAX)
+        return 0;
+
+    pthread_mutex_lock(&completion_lock);
+    uint32_t node = trie == NULL ? COMPLETION_NO_NODE : trie_find(trie, prefix, len);
+    if (node != COMPLETION_NO_NODE) {
+        memcpy(name, prefix, len);
+        trie_list(trie, node, name, len, &left, out);
+    }
+    pthread_mutex_unlock(&completion_lock);
+    return max - left;
+}
+
+struct completion_t complete_path(const char *word, size_t len, char *extension,
+                                  size_t extension_size)
+{
+    struct completion_t result = { 0 };
+    size_t dir_len;
+    extension[0] = 0;
+
+    struct dir_cache_t *dir = path_dir(word, len, &dir_len);
+    if (dir == NULL)
+        return result;
+
+    const char *prefix = word + dir_len;
+    size_t prefix_len = len - dir_len;
+    const char *match = NULL;
+    size_t common = 0;
+    for (size_t i = dir_cache_lower_bound(dir, prefix, prefix_len); i < dir->entries_len; i++) {
+        const char *name = dir->names + dir->entries[i].offset;
+        if (strncmp(name, prefix, prefix_len) != 0)
+            break;
+        if (path_hidden(name, prefix, prefix_len))
+            continue;
+
+        if (match == NULL) {
+            match = name;
+            common = strlen(name);
+            result.directory = dir->entries[i].dir;
+        } else {
+            size_t j = prefix_len;
+            while (j < common && name[j] == match[j])
+                j++;
+            common = j;
+        }
+        result.candidates++;
+    }
+    if (match == NULL)
+        return result;
+
+    result.len = MIN(common - prefix_len, extension_size - 1);
+    memcpy(extension, match + prefix_len, result.len);
+    extension[result.len] = 0;
+    result.unique = result.candidates == 1 && result.len == common - prefix_len;
+    return result;
+}
+
+size_t completion_list_paths(const char *word, size_t len, size_t max, FILE *out)
+{
+    size_t dir_len;
+    size_t listed = 0;
+    struct dir_cache_t *dir = path_dir(word, len, &dir_len);
+    if (dir == NULL)
+        return 0;
+
+    const char *prefix = word + dir_len;
+    size_t prefix_len = len - dir_len;
+    for (size_t i = dir_cache_lower_bound(dir, prefix, prefix_len);
+         i < dir->entries_len && listed < max; i++) {
+        const char *name = dir->names + dir->entries[i].offset;
+        if (strncmp(name, prefix, prefix_len) != 0)
+            break;
+        if (path_hidden(name, prefix, prefix_len))
+            continue;
+        fprintf(out, "%s%s\n", name, dir->entries[i].dir ? "/" : "");
+        listed++;
+    }
+    return listed;
+}
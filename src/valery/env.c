@@ -15,6 +15,7 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define VALERY_MEM_TAG MEM_ENV
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -26,35 +27,170 @@
 #include "builtins/builtins.h"
 #include "lib/vstring.h"
 #include "valery/load_config.h"
+#include "valery/segment.h"
 #define NICC_IMPLEMENTATION 
 #define HT_KEY_LIST
 #include "lib/nicc/nicc.h"
 
+extern char **environ;
+
+
+struct env_table_t *env_table_malloc(size_t capacity)
+{
+    struct env_table_t *table = vmalloc(sizeof(struct env_table_t));
+    table->slots_capacity = 1;
+    while (table->slots_capacity < capacity * 2)
+        table->slots_capacity *= 2;
+    table->slots = vcalloc(table->slots_capacity, sizeof(struct env_slot_t));
+    table->tombstones = 0;
+    table->entries_capacity = capacity;
+    table->entries = vmalloc(table->entries_capacity * sizeof(struct env_entry_t));
+    table->entries_len = 0;
+    table->live = 0;
+    return table;
+}
+
+void env_table_free(struct env_table_t *table)
+{
+    for (size_t i = 0; i < table->entries_len; i++)
+        vfree(table->entries[i].pair);
+    vfree(table->entries);
+    vfree(table->slots);
+    vfree(table);
+}
+
+/* returns the slot that holds key, or the empty slot it would be inserted into */
+static struct env_slot_t *env_table_find(struct env_table_t *table, const char *key, size_t len,
+                                         uint64_t hash)
+{
+    size_t mask = table->slots_capacity - 1;
+    struct env_slot_t *insert_at = NULL;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        struct env_slot_t *slot = &table->slots[i];
+        if (slot->entry == ENV_SLOT_EMPTY)
+            return insert_at != NULL ? insert_at : slot;
+        if (slot->entry == ENV_SLOT_TOMBSTONE) {
+            if (insert_at == NULL)
+                insert_at = slot;
+            continue;
+        }
+        struct env_entry_t *entry = &table->entries[slot->entry - 1];
+        if (slot->hash == hash && entry->key_len == len && memcmp(entry->pair, key, len) == 0)
+            return slot;
+    }
+}
+
+/* drops the removed entries and the tombstones and places the entries in slots_capacity slots */
+static void env_table_rebuild(struct env_table_t *table, size_t slots_capacity)
+{
+    size_t live = 0;
+    for (size_t i = 0; i < table->entries_len; i++) {
+        if (table->entries[i].pair != NULL)
+            table->entries[live++] = table->entries[i];
+    }
+    table->entries_len = live;
+
+    vfree(table->slots);
+    table->slots_capacity = slots_capacity;
+    table->slots = vcalloc(slots_capacity, sizeof(struct env_slot_t));
+    table->tombstones = 0;
+    size_t mask = slots_capacity - 1;
+    for (size_t e = 0; e < live; e++) {
+        size_t i = table->entries[e].hash & mask;
+        while (table->slots[i].entry != ENV_SLOT_EMPTY)
+            i = (i + 1) & mask;
+        table->slots[i] = (struct env_slot_t){ .hash = table->entries[e].hash, .entry = e + 1 };
+    }
+}
+
+char *env_table_get(struct env_table_t *table, const char *key, size_t len, uint64_t hash)
+{
+    struct env_slot_t *slot = env_table_find(table, key, len, hash);
+    if (slot->entry == ENV_SLOT_EMPTY || slot->entry == ENV_SLOT_TOMBSTONE)
+        return NULL;
+    struct env_entry_t *entry = &table->entries[slot->entry - 1];
+    return entry->pair + entry->key_len + 1;
+}
+
+void env_table_set(struct env_table_t *table, const char *key, size_t len, uint64_t hash,
+                   const char *value)
+{
+    size_t value_len = strlen(value);
+    char *pair = vmalloc(len + value_len + 2);
+    memcpy(pair, key, len);
+    pair[len] = '=';
+    memcpy(pair + len + 1, value, value_len + 1);
+
+    struct env_slot_t *slot = env_table_find(table, key, len, hash);
+    if (slot->entry != ENV_SLOT_EMPTY && slot->entry != ENV_SLOT_TOMBSTONE) {
+        struct env_entry_t *entry = &table->entries[slot->entry - 1];
+        vfree(entry->pair);
+        entry->pair = pair;
+        return;
+    }
+
+    /*
+     * keep at most three quarters of the slots in use, counting tombstones, and drop the
+     * removed entries instead of growing the entries when at least half of them are removed
+     */
+    bool slots_full = (table->live + table->tombstones + 1) * 4 > table->slots_capacity * 3;
+    bool entries_full = table->entries_len == table->entries_capacity;
+    if (slots_full || (entries_full && table->entries_len - table->live >= table->live)) {
+        size_t slots_capacity = table->slots_capacity;
+        while ((table->live + 1) * 2 > slots_capacity)
+            slots_capacity *= 2;
+        env_table_rebuild(table, slots_capacity);
+        slot = env_table_find(table, key, len, hash);
+    }
+    if (table->entries_len == table->entries_capacity) {
+        table->entries_capacity *= 2;
+        table->entries = vrealloc(table->entries,
+                                  table->entries_capacity * sizeof(struct env_entry_t));
+    }
+
+    if (slot->entry == ENV_SLOT_TOMBSTONE)
+        table->tombstones--;
+    table->entries[table->entries_len++] = (struct env_entry_t){ .pair = pair, .key_len = len,
+                                                                 .hash = hash };
+    *slot = (struct env_slot_t){ .hash = hash, .entry = table->entries_len };
+    table->live++;
+}
+
+bool env_table_rm(struct env_table_t *table, const char *key, size_t len, uint64_t hash)
+{
+    struct env_slot_t *slot = env_table_find(table, key, len, hash);
+    if (slot->entry == ENV_SLOT_EMPTY || slot->entry == ENV_SLOT_TOMBSTONE)
+        return false;
+
+    struct env_entry_t *entry = &table->entries[slot->entry - 1];
+    vfree(entry->pair);
+    entry->pair = NULL;
+    slot->entry = ENV_SLOT_TOMBSTONE;
+    table->tombstones++;
+    table->live--;
+    return true;
+}
 
 static struct env_vars_t *env_vars_malloc(void)
 {
     struct env_vars_t *env_vars = (struct env_vars_t *) vmalloc(sizeof(struct env_vars_t));
-    env_vars->ht = ht_malloc(ENV_HT_SIZE);
-    env_vars->update = false;
-    env_vars->capacity = ENV_HT_SIZE;
+    env_vars->table = env_table_malloc(ENV_STARTING_CAPACITY);
+    env_vars->unset = NULL;
+    env_vars->parent = NULL;
+    env_vars->update = true;
+    env_vars->capacity = ENV_STARTING_CAPACITY;
     env_vars->size = 0;
-
-    env_vars->environ = (char **)malloc(env_vars->capacity * sizeof(char *));
-    for (int i = 0; i < env_vars->capacity; i++)
-        env_vars->environ[i] = (char *)malloc(MAX_ENV_LEN * sizeof(char));
+    env_vars->environ = (char **)vmalloc(env_vars->capacity * sizeof(char *));
+    env_vars->environ[0] = NULL;
 
     return env_vars;
 }
 
 static void env_vars_free(struct env_vars_t *env_vars)
 {
-    ht_free(env_vars->ht);
-
-    for (int i = 0; i < env_vars->capacity; i++)
-        free(env_vars->environ[i]);
-
-    free(env_vars->environ);
-    free(env_vars);
+    env_table_free(env_vars->table);
+    vfree(env_vars->environ);
+    vfree(env_vars);
 }
 
 static struct paths_t *paths_malloc(void)
@@ -72,25 +208,56 @@ static struct paths_t *paths_malloc(void)
 static void paths_free(struct paths_t *p)
 {
     for (int i = 0; i < p->capacity; i++)
-        free(p->paths[i]);
+        vfree(p->paths[i]);
 
-    free(p->paths);
-    free(p);
+    vfree(p->paths);
+    vfree(p);
 }
 
 char *alias_get(struct env_t *env, char *key)
 {
-    return (char *)ht_get(env->aliases, key, strlen(key) + 1);
+    size_t len = strlen(key);
+    return env_table_get(env->aliases, key, len, env_hash(key, len));
 }
 
 char *env_get(struct env_vars_t *env_vars, char *key)
 {
-    return (char *)ht_get(env_vars->ht, key, (strlen(key) + 1) * sizeof(char));
+    size_t len = strlen(key);
+    return env_get_hashed(env_vars, key, len, env_hash(key, len));
+}
+
+uint64_t env_hash(const char *key, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/* returns true if a scope from 'from' up to, but not including, 'until' sets or removes key */
+static bool env_shadowed(struct env_vars_t *from, struct env_vars_t *until, const char *key,
+                         size_t len, uint64_t hash)
+{
+    for (struct env_vars_t *v = from; v != until; v = v->parent) {
+        if (env_table_get(v->table, key, len, hash) != NULL ||
+            (v->unset != NULL && env_table_get(v->unset, key, len, hash) != NULL))
+            return true;
+    }
+    return false;
 }
 
-struct ht_item_t *env_geth(struct env_vars_t *env_vars, unsigned int hash)
+char *env_get_hashed(struct env_vars_t *env_vars, const char *key, size_t len, uint64_t hash)
 {
-    return ht_geth(env_vars->ht, hash);
+    for (struct env_vars_t *v = env_vars; v != NULL; v = v->parent) {
+        char *value = env_table_get(v->table, key, len, hash);
+        if (value != NULL)
+            return value;
+        if (v->unset != NULL && env_table_get(v->unset, key, len, hash) != NULL)
+            return NULL;
+    }
+    return NULL;
 }
 
 void env_set(struct env_vars_t *env_vars, char *key, char *value)
@@ -98,48 +265,86 @@ void env_set(struct env_vars_t *env_vars, char *key, char *value)
 #ifdef DEBUG_ENV
     print_debug("set env var '%s'='%s'", key, value);
 #endif
-    ht_set(env_vars->ht, key, (strlen(key) + 1) * sizeof(char), value,
-           (strlen(value) + 1) * sizeof(char), NULL);
+    size_t len = strlen(key);
+    uint64_t hash = env_hash(key, len);
+    env_table_set(env_vars->table, key, len, hash, value);
+    if (env_vars->unset != NULL)
+        env_table_rm(env_vars->unset, key, len, hash);
     env_vars->update = true;
 }
 
 void env_rm(struct env_vars_t *env_vars, char *key)
 {
-    ht_rm(env_vars->ht, key, (strlen(key) + 1) * sizeof(char));
-    env_vars->update = true;
+    size_t len = strlen(key);
+    uint64_t hash = env_hash(key, len);
+    if (env_table_rm(env_vars->table, key, len, hash))
+        env_vars->update = true;
+    /* the variable may still be set in a parent scope, so the overlay has to remember it is gone */
+    if (env_vars->unset != NULL) {
+        env_table_set(env_vars->unset, key, len, hash, "");
+        env_vars->update = true;
+    }
 }
 
-void env_gen(struct env_vars_t *env_vars, char *env_str[env_vars->capacity])
+struct env_vars_t *env_overlay(struct env_vars_t *parent)
 {
-    int i;
-
-    if (env_vars->update) {
-        struct ht_item_t *item;
-        i = 0;
-
-        for (int hash = 0; hash < env_vars->capacity; hash++) {
-            if (env_vars->ht->keys[hash] != 0) {
-                item = env_geth(env_vars, hash);
-                /* hash table may have collisions */
-                while (item != NULL) {
-                    snprintf(env_vars->environ[i], MAX_ENV_LEN, "%s=%s", (char *)item->key,
-                             (char *)item->value);
-                    env_str[i] = env_vars->environ[i];
-                    i++;
-                    item = item->next;
-                }
-            }
-        }
+    struct env_vars_t *overlay = vmalloc(sizeof(struct env_vars_t));
+    overlay->table = env_table_malloc(ENV_OVERLAY_CAPACITY);
+    overlay->unset = env_table_malloc(ENV_OVERLAY_CAPACITY);
+    overlay->parent = parent;
+    overlay->environ = NULL;
+    overlay->size = 0;
+    overlay->capacity = 0;
+    overlay->update = true;
+    return overlay;
+}
 
-        env_str[i] = NULL;
-        env_vars->size = --i;
-        env_vars->update = false;
-    } else {
-        for (i = 0; i < env_vars->size; i++) {
-            env_str[i] = env_vars->environ[i];
-        }
-        env_str[i] = NULL;
+void env_overlay_free(struct env_vars_t *overlay)
+{
+    env_table_free(overlay->table);
+    env_table_free(overlay->unset);
+    vfree(overlay->environ);
+    vfree(overlay);
+}
+
+/*
+ * appends the variables of scope v that no scope between leaf and v shadows.
+ * the outermost scope goes first, so variables keep the order they were first set in.
+ */
+static size_t env_gen_scope(struct env_vars_t *leaf, struct env_vars_t *v, char **out, size_t i)
+{
+    if (v->parent != NULL)
+        i = env_gen_scope(leaf, v->parent, out, i);
+
+    struct env_table_t *table = v->table;
+    for (size_t e = 0; e < table->entries_len; e++) {
+        struct env_entry_t *entry = &table->entries[e];
+        if (entry->pair != NULL &&
+            !env_shadowed(leaf, v, entry->pair, entry->key_len, entry->hash))
+            out[i++] = entry->pair;
+    }
+    return i;
+}
+
+char **env_gen(struct env_vars_t *env_vars)
+{
+    /* an overlay can not know if a parent has changed, but merging is a single cheap pass */
+    if (!env_vars->update && env_vars->parent == NULL)
+        return env_vars->environ;
+
+    size_t needed = 1;
+    for (struct env_vars_t *v = env_vars; v != NULL; v = v->parent)
+        needed += v->table->live;
+    if (needed > env_vars->capacity) {
+        env_vars->capacity = MAX(env_vars->capacity * 2, needed);
+        env_vars->environ = vrealloc(env_vars->environ, env_vars->capacity * sizeof(char *));
     }
+
+    size_t i = env_gen_scope(env_vars, env_vars, env_vars->environ, 0);
+    env_vars->environ[i] = NULL;
+    env_vars->size = i;
+    env_vars->update = false;
+    return env_vars->environ;
 }
 
 void path_increase(struct paths_t *p, int new_len) {
@@ -150,7 +355,7 @@ void path_increase(struct paths_t *p, int new_len) {
     p->capacity = new_len;
 }
 
-static void env_update_ps1(struct env_t *env)
+void env_update_ps1(struct env_t *env)
 {
     char default_ps1[] = ">";
     char *ps1 = env_get(env->env_vars, "PS1");
@@ -176,6 +381,7 @@ static void env_update_ps1(struct env_t *env)
             char *home;
             char *cw;
             char *res;
+            const char *branch;
             uid_t uid;
             case '$':
                 uid = env->uid;
@@ -206,6 +412,15 @@ static void env_update_ps1(struct env_t *env)
                     ps1_tmp[pos++] = c;
                 break;
 
+            /* the git branch, \g also marks changes to tracked files. see segment.h */
+            case 'G':
+            case 'g':
+                branch = segment_get(c == 'g' ? SEGMENT_GIT_DIRTY : SEGMENT_GIT,
+                                     env_get(env->env_vars, "PWD"));
+                while ((c = *branch++) != 0 && pos < (int)sizeof(ps1_tmp) - 1)
+                    ps1_tmp[pos++] = c;
+                break;
+
             case 'C':
                 strncat(ps1_tmp, "\033[0;36m", 8);
                 pos += 7;
@@ -248,8 +463,12 @@ static void env_update_pwd(struct env_vars_t *env_vars)
     //env->env_vars->update = true;
 }
 
+/* an inherited HOME wins over the one in the password database, like in other shells */
 static int set_home_dir(struct env_vars_t *env_vars)
 {
+    if (env_get(env_vars, "HOME") != NULL)
+        return 0;
+
     struct passwd *pw = getpwuid(getuid());
     char *homedir = pw->pw_dir;
     
@@ -273,9 +492,18 @@ struct env_t *env_malloc(void)
     struct env_t *env = (struct env_t *) vmalloc(sizeof(struct env_t));
     env->env_vars = env_vars_malloc();
     env->paths = paths_malloc();
-    env->aliases = ht_malloc(ALIASES_HT_SIZE);
+    env->aliases = env_table_malloc(ALIASES_STARTING_CAPACITY);
     /* TODO: remove this, just for testing */
-    ht_set(env->aliases, "ls", 3, "ls --color=auto", 16, NULL);
+    env_table_set(env->aliases, "ls", 2, env_hash("ls", 2), "ls --color=auto");
+
+    /* inherit the environment valery was started with, the config may override it */
+    for (char **var = environ; *var != NULL; var++) {
+        char *eq = strchr(*var, '=');
+        if (eq == NULL || eq == *var)
+            continue;
+        size_t len = eq - *var;
+        env_table_set(env->env_vars->table, *var, len, env_hash(*var, len), eq + 1);
+    }
 
     set_home_dir(env->env_vars);
     set_uid(env);
@@ -290,8 +518,8 @@ void env_free(struct env_t *env)
 
     env_vars_free(env->env_vars);
     paths_free(env->paths);
-    ht_free(env->aliases);
-    free(env);
+    env_table_free(env->aliases);
+    vfree(env);
 }
 
 struct env_t *env_init(void)
@@ -0,0 +1,230 @@
+/*
+ *  The event loop of the interactive shell. The terminal, signals, exiting children, timers
+ *  and the segment thread are all file descriptors waited on with one epoll instance.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // syscall, wait4, NSIG
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "valery/valery.h"
+#include "valery/event.h"
+
+
+/* types */
+struct event_source_t {
+    int fd;
+    bool timer;             /* a timerfd, it has to be read to stop being readable */
+    event_fd_callback_t callback;
+    void *arg;
+};
+
+struct event_signal_t {
+    event_signal_callback_t callback;
+    void *arg;
+};
+
+
+static bool event_running = false;
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static sigset_t original_mask;
+
+static struct event_source_t *sources = NULL;
+static size_t sources_len = 0;
+static size_t sources_capacity = 0;
+static struct event_signal_t signal_handlers[NSIG];
+
+
+static struct event_source_t *source_find(int fd)
+{
+    for (size_t i = 0; i < sources_len; i++) {
+        if (sources[i].fd == fd)
+            return &sources[i];
+    }
+    return NULL;
+}
+
+static int source_add(int fd, bool timer, event_fd_callback_t callback, void *arg)
+{
+    if (!event_running)
+        return -1;
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    /* f.ex. regular files can not be polled */
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        return -1;
+
+    if (sources_len == sources_capacity) {
+        sources_capacity = sources_capacity == 0 ? EVENT_STARTING_CAPACITY : sources_capacity * 2;
+        sources = vrealloc(sources, sources_capacity * sizeof(struct event_source_t));
+    }
+    sources[sources_len++] = (struct event_source_t){ .fd = fd, .timer = timer,
+                                                      .callback = callback, .arg = arg };
+    return 0;
+}
+
+static void signals_read(void *arg, int fd)
+{
+    (void)arg;
+    struct signalfd_siginfo info;
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo >= NSIG)
+            continue;
+        struct event_signal_t *handler = &signal_handlers[info.ssi_signo];
+        if (handler->callback != NULL)
+            handler->callback(handler->arg, info.ssi_signo);
+    }
+}
+
+void event_init(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGWINCH);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1 || sigprocmask(SIG_BLOCK, &mask, &original_mask) == -1)
+        valery_exit_internal_error("could not start the event loop");
+    signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    event_running = true;
+    if (signal_fd == -1 || source_add(signal_fd, false, signals_read, NULL) == -1)
+        valery_exit_internal_error("could not read signals from a signalfd");
+}
+
+void event_free(void)
+{
+    /* the signals stay blocked, anything still pending would otherwise kill the shell now */
+    if (signal_fd != -1)
+        close(signal_fd);
+    if (epoll_fd != -1)
+        close(epoll_fd);
+    signal_fd = epoll_fd = -1;
+    event_running = false;
+
+    vfree(sources);
+    sources = NULL;
+    sources_len = sources_capacity = 0;
+}
+
+int event_add_fd(int fd, event_fd_callback_t callback, void *arg)
+{
+    return source_add(fd, false, callback, arg);
+}
+
+void event_rm_fd(int fd)
+{
+    struct event_source_t *source = source_find(fd);
+    if (source == NULL)
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    *source = sources[--sources_len];
+}
+
+int event_add_timer(uint64_t ms, event_fd_callback_t callback, void *arg)
+{
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer == -1)
+        return -1;
+    /* a time of zero would disarm the timer */
+    struct itimerspec spec = { .it_value = { .tv_sec = ms / 1000,
+                                             .tv_nsec = ms % 1000 * 1000000 + (ms == 0) } };
+    if (timerfd_settime(timer, 0, &spec, NULL) == -1 ||
+        source_add(timer, true, callback, arg) == -1) {
+        close(timer);
+        return -1;
+    }
+    return timer;
+}
+
+void event_rm_timer(int timer)
+{
+    if (timer == -1)
+        return;
+    event_rm_fd(timer);
+    close(timer);
+}
+
+void event_on_signal(int signo, event_signal_callback_t callback, void *arg)
+{
+    signal_handlers[signo] = (struct event_signal_t){ .callback = callback, .arg = arg };
+}
+
+void event_run_once(int timeout_ms)
+{
+    struct epoll_event events[EVENT_MAX_PER_WAIT];
+    int n = epoll_wait(epoll_fd, events, EVENT_MAX_PER_WAIT, timeout_ms);
+    for (int i = 0; i < n; i++) {
+        /* an earlier callback may have removed the source */
+        struct event_source_t *source = source_find(events[i].data.fd);
+        if (source == NULL)
+            continue;
+        struct event_source_t copy = *source;
+        uint64_t expirations;
+        if (copy.timer)
+            (void)!read(copy.fd, &expirations, sizeof(expirations));
+        copy.callback(copy.arg, copy.fd);
+    }
+}
+
+static void child_exited(void *arg, int fd)
+{
+    /* waking up the loop is all that is needed, the child is reaped by event_wait_child() */
+    (void)arg;
+    (void)fd;
+}
+
+pid_t event_wait_child(pid_t pid, int *status, struct rusage *usage)
+{
+    if (!event_running)
+        return wait4(pid, status, 0, usage);
+
+    int pidfd = -1;
+#ifdef SYS_pidfd_open
+    pidfd = syscall(SYS_pidfd_open, pid, 0);
+#endif
+    if (pidfd != -1 && event_add_fd(pidfd, child_exited, NULL) == -1) {
+        close(pidfd);
+        pidfd = -1;
+    }
+
+    /* without a pidfd, SIGCHLD on the signalfd wakes the loop instead */
+    pid_t rc;
+    while ((rc = wait4(pid, status, WNOHANG, usage)) == 0)
+        event_run_once(-1);
+
+    if (pidfd != -1) {
+        event_rm_fd(pidfd);
+        close(pidfd);
+    }
+    return rc;
+}
+
+const sigset_t *event_child_sigmask(void)
+{
+    return event_running ? &original_mask : NULL;
+}
@@ -0,0 +1,502 @@
+/*
+ *  Reads the state of git repositories for the prompt without running git.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // fstatat, st_mtim, strdup
+#define VALERY_MEM_TAG MEM_PROMPT
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "valery/valery.h"
+#include "valery/git.h"
+#include "valery/watch.h"
+
+
+/* the parts of the index file that are needed, every number in it is big endian */
+#define INDEX_SIGNATURE "DIRC"
+#define INDEX_HEADER_SIZE 12
+#define INDEX_ENTRY_SIZE 62     /* stat data, sha-1 object name and flags, before the path */
+#define INDEX_MTIME 8
+#define INDEX_MODE 24
+#define INDEX_SIZE 36
+#define INDEX_FLAGS 60
+#define INDEX_FLAG_VALID 0x8000
+#define INDEX_FLAG_EXTENDED 0x4000
+#define INDEX_FLAG_SKIP_WORKTREE 0x4000 /* in the extended flags */
+#define INDEX_MODE_GITLINK 0160000
+
+
+/* types */
+/* a tracked file as it was when it was added to the index */
+struct git_file_t {
+    uint32_t path;          /* where the path starts in paths */
+    uint32_t mtime;
+    uint32_t size;          /* truncated to 32 bits, like git does */
+};
+
+struct git_repo_t {
+    char *root;             /* the work tree, NULL if the slot is free */
+    char *gitdir;
+    int wd;                 /* the watch on gitdir, -1 if it could not be watched */
+    int tree_wds[GIT_MAX_WATCHED_DIRS];
+    size_t tree_wds_len;
+    bool tree_watched;      /* every directory with a tracked file is watched */
+    uint64_t last_used;
+    char head[GIT_HEAD_MAX];
+    struct timespec index_mtime;
+    off_t index_size;       /* -1 before the index has been read */
+    struct git_file_t *files;
+    size_t files_len;
+    size_t files_capacity;
+    char *paths;            /* NUL separated paths relative to root */
+    size_t paths_len;
+    size_t paths_capacity;
+    bool dirty;
+};
+
+
+/* only used by the prompt */
+static struct git_repo_t repos[GIT_CACHE_SIZE];
+static uint64_t git_tick = 0;
+static char prompt_segment[GIT_HEAD_MAX + 1];
+
+/* set by the watch thread when something in a cached repository changes */
+static pthread_mutex_t git_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool head_stale[GIT_CACHE_SIZE];     /* HEAD or the index may have changed */
+static bool tree_stale[GIT_CACHE_SIZE];     /* a tracked file may have changed */
+static bool repo_lost[GIT_CACHE_SIZE];      /* the git directory is gone */
+static bool tree_lost[GIT_CACHE_SIZE];      /* a watched directory of the work tree is gone */
+
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t be16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/* reads the varint of index version 4, the amount of chars to drop from the previous path */
+static size_t index_varint(const unsigned char **p, const unsigned char *end)
+{
+    unsigned char c = *(*p)++;
+    size_t value = c & 127;
+    while ((c & 128) && *p < end) {
+        c = *(*p)++;
+        value = ((value + 1) << 7) + (c & 127);
+    }
+    return value;
+}
+
+/* reads the start of the file at path into buf as a string. returns false if it can not be read */
+static bool read_small(const char *path, char *buf, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    ssize_t len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0)
+        return false;
+    buf[len] = 0;
+    return true;
+}
+
+/* a '.git' file instead of a directory points to the git directory, f.ex. in a linked work tree */
+static bool git_read_link(const char *root, char gitdir[PATH_MAX])
+{
+    char buf[PATH_MAX];
+    if (!read_small(gitdir, buf, sizeof(buf)) || strncmp(buf, "gitdir: ", 8) != 0)
+        return false;
+    char *path = buf + 8;
+    path[strcspn(path, "\r\n")] = 0;
+    if (path[0] == '/')
+        snprintf(gitdir, PATH_MAX, "%s", path);
+    else
+        snprintf(gitdir, PATH_MAX, "%s/%s", root, path);
+    return true;
+}
+
+/*
+ * finds the work tree that pwd is in by walking up to the first directory with a '.git' in it.
+ * returns false outside a repository.
+ */
+static bool git_find(const char *pwd, char root[PATH_MAX], char gitdir[PATH_MAX])
+{
+    struct stat st;
+    snprintf(root, PATH_MAX, "%s", pwd);
+    size_t len = strlen(root);
+    while (len > 0 && root[len - 1] == '/')
+        root[--len] = 0;
+
+    while (1) {
+        snprintf(gitdir, PATH_MAX, "%s/.git", root);
+        if (stat(gitdir, &st) == 0 &&
+            (S_ISDIR(st.st_mode) || (S_ISREG(st.st_mode) && git_read_link(root, gitdir)))) {
+            if (root[0] == 0)
+                strcpy(root, "/");
+            return true;
+        }
+        char *slash = strrchr(root, '/');
+        if (slash == NULL)
+            return false;
+        *slash = 0;
+    }
+}
+
+static void git_read_head(struct git_repo_t *repo)
+{
+    char path[PATH_MAX];
+    char buf[GIT_HEAD_MAX];
+    repo->head[0] = 0;
+    snprintf(path, PATH_MAX, "%s/HEAD", repo->gitdir);
+    if (!read_small(path, buf, sizeof(buf)))
+        return;
+
+    buf[strcspn(buf, "\r\n")] = 0;
+    if (strncmp(buf, "ref: refs/heads/", 16) == 0)
+        snprintf(repo->head, GIT_HEAD_MAX, "%s", buf + 16);
+    else if (strncmp(buf, "ref: ", 5) == 0)
+        snprintf(repo->head, GIT_HEAD_MAX, "%s", buf + 5);
+    else
+        /* detached, HEAD is the commit itself */
+        snprintf(repo->head, GIT_HEAD_MAX, "%.7s", buf);
+}
+
+static void git_add_file(struct git_repo_t *repo, const char *path, size_t len, uint32_t mtime,
+                         uint32_t size)
+{
+    if (repo->paths_len + len + 1 > repo->paths_capacity) {
+        repo->paths_capacity = MAX(repo->paths_capacity * 2, repo->paths_len + len + 1);
+        repo->paths = vrealloc(repo->paths, repo->paths_capacity);
+    }
+    if (repo->files_len == repo->files_capacity) {
+        repo->files_capacity = repo->files_capacity == 0 ? 64 : repo->files_capacity * 2;
+        repo->files = vrealloc(repo->files, repo->files_capacity * sizeof(struct git_file_t));
+    }
+    repo->files[repo->files_len++] = (struct git_file_t){ .path = repo->paths_len, .mtime = mtime,
+                                                          .size = size };
+    memcpy(repo->paths + repo->paths_len, path, len + 1);
+    repo->paths_len += len + 1;
+}
+
+/*
+ * reads the tracked files and their stat data from the index, versions 2 to 4 are understood.
+ * files git is told not to look at, and submodules, are left out.
+ */
+static void git_parse_index(struct git_repo_t *repo, const unsigned char *map, size_t size)
+{
+    const unsigned char *end = map + size;
+    if (size < INDEX_HEADER_SIZE || memcmp(map, INDEX_SIGNATURE, 4) != 0)
+        return;
+    uint32_t version = be32(map + 4);
+    uint32_t count = be32(map + 8);
+    if (version < 2 || version > 4)
+        return;
+
+    char path[PATH_MAX];
+    size_t path_len = 0;
+    const unsigned char *p = map + INDEX_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        const unsigned char *entry = p;
+        if (end - p < INDEX_ENTRY_SIZE)
+            return;
+        uint16_t flags = be16(entry + INDEX_FLAGS);
+        bool skip = (flags & INDEX_FLAG_VALID) ||
+                    (be32(entry + INDEX_MODE) & S_IFMT) == INDEX_MODE_GITLINK;
+        p += INDEX_ENTRY_SIZE;
+        if (flags & INDEX_FLAG_EXTENDED) {
+            if (end - p < 2)
+                return;
+            skip |= (be16(p) & INDEX_FLAG_SKIP_WORKTREE) != 0;
+            p += 2;
+        }
+
+        /* version 4 only stores how the path differs from the one before it */
+        if (version == 4) {
+            size_t drop = p < end ? index_varint(&p, end) : SIZE_MAX;
+            if (drop > path_len)
+                return;
+            path_len -= drop;
+        } else {
+            path_len = 0;
+        }
+        const unsigned char *nul = memchr(p, 0, end - p);
+        if (nul == NULL || path_len + (nul - p) >= PATH_MAX)
+            return;
+        memcpy(path + path_len, p, nul - p);
+        path_len += nul - p;
+        path[path_len] = 0;
+        p = nul + 1;
+        /* earlier versions pad every entry with NULs to a multiple of 8 */
+        if (version < 4)
+            p = entry + ((p - entry + 7) & ~(size_t)7);
+        if (p > end)
+            return;
+
+        if (!skip)
+            git_add_file(repo, path, path_len, be32(entry + INDEX_MTIME), be32(entry + INDEX_SIZE));
+    }
+}
+
+/* reads the index again if it has changed. returns true if it was read */
+static bool git_read_index(struct git_repo_t *repo)
+{
+    char path[PATH_MAX];
+    snprintf(path, PATH_MAX, "%s/index", repo->gitdir);
+    struct stat st = { 0 };
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    /* a repository without commits may not have an index */
+    if (fd != -1 && fstat(fd, &st) == -1)
+        st = (struct stat){ 0 };
+    if (st.st_size == repo->index_size && st.st_mtim.tv_sec == repo->index_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == repo->index_mtime.tv_nsec) {
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+
+    repo->index_size = st.st_size;
+    repo->index_mtime = st.st_mtim;
+    repo->files_len = 0;
+    repo->paths_len = 0;
+    if (fd == -1)
+        return true;
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            git_parse_index(repo, map, st.st_size);
+            munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+    return true;
+}
+
+/*
+ * returns true if a tracked file differs from the index. like git, the stat data is compared
+ * instead of the content. only whole seconds are compared, git does not store nanoseconds
+ * unless it is built to.
+ */
+static bool git_tree_dirty(struct git_repo_t *repo)
+{
+    int dirfd = open(repo->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1)
+        return false;
+
+    struct stat st;
+    bool dirty = false;
+    for (size_t i = 0; i < repo->files_len && !dirty; i++) {
+        struct git_file_t *file = &repo->files[i];
+        dirty = fstatat(dirfd, repo->paths + file->path, &st, AT_SYMLINK_NOFOLLOW) == -1 ||
+                (uint32_t)st.st_mtim.tv_sec != file->mtime || (uint32_t)st.st_size != file->size;
+    }
+    close(dirfd);
+    return dirty;
+}
+
+static void git_dir_changed(void *arg, uint32_t mask)
+{
+    pthread_mutex_lock(&git_lock);
+    head_stale[(uintptr_t)arg] = true;
+    if (mask & IN_IGNORED)
+        repo_lost[(uintptr_t)arg] = true;
+    pthread_mutex_unlock(&git_lock);
+}
+
+static void git_tree_changed(void *arg, uint32_t mask)
+{
+    pthread_mutex_lock(&git_lock);
+    tree_stale[(uintptr_t)arg] = true;
+    if (mask & IN_IGNORED)
+        tree_lost[(uintptr_t)arg] = true;
+    pthread_mutex_unlock(&git_lock);
+}
+
+static void git_unwatch_tree(size_t i)
+{
+    struct git_repo_t *repo = &repos[i];
+    for (size_t j = 0; j < repo->tree_wds_len; j++)
+        watch_rm(repo->tree_wds[j], git_tree_changed, (void *)(uintptr_t)i);
+    repo->tree_wds_len = 0;
+    repo->tree_watched = false;
+}
+
+/* watches every directory with a tracked file in it, unless there are too many of them */
+static void git_watch_tree(size_t i)
+{
+    struct git_repo_t *repo = &repos[i];
+    git_unwatch_tree(i);
+    pthread_mutex_lock(&git_lock);
+    tree_lost[i] = false;
+    pthread_mutex_unlock(&git_lock);
+
+    /* the directories as the offset and length of a path that is in them */
+    uint32_t dirs[GIT_MAX_WATCHED_DIRS];
+    size_t dirs_len[GIT_MAX_WATCHED_DIRS];
+    size_t n = 0;
+    for (size_t j = 0; j < repo->files_len; j++) {
+        const char *path = repo->paths + repo->files[j].path;
+        const char *slash = strrchr(path, '/');
+        size_t len = slash == NULL ? 0 : (size_t)(slash - path);
+        size_t k = n;
+        /* the index is sorted, so the directory of the file before is the most likely match */
+        while (k > 0 && !(dirs_len[k - 1] == len &&
+                          memcmp(repo->paths + dirs[k - 1], path, len) == 0))
+            k--;
+        if (k > 0)
+            continue;
+        if (n == GIT_MAX_WATCHED_DIRS)
+            return;
+        dirs[n] = repo->files[j].path;
+        dirs_len[n++] = len;
+    }
+
+    char dir[PATH_MAX];
+    for (size_t j = 0; j < n; j++) {
+        snprintf(dir, PATH_MAX, "%s/%.*s", repo->root, (int)dirs_len[j], repo->paths + dirs[j]);
+        int wd = watch_add(dir, GIT_TREE_CHANGES, git_tree_changed, (void *)(uintptr_t)i);
+        if (wd == -1) {
+            git_unwatch_tree(i);
+            return;
+        }
+        repo->tree_wds[repo->tree_wds_len++] = wd;
+    }
+    repo->tree_watched = true;
+}
+
+static void git_clear(size_t i)
+{
+    struct git_repo_t *repo = &repos[i];
+    watch_rm(repo->wd, git_dir_changed, (void *)(uintptr_t)i);
+    git_unwatch_tree(i);
+    vfree(repo->root);
+    vfree(repo->gitdir);
+    vfree(repo->files);
+    vfree(repo->paths);
+    *repo = (struct git_repo_t){ .wd = -1 };
+}
+
+/* returns the slot of the repository, a new one has to be read from scratch */
+static size_t git_slot(const char *root, const char *gitdir)
+{
+    size_t i;
+    size_t free_slot = GIT_CACHE_SIZE;
+    for (i = 0; i < GIT_CACHE_SIZE; i++) {
+        if (repos[i].root == NULL) {
+            if (free_slot == GIT_CACHE_SIZE)
+                free_slot = i;
+        } else if (strcmp(repos[i].root, root) == 0 && strcmp(repos[i].gitdir, gitdir) == 0) {
+            break;
+        }
+    }
+
+    if (i < GIT_CACHE_SIZE) {
+        pthread_mutex_lock(&git_lock);
+        bool lost = repo_lost[i];
+        pthread_mutex_unlock(&git_lock);
+        if (!lost)
+            return i;
+        git_clear(i);
+        free_slot = i;
+    }
+
+    if (free_slot == GIT_CACHE_SIZE) {
+        free_slot = 0;
+        for (i = 1; i < GIT_CACHE_SIZE; i++) {
+            if (repos[i].last_used < repos[free_slot].last_used)
+                free_slot = i;
+        }
+        git_clear(free_slot);
+    }
+    repos[free_slot] = (struct git_repo_t){ .root = strdup(root), .gitdir = strdup(gitdir),
+                                            .wd = -1, .index_size = -1 };
+    pthread_mutex_lock(&git_lock);
+    head_stale[free_slot] = tree_stale[free_slot] = true;
+    repo_lost[free_slot] = tree_lost[free_slot] = false;
+    pthread_mutex_unlock(&git_lock);
+    return free_slot;
+}
+
+const char *git_prompt(const char *pwd, bool dirty)
+{
+    char root[PATH_MAX], gitdir[PATH_MAX];
+    if (pwd == NULL || !git_find(pwd, root, gitdir))
+        return NULL;
+
+    size_t i = git_slot(root, gitdir);
+    struct git_repo_t *repo = &repos[i];
+    repo->last_used = ++git_tick;
+
+    /* the flags are cleared before reading, so no change can happen unnoticed in between */
+    pthread_mutex_lock(&git_lock);
+    bool head = head_stale[i] || repo->wd == -1;
+    bool lost = tree_lost[i];
+    bool tree = tree_stale[i] || lost || !repo->tree_watched;
+    head_stale[i] = false;
+    if (dirty)
+        tree_stale[i] = false;
+    pthread_mutex_unlock(&git_lock);
+
+    if (head) {
+        if (repo->wd == -1)
+            repo->wd = watch_add(repo->gitdir, GIT_DIR_CHANGES, git_dir_changed,
+                                 (void *)(uintptr_t)i);
+        git_read_head(repo);
+        if (git_read_index(repo)) {
+            git_unwatch_tree(i);
+            tree = true;
+        }
+    }
+
+    if (dirty && tree) {
+        if (lost)
+            git_unwatch_tree(i);
+        if (!repo->tree_watched)
+            git_watch_tree(i);
+        repo->dirty = git_tree_dirty(repo);
+    }
+
+    if (repo->head[0] == 0)
+        return NULL;
+    snprintf(prompt_segment, sizeof(prompt_segment), "%s", repo->head);
+    if (dirty && repo->dirty) {
+        size_t len = strlen(prompt_segment);
+        prompt_segment[MIN(len, sizeof(prompt_segment) - 2)] = GIT_DIRTY_SYM;
+        prompt_segment[MIN(len, sizeof(prompt_segment) - 2) + 1] = 0;
+    }
+    return prompt_segment;
+}
+
+void git_free(void)
+{
+    for (size_t i = 0; i < GIT_CACHE_SIZE; i++) {
+        if (repos[i].root != NULL)
+            git_clear(i);
+    }
+}
@@ -1,8 +1,9 @@
 /*
- *  Operations on history file that stores previously used commands
- *  in succesive order.
+ *  Operations on the history files that store previously used commands in succesive order.
+ *  Every command is a fixed size record in an append-only file, its text is in a string heap
+ *  next to it. Both are mapped into memory, so nothing is parsed to read the history.
  *
- *  Copyright (C) 2022 Nicolai Brand 
+ *  Copyright (C) 2022 Nicolai Brand
  *
  *  This program is free software: you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -17,185 +18,311 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-
+#define _GNU_SOURCE             // flock, getline, PATH_MAX
+#define VALERY_MEM_TAG MEM_HISTORY
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "valery/valery.h"
+#include "valery/env.h"
 #include "valery/histfile.h"
+#include "valery/profile.h"
 
 
-/* returns 1 if the given action will put the file pointer out of
- * bounds, else 0.
- */
-static int out_of_bounds(struct hist_t *hist, enum histaction_t action)
+static int write_all(int fd, const void *buf, size_t len)
 {
-    if (action == HIST_UP && hist->pos == 0)
-        return 1;
-
-    /* minus 1 because hist->pos is zero indexed */
-    if (action == HIST_DOWN && hist->pos == hist->s_len + hist->f_len - 1)
-        return 1;
-
+    const char *pos = buf;
+    while (len > 0) {
+        ssize_t written = write(fd, pos, len);
+        if (written == -1)
+            return -1;
+        pos += written;
+        len -= written;
+    }
     return 0;
 }
 
-/* 
- * stores the amount of lines in the file and in the process moves
- * the file pointer to the end of the file.
+static void hist_unmap(struct hist_t *hist)
+{
+    if (hist->records_map != NULL)
+        munmap(hist->records_map, hist->records_map_size);
+    if (hist->strings != NULL)
+        munmap(hist->strings, hist->strings_size);
+    hist->records_map = NULL;
+    hist->records = NULL;
+    hist->strings = NULL;
+    hist->records_map_size = hist->strings_size = hist->f_len = 0;
+}
+
+/*
+ * maps the history files as they are now. the records are mapped before the string heap, and
+ * writers append to the heap before the records, so every mapped record has its string.
  */
-static void hist_count(struct hist_t *hist)
+static void hist_map(struct hist_t *hist)
 {
-    size_t len = 0;
-    long chars = 0;
+    hist_unmap(hist);
 
-    while (!feof(hist->fp)) {
-        chars++;
-        if (fgetc(hist->fp) == '\n')
-            len++;
-    }
+    struct stat st;
+    if (fstat(hist->records_fd, &st) == -1 || (size_t)st.st_size <= sizeof(struct hist_header_t))
+        return;
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hist->records_fd, 0);
+    if (map == MAP_FAILED)
+        return;
+    hist->records_map = map;
+    hist->records_map_size = st.st_size;
+    hist->records = (struct hist_record_t *)((char *)map + sizeof(struct hist_header_t));
+    hist->f_len = (st.st_size - sizeof(struct hist_header_t)) / sizeof(struct hist_record_t);
 
-    hist->f_len = len;
-    hist->f_chars = chars;
+    if (fstat(hist->strings_fd, &st) == -1 || st.st_size == 0)
+        return;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, hist->strings_fd, 0);
+    if (map == MAP_FAILED)
+        return;
+    hist->strings = map;
+    hist->strings_size = st.st_size;
 }
 
 /*
- * opens a read and write connection to the hist file.
- * creates a new hist file if input path does not exist.
- * returns 1 if no connection could be made, else 0.
+ * appends the n records and their heap of NUL terminated commands to the files. the command of
+ * every record is an offset into heap, and becomes an offset into the string heap file.
  */
-static int hist_open(struct hist_t *hist, char *path)
+static void hist_append(struct hist_t *hist, struct hist_record_t *records, size_t n, char *heap,
+                        size_t heap_len)
 {
-    hist->fp = fopen(path, "a+");
+    flock(hist->records_fd, LOCK_EX);
+    off_t base = lseek(hist->strings_fd, 0, SEEK_END);
+    if (base != -1 && write_all(hist->strings_fd, heap, heap_len) == 0) {
+        for (size_t i = 0; i < n; i++)
+            records[i].command += base;
+        if (write_all(hist->records_fd, records, n * sizeof(struct hist_record_t)) == -1)
+            valery_error("could not write to the history file");
+    }
+    flock(hist->records_fd, LOCK_UN);
+}
+
+/* the plain text history of earlier versions becomes records with only the command known */
+static void hist_import(struct hist_t *hist, char *text_path)
+{
+    FILE *fp = fopen(text_path, "r");
+    if (fp == NULL)
+        return;
 
-    if (hist->fp != NULL) {
-        /* hist_t_count() moves file pointer to end of file */
-        hist_count(hist);
-        hist->f_pos = hist->f_len;
-        return 0;
+    size_t n = 0, capacity = 64;
+    size_t heap_len = 0, heap_capacity = 4096;
+    struct hist_record_t *records = vmalloc(capacity * sizeof(struct hist_record_t));
+    char *heap = vmalloc(heap_capacity);
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_capacity, fp)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = 0;
+        if (len == 0)
+            continue;
+
+        if (n == capacity) {
+            capacity *= 2;
+            records = vrealloc(records, capacity * sizeof(struct hist_record_t));
+        }
+        while (heap_len + len + 1 > heap_capacity) {
+            heap_capacity *= 2;
+            heap = vrealloc(heap, heap_capacity);
+        }
+        records[n++] = (struct hist_record_t){ .exit_code = HIST_EXIT_UNKNOWN, .command = heap_len };
+        memcpy(heap + heap_len, line, len + 1);
+        heap_len += len + 1;
     }
 
-    return 1;
+    if (n > 0)
+        hist_append(hist, records, n, heap, heap_len);
+    vfree(line);
+    vfree(records);
+    vfree(heap);
+    fclose(fp);
+}
+
+static void hist_close(struct hist_t *hist)
+{
+    hist_unmap(hist);
+    if (hist->records_fd != -1)
+        close(hist->records_fd);
+    if (hist->strings_fd != -1)
+        close(hist->strings_fd);
+    hist->records_fd = hist->strings_fd = -1;
 }
 
 /*
- * traverses the hist one line in the given direction.
- * NB: function does not make sure direction does not cause
- * hist to go out of bounds.
+ * opens the history files, creating them if they do not exist.
+ * returns 1 if they could not be opened or are not history files, else 0.
  */
-long hist_traverse(struct hist_t *hist, enum histaction_t direction)
-{
-    direction == HIST_UP ? hist->pos-- : hist->pos++;
-
-    /* histline in memory, do not update file pointer in histfile */
-    if (hist->pos + 1 > hist->f_len)
-        return READ_FROM_MEMORY;
-
-    /* read from hist file */
-    long position_in_file = ftell(hist->fp);
-    /* decrement pos to one char before \n, unless it is at the beginning */
-    if (position_in_file != 0) --position_in_file;
-
-    while (fgetc(hist->fp) != '\n') {
-        if (direction == HIST_UP) {
-            if (position_in_file == 0) { 
-                /* actual position will be delayed by one, so set file pointer to zero */
-                fseek(hist->fp, 0, SEEK_SET);
-                break;
-            }
-            fseek(hist->fp, --position_in_file, SEEK_SET);
-        } else {
-            if (position_in_file == hist->f_chars) break;
-            fseek(hist->fp, ++position_in_file, SEEK_SET);
-        }
+static int hist_open(struct hist_t *hist, char *records_path, char *strings_path, char *text_path)
+{
+    hist->records_fd = open(records_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    hist->strings_fd = open(strings_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (hist->records_fd == -1 || hist->strings_fd == -1) {
+        hist_close(hist);
+        return 1;
+    }
+
+    struct hist_header_t header;
+    bool created = false;
+    flock(hist->records_fd, LOCK_EX);
+    ssize_t len = pread(hist->records_fd, &header, sizeof(header), 0);
+    if (len == 0) {
+        header = (struct hist_header_t){ .magic = HIST_MAGIC, .version = HIST_VERSION,
+                                         .record_size = sizeof(struct hist_record_t) };
+        created = write_all(hist->records_fd, &header, sizeof(header)) == 0;
+        len = created ? (ssize_t)sizeof(header) : -1;
     }
-    position_in_file++;
+    flock(hist->records_fd, LOCK_UN);
 
-    return position_in_file;
+    if (len != sizeof(header) || memcmp(header.magic, HIST_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != HIST_VERSION || header.record_size != sizeof(struct hist_record_t)) {
+        valery_error("the history file has an unknown format, commands will not be saved");
+        hist_close(hist);
+        return 1;
+    }
+
+    if (created)
+        hist_import(hist, text_path);
+    hist_map(hist);
+    return 0;
 }
 
-/*
- * reads one line of the hist file and moves the file pointer back to the given offset.
- * if offset is -1, it uses ftell(hist->fp) to get the offset
- */
-static void hist_read_line_f(struct hist_t *hist, char buf[MAX_COMMAND_LEN], long offset)
+size_t hist_len(struct hist_t *hist)
+{
+    return hist->f_len + hist->s_len;
+}
+
+struct hist_record_t *hist_record(struct hist_t *hist, size_t i)
 {
-    if (offset == -1)
-        offset = ftell(hist->fp);
-    /* read hist line into buffer */
-    fgets(buf, MAX_COMMAND_LEN, hist->fp);
-    /* move file pointer back to last '\n' */
-    fseek(hist->fp, offset, SEEK_SET);
+    return i < hist->f_len ? &hist->records[i] : &hist->stored[i - hist->f_len];
+}
+
+const char *hist_command(struct hist_t *hist, size_t i)
+{
+    if (i >= hist->f_len)
+        return hist->stored_commands[i - hist->f_len];
+    uint64_t offset = hist->records[i].command;
+    return offset < hist->strings_size ? hist->strings + offset : "";
+}
+
+const char *hist_suggest(struct hist_t *hist, const char *prefix, size_t len)
+{
+    return suggest_get(hist->suggest, prefix, len);
 }
 
 void hist_reset_pos(struct hist_t *hist)
 {
-    /* move file pointer to end of file */
-    fseek(hist->fp, 0, SEEK_END);
-    /* reset position counters */
-    hist->f_pos = hist->f_len;
-    hist->pos = hist->f_len + hist->s_len;
+    hist->pos = hist_len(hist);
 }
 
 enum readfrom_t hist_get_line(struct hist_t *hist, char buf[MAX_COMMAND_LEN], enum histaction_t action)
 {
-    if (out_of_bounds(hist, action))
-        return DID_NOT_READ;
-
-    long rc = hist_traverse(hist, action);
-    if (rc == READ_FROM_MEMORY) {
-        size_t index = hist->pos - hist->f_len;
-        strncpy(buf, hist->stored_commands[index], MAX_COMMAND_LEN);
-        return READ_FROM_MEMORY;
+    if (action == HIST_UP) {
+        if (hist->pos == 0)
+            return DID_NOT_READ;
+        hist->pos--;
+    } else {
+        /* going down stops at the newest command */
+        if (hist->pos + 1 >= hist_len(hist))
+            return DID_NOT_READ;
+        hist->pos++;
     }
 
-    /* read from hist file, rc is the offset of the file pointer */
-    hist_read_line_f(hist, buf, rc);
-    return READ_FROM_HIST;
+    strncpy(buf, hist_command(hist, hist->pos), MAX_COMMAND_LEN - 1);
+    buf[MAX_COMMAND_LEN - 1] = 0;
+    return hist->pos < hist->f_len ? READ_FROM_HIST : READ_FROM_MEMORY;
 }
 
 void hist_write(struct hist_t *hist)
 {
-    for (size_t i = 0; i < hist->s_len; i++) {
-        if (strcmp(hist->stored_commands[i], "") != 0) {
-            fputs(hist->stored_commands[i], hist->fp);
-            fputs("\n", hist->fp);
-            hist->f_len++;
+    if (hist->s_len == 0)
+        return;
+
+    if (hist->records_fd != -1) {
+        size_t heap_len = 0;
+        for (size_t i = 0; i < hist->s_len; i++)
+            heap_len += strlen(hist->stored_commands[i]) + 1;
+        char *heap = vmalloc(heap_len);
+        char *pos = heap;
+        for (size_t i = 0; i < hist->s_len; i++) {
+            size_t len = strlen(hist->stored_commands[i]) + 1;
+            memcpy(pos, hist->stored_commands[i], len);
+            hist->stored[i].command = pos - heap;
+            pos += len;
         }
+        hist_append(hist, hist->stored, hist->s_len, heap, heap_len);
+        vfree(heap);
     }
-    /* move file pointer back to end of file */
-    fseek(hist->fp, 0, SEEK_END);
+
+    hist->s_len = 0;
+    hist->pending = false;
+    /* other shells may have written too, they are part of the history from now on */
+    if (hist->records_fd != -1)
+        hist_map(hist);
 }
 
 void hist_save(struct hist_t *hist, char buf[MAX_COMMAND_LEN])
 {
+    hist->pending = false;
+    size_t len = strcspn(buf, "\n");
+    if (len == 0)
+        return;
+
     if (hist->s_len == MAX_COMMANDS_BEFORE_WRITE)
         hist_write(hist);
-    strncpy(hist->stored_commands[hist->s_len++], buf, MAX_COMMAND_LEN);
+
+    char cwd[PATH_MAX];
+    uint64_t cwd_id = getcwd(cwd, sizeof(cwd)) != NULL ? env_hash(cwd, strlen(cwd)) : 0;
+    hist->stored[hist->s_len] = (struct hist_record_t){ .time = time(NULL), .cwd_id = cwd_id };
+
+    len = MIN(len, MAX_COMMAND_LEN - 1);
+    memcpy(hist->stored_commands[hist->s_len], buf, len);
+    hist->stored_commands[hist->s_len][len] = 0;
+    suggest_add(hist->suggest, buf, len, hist->stored[hist->s_len].time);
+    hist->s_len++;
+    hist->pending = true;
+    hist->started_ns = profile_now();
 }
 
-struct hist_t *hist_malloc(char *full_path_to_hist_file)
+void hist_finish(struct hist_t *hist, int exit_code)
 {
-    struct hist_t *hist = (struct hist_t *) vmalloc(sizeof(struct hist_t));
-    hist->s_len = 0;
+    if (!hist->pending)
+        return;
+    struct hist_record_t *record = &hist->stored[hist->s_len - 1];
+    record->exit_code = exit_code;
+    record->duration_ms = (profile_now() - hist->started_ns) / 1000000;
+    hist->pending = false;
+}
+
+struct hist_t *hist_malloc(char *records_path, char *strings_path, char *text_path)
+{
+    struct hist_t *hist = (struct hist_t *) vcalloc(1, sizeof(struct hist_t));
     hist->stored_commands = vmalloc(MAX_COMMANDS_BEFORE_WRITE * sizeof(char *));
 
     /* allocate space for all strings */
     for (int i = 0; i < MAX_COMMANDS_BEFORE_WRITE; i++)
         hist->stored_commands[i] = vmalloc(MAX_COMMAND_LEN * sizeof(char));
 
-    int rc = hist_open(hist, full_path_to_hist_file);
-    /* if no connection could be made to the hist file, set the pointer to null */
-    if (rc == 1)
-        hist->fp = NULL;
-
-    /*
-     * initially no commands in memory, so set pos to file pos
-     * NB: hist->pos is zero indexed
-     */
-    hist->pos = hist->f_pos - 1;
-    
+    /* without the files the history only lives as long as the shell */
+    hist_open(hist, records_path, strings_path, text_path);
+    hist_reset_pos(hist);
+
+    /* commands other shells write later are not suggested until the next start */
+    hist->suggest = suggest_malloc();
+    for (size_t i = 0; i < hist->f_len; i++) {
+        const char *command = hist_command(hist, i);
+        suggest_add(hist->suggest, command, strlen(command), hist->records[i].time);
+    }
     return hist;
 }
 
@@ -204,19 +331,21 @@ void hist_free(struct hist_t *hist)
     if (hist == NULL)
         return;
 
-    if (hist->fp != NULL)
-        fclose(hist->fp);
-
+    hist_close(hist);
+    suggest_free(hist->suggest);
     for (int i = 0; i < MAX_COMMANDS_BEFORE_WRITE; i++)
-        free(hist->stored_commands[i]);
+        vfree(hist->stored_commands[i]);
 
-    free(hist->stored_commands);
-    free(hist);
+    vfree(hist->stored_commands);
+    vfree(hist);
 }
 
 struct hist_t *hist_init(char *home_folder)
 {
-    char hist_file_path[1024] = {0};
-    snprintf(hist_file_path, 1024, "%s/%s", home_folder, HISTFILE_NAME);
-    return hist_malloc(hist_file_path);
+    char records_path[PATH_MAX], strings_path[PATH_MAX], text_path[PATH_MAX];
+    snprintf(records_path, PATH_MAX, "%s/%s", home_folder, HISTFILE_NAME);
+    snprintf(strings_path, PATH_MAX, "%s/%s", home_folder, HISTFILE_STRINGS_NAME);
+    snprintf(text_path, PATH_MAX, "%s/%s", home_folder, HISTFILE_TEXT_NAME);
+
+    return hist_malloc(records_path, strings_path, text_path);
 }
@@ -19,6 +19,7 @@
 #include "lib/nicc/nicc.h"
 #include "valery/interpreter/lexer.h"
 #include "valery/interpreter/ast.h"
+#include "valery/interpreter/impl/glob.h"
 
 //extern const char *tokentype_str[T_ENUM_COUNT];
 static void ast_print_expr(struct Expr *expr_head);
@@ -36,6 +37,11 @@ static void literal_print(struct LiteralExpr *expr)
 
 static void command_print(struct CommandExpr *expr)
 {
+    for (struct Assignment *a = expr->assignments; a != NULL; a = a->next) {
+        printf("%s=", a->name);
+        ast_print_expr(a->value);
+        putchar(' ');
+    }
     int bound = darr_get_size(expr->exprs);
     for (int i = 0; i < bound; i++) {
         ast_print_expr(darr_get(expr->exprs, i));
@@ -44,6 +50,46 @@ static void command_print(struct CommandExpr *expr)
     }
 }
 
+static void word_print(struct WordExpr *expr)
+{
+    for (size_t i = 0; i < expr->parts_len; i++) {
+        struct WordPart *part = &expr->parts[i];
+        switch (part->type) {
+            case WORD_LITERAL:
+                printf("%.*s", (int)part->len, part->str);
+                break;
+
+            case WORD_PARAM:
+                printf("${%s", part->str);
+                if (part->fallback != NULL) {
+                    printf(part->fallback_if_empty ? ":-" : "-");
+                    word_print(part->fallback);
+                }
+                putchar('}');
+                break;
+
+            case WORD_POSITIONAL:
+                printf("${%zu}", part->len);
+                break;
+
+            case WORD_ARG_COUNT:
+                printf("$#");
+                break;
+
+            case WORD_ALL_ARGS:
+                printf("$@");
+                break;
+
+            case WORD_COMMAND_SUBST:
+                printf("$(");
+                for (int j = 0; j < darr_get_size(part->statements); j++)
+                    ast_print_stmt(darr_get(part->statements, j));
+                putchar(')');
+                break;
+        }
+    }
+}
+
 static void binary_print(struct BinaryExpr *expr)
 {
     putchar('(');
@@ -71,6 +117,32 @@ static void ast_print_expr(struct Expr *expr_head)
         case EXPR_LITERAL:
             literal_print((struct LiteralExpr *)expr_head);
             break;
+        case EXPR_WORD:
+            word_print((struct WordExpr *)expr_head);
+            break;
+        case EXPR_GLOB:
+            printf("%s", ((struct GlobExpr *)expr_head)->pattern->word);
+            break;
+        case EXPR_FUNCTION: {
+            struct function_t *function = ((struct FunctionExpr *)expr_head)->function;
+            printf("%s() {", function->name);
+            for (int i = 0; i < darr_get_size(function->statements); i++)
+                ast_print_stmt(darr_get(function->statements, i));
+            putchar('}');
+            break;
+        }
+        case EXPR_RETURN:
+            printf("return ");
+            ast_print_expr(((struct ReturnExpr *)expr_head)->code);
+            break;
+        case EXPR_SUBSHELL: {
+            struct darr_t *statements = ((struct SubshellExpr *)expr_head)->statements;
+            putchar('(');
+            for (int i = 0; i < darr_get_size(statements); i++)
+                ast_print_stmt(darr_get(statements, i));
+            putchar(')');
+            break;
+        }
 
         default:
             printf("AST TYPE NOT HANLDED, %d\n", expr_head->type);
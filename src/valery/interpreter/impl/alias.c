@@ -0,0 +1,256 @@
+/*
+ *  Alias substitution. The value of an alias is lexed once and the tokens are kept, so using an
+ *  alias only copies its tokens into the token list of the command line.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // strdup, strndup
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "valery/valery.h"
+#include "valery/env.h"
+#include "valery/table.h"
+#include "valery/interpreter/lexer.h"
+#include "valery/interpreter/parser_utils.h"
+#include "valery/interpreter/impl/alias.h"
+
+
+/* types */
+struct alias_entry_t {
+    char *name;
+    uint64_t hash;
+    struct token_t **tokens;    /* the lexed value, without the T_EOF token */
+    size_t tokens_len;
+    bool blank;                 /* the value ends with a blank */
+};
+
+
+static struct env_table_t *alias_table = NULL;
+
+static struct table_t entries = TABLE_INIT(struct alias_entry_t, ALIAS_CACHE_STARTING_CAPACITY);
+
+/* what every alias_save() inside a scope saw, so the scope can be undone */
+static struct alias_undo_t *undo = NULL;
+static size_t undo_len = 0;
+static size_t undo_capacity = 0;
+static int scopes = 0;
+
+
+static void alias_entry_free(struct alias_entry_t *entry)
+{
+    for (size_t i = 0; i < entry->tokens_len; i++) {
+        vfree(entry->tokens[i]->lexeme);
+        vfree(entry->tokens[i]->literal);
+        vfree(entry->tokens[i]);
+    }
+    vfree(entry->tokens);
+    vfree(entry->name);
+}
+
+static bool alias_eq(const void *item, const void *key)
+{
+    return strcmp(((const struct alias_entry_t *)item)->name, key) == 0;
+}
+
+/* lexes the value of the alias and caches the tokens */
+static struct alias_entry_t *alias_compile(const char *name, uint64_t hash, char *value)
+{
+    /* tokenize() only reads the value, the tokens have copies of everything they need */
+    struct tokenlist_t *tl = tokenize(value);
+    /* the last token is T_EOF */
+    tl->size--;
+    vfree(tl->tokens[tl->size]);
+
+    size_t len = strlen(value);
+    bool added;
+    struct alias_entry_t *entry = table_put(&entries, hash, name, alias_eq, &added);
+    *entry = (struct alias_entry_t){
+        .name = strdup(name),
+        .hash = hash,
+        .tokens = tl->tokens,
+        .tokens_len = tl->size,
+        .blank = len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t')
+    };
+    vfree(tl);
+    return entry;
+}
+
+/* returns the cached alias, compiling it if it has not been used before, or NULL if no alias */
+static struct alias_entry_t *alias_lookup(const char *name)
+{
+    size_t len = strlen(name);
+    uint64_t hash = env_hash(name, len);
+    struct alias_entry_t *entry = table_get(&entries, hash, name, alias_eq);
+    if (entry != NULL)
+        return entry;
+
+    char *value = env_table_get(alias_table, name, len, hash);
+    if (value == NULL)
+        return NULL;
+    return alias_compile(name, hash, value);
+}
+
+/* copies the token onto the ast arena, so the cache may change while the ast is in use */
+static struct token_t *token_copy(struct token_t *token)
+{
+    struct token_t *copy = ast_arena_alloc(sizeof(struct token_t));
+    *copy = *token;
+    if (token->lexeme != NULL) {
+        size_t size = strlen(token->lexeme) + 1;
+        copy->lexeme = ast_arena_alloc(size);
+        memcpy(copy->lexeme, token->lexeme, size);
+    }
+    if (token->literal != NULL) {
+        copy->literal = ast_arena_alloc(token->literal_size + 1);
+        memcpy(copy->literal, token->literal, token->literal_size);
+        ((char *)copy->literal)[token->literal_size] = 0;
+    }
+    return copy;
+}
+
+/* replaces the token at pos with the tokens of the alias */
+static void alias_splice(struct tokenlist_t *tokenlist, size_t pos, struct alias_entry_t *alias)
+{
+    size_t size = tokenlist->size - 1 + alias->tokens_len;
+    if (size > tokenlist->capacity) {
+        while (size > tokenlist->capacity)
+            tokenlist->capacity *= 2;
+        tokenlist->tokens = vrealloc(tokenlist->tokens,
+                                     tokenlist->capacity * sizeof(struct token_t *));
+    }
+
+    memmove(&tokenlist->tokens[pos + alias->tokens_len], &tokenlist->tokens[pos + 1],
+            (tokenlist->size - pos - 1) * sizeof(struct token_t *));
+    for (size_t i = 0; i < alias->tokens_len; i++)
+        tokenlist->tokens[pos + i] = token_copy(alias->tokens[i]);
+    tokenlist->size = size;
+}
+
+static bool alias_active(uint64_t *active, int depth, struct alias_entry_t *alias)
+{
+    for (int i = 0; i < depth; i++) {
+        if (active[i] == alias->hash)
+            return true;
+    }
+    return false;
+}
+
+void alias_expand(struct tokenlist_t *tokenlist)
+{
+    /*
+     * hashes of the aliases expanded so far, an alias is never expanded inside its own value.
+     * not pointers, because compiling another alias may move the cache entries.
+     */
+    uint64_t active[ALIAS_MAX_DEPTH];
+    int depth = 0;
+    size_t pos = tokenlist->pos;
+    /* the word after a value that ended with a blank, it is checked once pos is done */
+    size_t next = ALIAS_NO_NEXT;
+
+    while (depth < ALIAS_MAX_DEPTH && pos < tokenlist->size) {
+        struct token_t *token = tokenlist->tokens[pos];
+        struct alias_entry_t *alias = token->type == T_WORD ? alias_lookup(token->literal) : NULL;
+        if (alias == NULL || alias_active(active, depth, alias)) {
+            if (next == ALIAS_NO_NEXT)
+                return;
+            pos = next;
+            next = ALIAS_NO_NEXT;
+            continue;
+        }
+
+        /* the first word of the value is checked again */
+        active[depth++] = alias->hash;
+        alias_splice(tokenlist, pos, alias);
+        if (alias->blank)
+            next = pos + alias->tokens_len;
+        else if (next != ALIAS_NO_NEXT)
+            next = next + alias->tokens_len - 1;
+    }
+}
+
+void alias_invalidate(const char *name)
+{
+    struct alias_entry_t *entry = table_get(&entries, env_hash(name, strlen(name)), name,
+                                            alias_eq);
+    if (entry != NULL) {
+        alias_entry_free(entry);
+        table_rm(&entries, entry);
+    }
+}
+
+void alias_save(const char *name, size_t len, uint64_t hash)
+{
+    if (scopes == 0)
+        return;
+
+    if (undo_len == undo_capacity) {
+        undo_capacity = undo_capacity == 0 ? ALIAS_CACHE_STARTING_CAPACITY : undo_capacity * 2;
+        undo = vrealloc(undo, undo_capacity * sizeof(struct alias_undo_t));
+    }
+    char *previous = env_table_get(alias_table, name, len, hash);
+    undo[undo_len++] = (struct alias_undo_t){ .name = strndup(name, len),
+                                              .previous = previous != NULL ? strdup(previous)
+                                                                           : NULL };
+}
+
+size_t alias_scope_begin(void)
+{
+    scopes++;
+    return undo_len;
+}
+
+void alias_scope_end(size_t mark)
+{
+    while (undo_len > mark) {
+        struct alias_undo_t *u = &undo[--undo_len];
+        size_t len = strlen(u->name);
+        uint64_t hash = env_hash(u->name, len);
+        if (u->previous != NULL)
+            env_table_set(alias_table, u->name, len, hash, u->previous);
+        else
+            env_table_rm(alias_table, u->name, len, hash);
+        alias_invalidate(u->name);
+        vfree(u->name);
+        vfree(u->previous);
+    }
+    scopes--;
+}
+
+void alias_init(struct env_table_t *aliases)
+{
+    alias_table = aliases;
+}
+
+void alias_free(void)
+{
+    struct alias_entry_t *entry;
+    for (size_t i = 0; (entry = table_next(&entries, &i)) != NULL;)
+        alias_entry_free(entry);
+    table_free(&entries);
+    for (size_t i = 0; i < undo_len; i++) {
+        vfree(undo[i].name);
+        vfree(undo[i].previous);
+    }
+    vfree(undo);
+    undo = NULL;
+    undo_len = undo_capacity = 0;
+    scopes = 0;
+    alias_table = NULL;
+}
@@ -0,0 +1,119 @@
+/*
+ *  Captures the output of command substitutions.
+ *
+ *  Copyright (C) 2023 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // fopencookie
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "valery/valery.h"
+#include "valery/interpreter/impl/capture.h"
+
+
+/* makes sure there is room for at least n more bytes */
+static void capture_reserve(struct capture_t *capture, size_t n)
+{
+    if (capture->capacity - capture->len >= n)
+        return;
+
+    size_t new_capacity = capture->capacity;
+    while (new_capacity - capture->len < n)
+        new_capacity *= 2;
+
+    capture->buf = vrealloc(capture->buf, new_capacity);
+    capture->capacity = new_capacity;
+}
+
+/* write callback of the cookie stream, lets builtins print directly into the buffer */
+static ssize_t capture_stream_write(void *cookie, const char *data, size_t n)
+{
+    capture_write((struct capture_t *)cookie, data, n);
+    return n;
+}
+
+struct capture_t *capture_malloc(void)
+{
+    struct capture_t *capture = vmalloc(sizeof(struct capture_t));
+    capture->capacity = CAPTURE_READ_SIZE;
+    capture->len = 0;
+    capture->buf = vmalloc(capture->capacity);
+
+    cookie_io_functions_t io = { .write = capture_stream_write };
+    capture->stream = fopencookie(capture, "w", io);
+    if (capture->stream == NULL)
+        valery_exit_internal_error("could not open capture stream");
+    setvbuf(capture->stream, NULL, _IONBF, 0);
+
+    return capture;
+}
+
+void capture_free(struct capture_t *capture)
+{
+    if (capture == NULL)
+        return;
+
+    fclose(capture->stream);
+    vfree(capture->buf);
+    vfree(capture);
+}
+
+void capture_write(struct capture_t *capture, const char *data, size_t n)
+{
+    capture_reserve(capture, n);
+    memcpy(capture->buf + capture->len, data, n);
+    capture->len += n;
+}
+
+int capture_read_fd(struct capture_t *capture, int fd)
+{
+    while (1) {
+        capture_reserve(capture, CAPTURE_READ_SIZE);
+        ssize_t n = read(fd, capture->buf + capture->len, capture->capacity - capture->len);
+        if (n == 0)
+            return 0;
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        capture->len += n;
+    }
+}
+
+size_t capture_begin(struct capture_t *capture)
+{
+    return capture->len;
+}
+
+char *capture_end(struct capture_t *capture, size_t mark, size_t *len)
+{
+    /* trim the trailing newlines */
+    size_t end = capture->len;
+    while (end > mark && capture->buf[end - 1] == '\n')
+        end--;
+
+    capture_reserve(capture, 1);
+    capture->buf[end] = 0;
+    capture->len = mark;
+
+    *len = end - mark;
+    return capture->buf + mark;
+}
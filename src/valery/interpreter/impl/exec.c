@@ -16,40 +16,179 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE             // PATH_MAX, vfork, dprintf
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <sys/resource.h>
 #include "sys/wait.h"
 
 #include "valery/valery.h"
+#include "valery/event.h"
 #include "valery/interpreter/impl/pipe.h"
+#include "valery/interpreter/impl/capture.h"
+#include "valery/interpreter/impl/exec.h"
+#include "valery/interpreter/impl/lookup.h"
+#include "valery/profile.h"
+#include "valery/script_profile.h"
+#include "valery/stats.h"
+#include "builtins/builtins.h"
 
-int valery_exec_program(int argc, char *argv[])
+
+enum exec_strategy_t exec_strategy = EXEC_FORK;
+
+const char *exec_strategy_names[EXEC_STRATEGY_COUNT] = {
+    [EXEC_FORK] = "fork",
+    [EXEC_VFORK] = "vfork",
+    [EXEC_POSIX_SPAWN] = "posix_spawn",
+};
+
+
+/*
+ * runs in the child after fork() or vfork(). after vfork() the child borrows the memory of the
+ * shell until execve(), so nothing here may touch the heap or stdio buffers.
+ */
+static void exec_child(char *program, char *argv[], char *envp[], int fd_in, int fd_out)
 {
-    int status;
-    int rc;
-    int return_code;
+    /* the signals the shell reads from the event loop would stay blocked in the program */
+    const sigset_t *mask = event_child_sigmask();
+    if (mask != NULL)
+        sigprocmask(SIG_SETMASK, mask, NULL);
+    if (fd_in != -1 && dup2(fd_in, STDIN_FILENO) == -1)
+        _exit(1);
+    if (fd_out != -1 && dup2(fd_out, STDOUT_FILENO) == -1)
+        _exit(1);
+    execve(program, argv, envp);
+    /* only reached if execve() failed, the child must never return into the shell */
+    dprintf(STDERR_FILENO, "valery: %s: %s\n", argv[0], strerror(errno));
+    _exit(127);
+}
 
-    char first_arg[MAX_COMMAND_LEN];
-    snprintf(first_arg, MAX_COMMAND_LEN, "/bin/%s", argv[0]);
+static pid_t exec_posix_spawn(char *program, char *argv[], char *envp[], int fd_in, int fd_out)
+{
+    pid_t pid;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (fd_in != -1)
+        posix_spawn_file_actions_adddup2(&actions, fd_in, STDIN_FILENO);
+    if (fd_out != -1)
+        posix_spawn_file_actions_adddup2(&actions, fd_out, STDOUT_FILENO);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    const sigset_t *mask = event_child_sigmask();
+    if (mask != NULL) {
+        posix_spawnattr_setsigmask(&attr, mask);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    }
+
+    int rc = posix_spawn(&pid, program, &actions, &attr, argv, envp);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc != 0) {
+        fprintf(stderr, "valery: %s: %s\n", argv[0], strerror(rc));
+        return -1;
+    }
+    return pid;
+}
+
+/* waits for the program and accounts the resources it used to its command name */
+static void exec_wait(pid_t pid, char *name, int *status)
+{
+    struct rusage usage;
+    uint64_t start = profile_begin();
+    pid_t rc = event_wait_child(pid, status, &usage);
+    profile_end(PROFILE_WAIT, start);
+    if (rc == pid)
+        stats_record(name, &usage);
+}
+
+/*
+ * starts the program given by argv[0] with the environment envp the way exec_strategy says.
+ * fd_in and fd_out replace stdin and stdout in the child unless they are -1.
+ * @returns the pid of the child, or -1 if the program could not be started
+ */
+static pid_t valery_spawn(int argc, char *argv[], char *envp[], int fd_in, int fd_out)
+{
+    char program[PATH_MAX];
+    if (command_lookup(argv[0], program, PATH_MAX) == COMMAND_NOT_FOUND) {
+        fprintf(stderr, "valery: %s: command not found\n", argv[0]);
+        return -1;
+    }
 
     /*
      * full must contain program name and an argument.
      * last argument must be NULL to signify end of pointer arr.
-     * ex: full = { "/bin/ls", "-la", NULL }
+     * ex: full = { "ls", "-la", NULL }
      */
     char *full[argc + 1];
-    full[0] = first_arg;
-    for (int i = 1; i < argc; i++)
+    for (int i = 0; i < argc; i++)
         full[i] = argv[i];
 
     full[argc] = NULL;
 
-    pid_t new_pid = fork();
+    /* output buffered by builtins has to be written before the child's output */
+    fflush(stdout);
+
+    pid_t new_pid;
+    uint64_t start = profile_begin();
+    switch (exec_strategy) {
+        case EXEC_VFORK:
+            new_pid = vfork();
+            break;
+        case EXEC_POSIX_SPAWN:
+            new_pid = exec_posix_spawn(program, full, envp, fd_in, fd_out);
+            break;
+        default:
+            new_pid = fork();
+            break;
+    }
+
     if (new_pid == 0)
-        return_code = execve(first_arg, full, NULL);
+        exec_child(program, full, envp, fd_in, fd_out);
+    profile_end(PROFILE_SPAWN, start);
+    if (new_pid > 0)
+        script_profile_spawned();
+    return new_pid;
+}
+
+int valery_exec_program(int argc, char *argv[], char *envp[], int fd_in)
+{
+    int status;
+    pid_t pid = valery_spawn(argc, argv, envp, fd_in, -1);
+    if (pid == -1)
+        return 1;
+
+    exec_wait(pid, argv[0], &status);
+    return status != 0;
+}
+
+int valery_exec_capture(int argc, char *argv[], char *envp[], int fd_in,
+                        struct capture_t *capture)
+{
+    int status;
+    int fds[2];
+    if (pipe(fds) == -1)
+        return 1;
+
+    pid_t pid = valery_spawn(argc, argv, envp, fd_in, fds[1]);
+    /* the parent must close its write end, or reading would never see end of file */
+    close(fds[1]);
+    if (pid == -1) {
+        close(fds[0]);
+        return 1;
+    }
 
-    waitpid(new_pid, &status, 0);
+    /* reading the output is part of waiting, it ends when the program closes its stdout */
+    uint64_t start = profile_begin();
+    capture_read_fd(capture, fds[0]);
+    close(fds[0]);
+    profile_end(PROFILE_WAIT, start);
+    exec_wait(pid, argv[0], &status);
     return status != 0;
 }
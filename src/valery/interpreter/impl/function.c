@@ -0,0 +1,105 @@
+/*
+ *  The table of defined shell functions.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "valery/valery.h"
+#include "valery/env.h"
+#include "valery/table.h"
+#include "valery/interpreter/impl/function.h"
+
+
+uint32_t function_version = 1;
+
+/* of function pointers. functions are only removed when the scope they were defined in ends */
+static struct table_t functions = TABLE_INIT(struct function_t *, FUNCTION_STARTING_CAPACITY);
+
+/* what every function_define() inside a scope replaced, so the scope can be undone */
+static struct function_undo_t *undo = NULL;
+static size_t undo_len = 0;
+static size_t undo_capacity = 0;
+static int scopes = 0;
+
+
+static bool function_eq(const void *item, const void *key)
+{
+    return strcmp((*(struct function_t * const *)item)->name, key) == 0;
+}
+
+void function_define(struct function_t *function)
+{
+    bool added;
+    struct function_t **slot = table_put(&functions, function->hash, function->name, function_eq,
+                                         &added);
+    if (scopes > 0) {
+        if (undo_len == undo_capacity) {
+            undo_capacity = undo_capacity == 0 ? FUNCTION_STARTING_CAPACITY : undo_capacity * 2;
+            undo = vrealloc(undo, undo_capacity * sizeof(struct function_undo_t));
+        }
+        undo[undo_len++] = (struct function_undo_t){ .defined = function,
+                                                     .previous = added ? NULL : *slot };
+    }
+    /* the old body stays on the persistent arena, a command may be running it right now */
+    *slot = function;
+    function_version++;
+}
+
+size_t function_scope_begin(void)
+{
+    scopes++;
+    return undo_len;
+}
+
+void function_scope_end(size_t mark)
+{
+    if (undo_len > mark)
+        function_version++;
+    while (undo_len > mark) {
+        struct function_undo_t *u = &undo[--undo_len];
+        struct function_t **slot = table_get(&functions, u->defined->hash, u->defined->name,
+                                             function_eq);
+        if (u->previous != NULL)
+            *slot = u->previous;
+        else
+            table_rm(&functions, slot);
+    }
+    scopes--;
+}
+
+struct function_t *function_get(const char *name)
+{
+    if (functions.len == 0)
+        return NULL;
+    struct function_t **slot = table_get(&functions, env_hash(name, strlen(name)), name,
+                                         function_eq);
+    return slot != NULL ? *slot : NULL;
+}
+
+void function_free(void)
+{
+    table_free(&functions);
+    vfree(undo);
+    undo = NULL;
+    undo_len = undo_capacity = 0;
+    scopes = 0;
+    function_version++;
+}
@@ -0,0 +1,346 @@
+/*
+ *  Pathname expansion. Directories are read with large getdents64 batches into snapshots that
+ *  are shared by all patterns of a command line.
+ *
+ *  Copyright (C) 2023 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // syscall
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "valery/valery.h"
+#include "valery/interpreter/parser_utils.h"
+#include "valery/interpreter/impl/glob.h"
+#include "lib/nicc/nicc.h"
+
+
+/* types */
+/* layout of the records getdents64 fills the buffer with */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+struct dirsnap_entry_t {
+    uint32_t offset;        /* into names */
+    uint32_t len;
+    unsigned char type;     /* d_type, DT_UNKNOWN on file systems that do not report it */
+};
+
+/* all names of one directory, in the order the file system returned them */
+struct dirsnap_t {
+    dev_t dev;              /* the directory itself, a relative path means another one after cd */
+    ino_t ino;
+    char *names;            /* NUL separated */
+    size_t names_len;
+    size_t names_capacity;
+    struct dirsnap_entry_t *entries;
+    size_t len;
+    size_t capacity;
+    struct dirsnap_t *next;
+};
+
+
+/* globals */
+static struct dirsnap_t *snapshots = NULL;     /* the directories read for the current command */
+/* what a directory that can not be read matches against */
+static struct dirsnap_t empty_snapshot = { 0 };
+/* read into by every getdents64 call, kept until glob_free() */
+static char *dirent_buf = NULL;
+
+
+/* functions */
+bool glob_has_wildcard(const char *word)
+{
+    return strpbrk(word, "*?") != NULL;
+}
+
+struct glob_pattern_t *glob_compile(char *word)
+{
+    struct glob_pattern_t *pattern = ast_arena_alloc(sizeof(struct glob_pattern_t));
+    pattern->word = word;
+    pattern->absolute = word[0] == '/';
+    pattern->dirs_only = word[strlen(word) - 1] == '/';
+
+    size_t max_segments = 1;
+    for (char *c = word; *c != 0; c++) {
+        if (*c == '/')
+            max_segments++;
+    }
+    pattern->segments = ast_arena_alloc(max_segments * sizeof(struct glob_segment_t));
+    pattern->segments_len = 0;
+
+    char *start = word;
+    while (*start != 0) {
+        char *end = strchr(start, '/');
+        size_t len = end == NULL ? strlen(start) : (size_t)(end - start);
+        /* empty segments come from leading, trailing or repeated slashes */
+        if (len > 0) {
+            struct glob_segment_t *seg = &pattern->segments[pattern->segments_len++];
+            seg->text = ast_arena_alloc(len + 1);
+            memcpy(seg->text, start, len);
+            seg->text[len] = 0;
+            seg->len = len;
+            seg->prefix_len = strcspn(seg->text, "*?");
+            seg->literal = seg->prefix_len == len;
+            seg->suffix_len = 0;
+            while (!seg->literal && seg->text[len - 1 - seg->suffix_len] != '*' &&
+                   seg->text[len - 1 - seg->suffix_len] != '?')
+                seg->suffix_len++;
+        }
+        if (end == NULL)
+            break;
+        start = end + 1;
+    }
+
+    return pattern;
+}
+
+/* matches '*' and '?' against the whole name, backtracking to the last '*' on a mismatch */
+static bool wildcard_match(const char *p, size_t p_len, const char *s, size_t s_len)
+{
+    size_t pi = 0;
+    size_t si = 0;
+    size_t star = SIZE_MAX;
+    size_t mark = 0;
+
+    while (si < s_len) {
+        if (pi < p_len && (p[pi] == '?' || p[pi] == s[si])) {
+            pi++;
+            si++;
+        } else if (pi < p_len && p[pi] == '*') {
+            star = pi++;
+            mark = si;
+        } else if (star != SIZE_MAX) {
+            pi = star + 1;
+            si = ++mark;
+        } else {
+            return false;
+        }
+    }
+
+    while (pi < p_len && p[pi] == '*')
+        pi++;
+    return pi == p_len;
+}
+
+static bool segment_match(struct glob_segment_t *seg, const char *name, size_t len)
+{
+    /* 2.13.3: a leading period must be matched explicitly */
+    if (name[0] == '.' && seg->text[0] != '.')
+        return false;
+
+    if (len < seg->prefix_len + seg->suffix_len)
+        return false;
+    if (memcmp(name, seg->text, seg->prefix_len) != 0)
+        return false;
+    if (memcmp(name + len - seg->suffix_len, seg->text + seg->len - seg->suffix_len,
+               seg->suffix_len) != 0)
+        return false;
+
+    return wildcard_match(seg->text + seg->prefix_len, seg->len - seg->prefix_len - seg->suffix_len,
+                          name + seg->prefix_len, len - seg->prefix_len - seg->suffix_len);
+}
+
+static void dirsnap_add(struct dirsnap_t *snap, const char *name, unsigned char type)
+{
+    size_t len = strlen(name);
+    if (snap->names_len + len + 1 > snap->names_capacity) {
+        while (snap->names_len + len + 1 > snap->names_capacity)
+            snap->names_capacity *= 2;
+        snap->names = vrealloc(snap->names, snap->names_capacity);
+    }
+    if (snap->len == snap->capacity) {
+        snap->capacity *= 2;
+        snap->entries = vrealloc(snap->entries, snap->capacity * sizeof(struct dirsnap_entry_t));
+    }
+
+    memcpy(snap->names + snap->names_len, name, len + 1);
+    snap->entries[snap->len].offset = snap->names_len;
+    snap->entries[snap->len].len = len;
+    snap->entries[snap->len].type = type;
+    snap->names_len += len + 1;
+    snap->len++;
+}
+
+/* reads the directory open at fd with as few getdents64 calls as possible, and closes fd */
+static struct dirsnap_t *dirsnap_read(int fd, struct stat *st)
+{
+    struct dirsnap_t *snap = vmalloc(sizeof(struct dirsnap_t));
+    snap->dev = st->st_dev;
+    snap->ino = st->st_ino;
+    snap->names_capacity = 4096;
+    snap->names_len = 0;
+    snap->names = vmalloc(snap->names_capacity);
+    snap->capacity = 128;
+    snap->len = 0;
+    snap->entries = vmalloc(snap->capacity * sizeof(struct dirsnap_entry_t));
+
+    if (dirent_buf == NULL)
+        dirent_buf = vmalloc(GLOB_DIRENT_BUF_SIZE);
+
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, dirent_buf, GLOB_DIRENT_BUF_SIZE)) > 0) {
+        for (long offset = 0; offset < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(dirent_buf + offset);
+            offset += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+                continue;
+            dirsnap_add(snap, d->d_name, d->d_type);
+        }
+    }
+    close(fd);
+
+    snap->next = snapshots;
+    snapshots = snap;
+    return snap;
+}
+
+static struct dirsnap_t *dirsnap_get(const char *path)
+{
+    struct stat st;
+    int fd = open(*path == 0 ? "." : path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        return &empty_snapshot;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return &empty_snapshot;
+    }
+
+    for (struct dirsnap_t *snap = snapshots; snap != NULL; snap = snap->next) {
+        if (snap->dev == st.st_dev && snap->ino == st.st_ino) {
+            close(fd);
+            return snap;
+        }
+    }
+    return dirsnap_read(fd, &st);
+}
+
+/* returns base and name joined by a '/', allocated on the ast arena */
+static char *path_join(const char *base, const char *name, size_t name_len)
+{
+    size_t base_len = strlen(base);
+    bool slash = base_len > 0 && base[base_len - 1] != '/';
+    char *path = ast_arena_alloc(base_len + slash + name_len + 1);
+    memcpy(path, base, base_len);
+    if (slash)
+        path[base_len] = '/';
+    memcpy(path + base_len + slash, name, name_len);
+    path[base_len + slash + name_len] = 0;
+    return path;
+}
+
+static bool is_dir(const char *path, unsigned char type)
+{
+    struct stat sb;
+    if (type == DT_DIR)
+        return true;
+    /* symlinks have to be followed, and some file systems do not fill in d_type */
+    if (type == DT_LNK || type == DT_UNKNOWN)
+        return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+    return false;
+}
+
+static int path_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+size_t glob_expand(struct glob_pattern_t *pattern, struct darr_t *results)
+{
+    struct darr_t *current = darr_malloc();
+    darr_append(current, pattern->absolute ? "/" : "");
+
+    for (size_t i = 0; i < pattern->segments_len; i++) {
+        struct glob_segment_t *seg = &pattern->segments[i];
+        bool last = i == pattern->segments_len - 1;
+        struct darr_t *next = darr_malloc();
+
+        for (int j = 0; j < darr_get_size(current); j++) {
+            char *base = darr_get(current, j);
+            if (seg->literal) {
+                struct stat sb;
+                char *path = path_join(base, seg->text, seg->len);
+                /* directories further down are checked when they are read */
+                if (!last || (pattern->dirs_only ? stat(path, &sb) == 0 && S_ISDIR(sb.st_mode)
+                                                 : lstat(path, &sb) == 0))
+                    darr_append(next, last && pattern->dirs_only ? path_join(path, "", 0) : path);
+                continue;
+            }
+
+            struct dirsnap_t *snap = dirsnap_get(base);
+            for (size_t k = 0; k < snap->len; k++) {
+                struct dirsnap_entry_t *entry = &snap->entries[k];
+                char *name = snap->names + entry->offset;
+                if (!segment_match(seg, name, entry->len))
+                    continue;
+
+                char *path = path_join(base, name, entry->len);
+                if (last && !pattern->dirs_only)
+                    darr_append(next, path);
+                else if (is_dir(path, entry->type))
+                    darr_append(next, last ? path_join(path, "", 0) : path);
+            }
+        }
+
+        vfree(darr_raw_ret(current));
+        current = next;
+    }
+
+    size_t matches = darr_get_size(current);
+    char **paths = (char **)darr_raw_ret(current);
+    /* only the matches are sorted, so a pattern that matches few names in a big directory is cheap */
+    qsort(paths, matches, sizeof(char *), path_cmp);
+
+    for (size_t i = 0; i < matches; i++)
+        darr_append(results, paths[i]);
+    vfree(paths);
+
+    if (matches == 0)
+        darr_append(results, pattern->word);
+    return matches;
+}
+
+void glob_cache_clear(void)
+{
+    struct dirsnap_t *snap = snapshots;
+    while (snap != NULL) {
+        struct dirsnap_t *next = snap->next;
+        vfree(snap->names);
+        vfree(snap->entries);
+        vfree(snap);
+        snap = next;
+    }
+    snapshots = NULL;
+}
+
+void glob_free(void)
+{
+    glob_cache_clear();
+    vfree(dirent_buf);
+    dirent_buf = NULL;
+}
@@ -0,0 +1,94 @@
+/*
+ *  Here-documents and here-strings backed by memfd instead of temporary files.
+ *
+ *  Copyright (C) 2023 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with this program.
+ *  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // memfd_create, F_ADD_SEALS
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "valery/valery.h"
+#include "valery/interpreter/impl/heredoc.h"
+
+#define HEREDOC_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+
+/* writes both iovecs completely, retrying on short writes */
+static int write_all(int fd, struct iovec iov[2])
+{
+    int iovcnt = 2;
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+
+        /* skip past what has been written */
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return 0;
+}
+
+int heredoc_open(const char *body, size_t len, bool append_newline)
+{
+    int fd = memfd_create("valery-heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        valery_runtime_error("could not create here-document");
+        return -1;
+    }
+
+    /* sizing the file up front means the kernel does not grow it page by page */
+    size_t total = len + (append_newline ? 1 : 0);
+    if (ftruncate(fd, total) == -1)
+        goto error;
+
+    struct iovec iov[2] = {
+        { .iov_base = (void *)body, .iov_len = len },
+        { .iov_base = "\n", .iov_len = append_newline ? 1 : 0 }
+    };
+    if (write_all(fd, iov) != 0)
+        goto error;
+
+    /* the child only ever reads, so nothing may change the contents from here on */
+    if (fcntl(fd, F_ADD_SEALS, HEREDOC_SEALS) == -1)
+        goto error;
+
+    if (lseek(fd, 0, SEEK_SET) == -1)
+        goto error;
+
+    return fd;
+
+error:
+    valery_runtime_error("could not write here-document");
+    close(fd);
+    return -1;
+}
@@ -0,0 +1,273 @@
+/*
+ *  Finds the executable a command name refers to. Lookups are cached, and inotify watches
+ *  on the PATH directories tell the cache when it has to forget them.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // strdup, strndup, PATH_MAX
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "valery/valery.h"
+#include "valery/env.h"
+#include "valery/table.h"
+#include "valery/watch.h"
+#include "valery/interpreter/impl/lookup.h"
+#include "builtins/builtins.h"
+
+
+/* types */
+struct lookup_entry_t {
+    char *name;
+    int dir;                /* index of the directory the executable is in, or LOOKUP_NOT_FOUND */
+};
+
+struct lookup_dir_t {
+    char *path;
+    int wd;                 /* -1 if neither the directory nor its parent could be watched */
+    bool watching_parent;   /* the directory did not exist, so its parent is watched instead */
+};
+
+
+static struct env_t *lookup_env = NULL;
+/* the PATH the directories were split from, NULL if it was unset */
+static char *lookup_path = NULL;
+static struct lookup_dir_t *lookup_dirs = NULL;
+static int lookup_dirs_len = 0;
+/* a directory from this index on is not watched, so lookups that reach it are not cached */
+static int uncached_from = 0;
+
+static struct table_t entries = TABLE_INIT(struct lookup_entry_t, LOOKUP_STARTING_CAPACITY);
+
+/* set by the watch thread */
+static pthread_mutex_t lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool *lookup_stale = NULL;
+static bool *lookup_lost = NULL;    /* the kernel dropped the watch */
+
+
+static void lookup_dir_changed(void *arg, uint32_t mask)
+{
+    uintptr_t i = (uintptr_t)arg;
+    pthread_mutex_lock(&lookup_lock);
+    lookup_stale[i] = true;
+    if (mask & IN_IGNORED)
+        lookup_lost[i] = true;
+    pthread_mutex_unlock(&lookup_lock);
+}
+
+/* watches directory i, or its parent so we learn when the directory is created */
+static void lookup_watch(int i)
+{
+    struct lookup_dir_t *dir = &lookup_dirs[i];
+    void *arg = (void *)(uintptr_t)i;
+
+    watch_rm(dir->wd, lookup_dir_changed, arg);
+    dir->watching_parent = false;
+    dir->wd = watch_add(dir->path, WATCH_DIR_CHANGES, lookup_dir_changed, arg);
+    if (dir->wd != -1)
+        return;
+
+    char parent[PATH_MAX];
+    snprintf(parent, PATH_MAX, "%s", dir->path);
+    char *slash = strrchr(parent, '/');
+    if (slash == NULL)
+        return;
+    slash[slash == parent] = 0;
+    dir->wd = watch_add(parent, WATCH_DIR_CHANGES, lookup_dir_changed, arg);
+    dir->watching_parent = dir->wd != -1;
+}
+
+static void lookup_update_uncached(void)
+{
+    for (uncached_from = 0; uncached_from < lookup_dirs_len; uncached_from++) {
+        if (lookup_dirs[uncached_from].wd == -1)
+            break;
+    }
+}
+
+static bool lookup_eq(const void *item, const void *key)
+{
+    return strcmp(((const struct lookup_entry_t *)item)->name, key) == 0;
+}
+
+/* keeps the lookups that found the executable before directory *from */
+static bool lookup_keep(void *item, void *from)
+{
+    struct lookup_entry_t *entry = item;
+    if (entry->dir != LOOKUP_NOT_FOUND && entry->dir < *(int *)from)
+        return true;
+    vfree(entry->name);
+    return false;
+}
+
+/*
+ * forgets the lookups the changes to the directories reported by the watch thread may have
+ * made wrong. an executable added to directory i can shadow anything found after it or turn a
+ * miss into a hit, and one removed from it only matters to lookups that found it there.
+ */
+static void lookup_sync(void)
+{
+    int first_changed = lookup_dirs_len;
+    bool rewatch[lookup_dirs_len + 1];
+
+    pthread_mutex_lock(&lookup_lock);
+    for (int i = 0; i < lookup_dirs_len; i++) {
+        rewatch[i] = false;
+        if (!lookup_stale[i])
+            continue;
+        rewatch[i] = lookup_lost[i] || lookup_dirs[i].watching_parent;
+        lookup_stale[i] = lookup_lost[i] = false;
+        if (first_changed == lookup_dirs_len)
+            first_changed = i;
+    }
+    pthread_mutex_unlock(&lookup_lock);
+
+    if (first_changed == lookup_dirs_len)
+        return;
+
+    /* must not hold lookup_lock here, the watch thread holds its own lock when calling us */
+    for (int i = first_changed; i < lookup_dirs_len; i++) {
+        if (rewatch[i])
+            lookup_watch(i);
+    }
+    lookup_update_uncached();
+    table_filter(&entries, lookup_keep, &first_changed);
+}
+
+/* searches PATH for the executable, the full path is written to result */
+static int lookup_resolve(const char *name, char *result, size_t result_size)
+{
+    struct stat st;
+    for (int i = 0; i < lookup_dirs_len; i++) {
+        snprintf(result, result_size, "%s/%s", lookup_dirs[i].path, name);
+        if (stat(result, &st) == 0 && S_ISREG(st.st_mode) &&
+            (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
+            return i;
+    }
+    return LOOKUP_NOT_FOUND;
+}
+
+/* watches the directories of path, empty ones are skipped like unwrap_paths() does */
+static void lookup_dirs_build(const char *path)
+{
+    lookup_path = path != NULL ? strdup(path) : NULL;
+    lookup_dirs_len = 0;
+    for (const char *c = path; c != NULL && *c != 0; c++)
+        lookup_dirs_len += *c == ':';
+    lookup_dirs_len += path != NULL;
+
+    lookup_dirs = vcalloc(lookup_dirs_len + 1, sizeof(struct lookup_dir_t));
+    lookup_stale = vcalloc(lookup_dirs_len + 1, sizeof(bool));
+    lookup_lost = vcalloc(lookup_dirs_len + 1, sizeof(bool));
+    int i = 0;
+    for (const char *start = path; start != NULL; ) {
+        const char *end = strchr(start, ':');
+        size_t len = end != NULL ? (size_t)(end - start) : strlen(start);
+        if (len > 0) {
+            lookup_dirs[i] = (struct lookup_dir_t){ .path = strndup(start, len), .wd = -1 };
+            lookup_watch(i++);
+        }
+        start = end != NULL ? end + 1 : NULL;
+    }
+    lookup_dirs_len = i;
+    lookup_update_uncached();
+}
+
+/* forgets the directories and every lookup made in them */
+static void lookup_dirs_free(void)
+{
+    for (int i = 0; i < lookup_dirs_len; i++) {
+        watch_rm(lookup_dirs[i].wd, lookup_dir_changed, (void *)(uintptr_t)i);
+        vfree(lookup_dirs[i].path);
+    }
+    struct lookup_entry_t *entry;
+    for (size_t i = 0; (entry = table_next(&entries, &i)) != NULL;)
+        vfree(entry->name);
+
+    vfree(lookup_path);
+    vfree(lookup_dirs);
+    vfree(lookup_stale);
+    vfree(lookup_lost);
+    table_free(&entries);
+    lookup_path = NULL;
+    lookup_dirs = NULL;
+    lookup_stale = lookup_lost = NULL;
+    lookup_dirs_len = uncached_from = 0;
+}
+
+static bool lookup_path_changed(const char *path)
+{
+    if (path == NULL || lookup_path == NULL)
+        return path != lookup_path;
+    return strcmp(path, lookup_path) != 0;
+}
+
+void lookup_init(struct env_t *env)
+{
+    lookup_env = env;
+    lookup_dirs_build(env_get(env->env_vars, "PATH"));
+}
+
+void lookup_free(void)
+{
+    lookup_dirs_free();
+    lookup_env = NULL;
+}
+
+int command_lookup(const char *name, char *result, size_t result_size)
+{
+    if (strchr(name, '/') != NULL) {
+        snprintf(result, result_size, "%s", name);
+        return COMMAND_IS_PATH;
+    }
+
+    /* PATH may have been set since, or be set for this command only */
+    char *path = env_get(lookup_env->env_vars, "PATH");
+    if (lookup_path_changed(path)) {
+        lookup_dirs_free();
+        lookup_dirs_build(path);
+    }
+
+    lookup_sync();
+    uint64_t hash = env_hash(name, strlen(name));
+    struct lookup_entry_t *entry = table_get(&entries, hash, name, lookup_eq);
+    int dir;
+    if (entry != NULL) {
+        dir = entry->dir;
+    } else {
+        dir = lookup_resolve(name, result, result_size);
+        /* a miss can only be trusted if every directory is watched */
+        bool cacheable = dir == LOOKUP_NOT_FOUND ? uncached_from == lookup_dirs_len
+                                                 : dir < uncached_from;
+        if (cacheable) {
+            bool added;
+            entry = table_put(&entries, hash, name, lookup_eq, &added);
+            *entry = (struct lookup_entry_t){ .name = strdup(name), .dir = dir };
+        }
+    }
+
+    if (dir == LOOKUP_NOT_FOUND)
+        return COMMAND_NOT_FOUND;
+    snprintf(result, result_size, "%s/%s", lookup_dirs[dir].path, name);
+    return COMMAND_IN_PATH;
+}
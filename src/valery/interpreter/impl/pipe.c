@@ -14,5 +14,6 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#define VALERY_MEM_TAG MEM_INTERPRETER
 #include "valery/interpreter/impl/pipe.h"
 
@@ -14,38 +14,333 @@
  *  You should have received a copy of the GNU General Public License along with this program.
  *  If not, see <https://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE             // O_DIRECTORY
+#define VALERY_MEM_TAG MEM_INTERPRETER
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "valery/interpreter/ast.h"
 #include "valery/interpreter/lexer.h"
 #include "valery/interpreter/parser.h"
+#include "valery/interpreter/parser_utils.h"
 #include "valery/interpreter/impl/exec.h"
+#include "valery/interpreter/impl/heredoc.h"
+#include "valery/interpreter/impl/capture.h"
+#include "valery/interpreter/impl/glob.h"
+#include "valery/interpreter/impl/lookup.h"
+#include "valery/interpreter/impl/alias.h"
+#include "valery/interpreter/impl/function.h"
+#include "builtins/builtins.h"
 #include "lib/nicc/nicc.h"
 #include "valery/valery.h"
+#include "valery/env.h"
+#include "valery/trace.h"
+#include "valery/script_profile.h"
 
 int glob_exit_code = 0;
+static struct env_t *env = NULL;
+static struct capture_t *capture = NULL;
+static bool capturing = false;  /* output goes into the capture buffer instead of stdout */
+
+/* the positional parameters of the function being run, args[0] is $1 */
+static char **args = NULL;
+static int args_count = 0;
+static int call_depth = 0;
+static bool returning = false;  /* 'return' was run, the rest of the function is skipped */
 
 static void execute(struct Stmt *stmt);
+static void execute_list(struct darr_t *statements);
 static void *evaluate(struct Expr *expr);
 
+/*
+ * makes an overlay on top of the current environment the one words are expanded against,
+ * programs are given and builtins see, until scope_end() is called with what this returned.
+ */
+static struct env_vars_t *scope_begin(void)
+{
+    struct env_vars_t *outer = env->env_vars;
+    env->env_vars = env_overlay(outer);
+    return outer;
+}
+
+static void scope_end(struct env_vars_t *outer)
+{
+    env_overlay_free(env->env_vars);
+    env->env_vars = outer;
+}
+
+/* 2.9.1 assignments are expanded in order, so a later value may use an earlier one */
+static void assign(struct Assignment *assignment)
+{
+    for (; assignment != NULL; assignment = assignment->next)
+        env_set(env->env_vars, assignment->name, evaluate(assignment->value));
+}
+
+/*
+ * returns the function the command calls, or NULL. a command name without expansions always
+ * resolves to the same function until a function is defined, so the result is kept in the node.
+ */
+static struct function_t *command_function(struct CommandExpr *expr, char *name)
+{
+    if (((struct Expr *)darr_get(expr->exprs, 0))->type != EXPR_LITERAL)
+        return function_get(name);
+
+    if (expr->function_version != function_version) {
+        expr->function = function_get(name);
+        expr->function_version = function_version;
+    }
+    return expr->function;
+}
+
+/* runs the body of the function with argv[1] and onwards as the positional parameters */
+static void function_call(struct function_t *function, int argc, char **argv)
+{
+    if (call_depth == FUNCTION_MAX_DEPTH) {
+        valery_runtime_error("maximum function nesting level exceeded");
+        glob_exit_code = 1;
+        return;
+    }
+
+    char **outer_args = args;
+    int outer_args_count = args_count;
+    args = argv + 1;
+    args_count = argc - 1;
+    call_depth++;
+
+    glob_exit_code = 0;
+    execute_list(function->statements);
+    returning = false;
+
+    call_depth--;
+    args = outer_args;
+    args_count = outer_args_count;
+}
 
 static void simple_command(struct CommandExpr *expr)
 {
     int argc = (int)darr_get_size(expr->exprs);
+    if (argc == 0) {
+        /* without a command name the assignments change the current environment */
+        if (expr->assignments != NULL) {
+            assign(expr->assignments);
+            glob_exit_code = 0;
+        }
+        return;
+    }
+
     struct darr_t *argv = darr_malloc();
     for (int i = 0; i < argc; i++) {
         struct Expr *e = darr_get(expr->exprs, i);
+        /* a pattern may expand into any amount of arguments */
+        if (e->type == EXPR_GLOB) {
+            glob_expand(((struct GlobExpr *)e)->pattern, argv);
+            continue;
+        }
         void *res = evaluate(e);
         darr_append(argv, res);
     }
+    argc = darr_get_size(argv);
+    /* the command may create files or change directory, later commands have to read again */
+    glob_cache_clear();
+
+    int fd_in = -1;
+    if (expr->here != NULL || expr->here_string != NULL) {
+        if (expr->here != NULL) {
+            fd_in = heredoc_open(expr->here, expr->here_len, false);
+        } else {
+            char *here_string = evaluate(expr->here_string);
+            fd_in = heredoc_open(here_string, strlen(here_string), true);
+        }
+        if (fd_in == -1) {
+            glob_exit_code = 1;
+            vfree(darr_raw_ret(argv));
+            return;
+        }
+    }
+
+    /* the assignments only apply to this command, so they go into an overlay thrown away after */
+    struct env_vars_t *outer = NULL;
+    if (expr->assignments != NULL) {
+        outer = scope_begin();
+        assign(expr->assignments);
+    }
+
+    char **raw_argv = (char **)darr_raw_ret(argv);
+    uint64_t start = trace_begin();
+    struct function_t *function = command_function(expr, raw_argv[0]);
+    if (function != NULL)
+        function_call(function, argc, raw_argv);
+    else if (is_builtin(raw_argv[0]))
+        /* builtins run in-process and, when captured, write straight into the capture buffer */
+        glob_exit_code = builtin_exec(argc, raw_argv, capturing ? capture->stream : stdout);
+    else if (capturing)
+        glob_exit_code = valery_exec_capture(argc, raw_argv, env_gen(env->env_vars), fd_in,
+                                             capture);
+    else
+        glob_exit_code = valery_exec_program(argc, raw_argv, env_gen(env->env_vars), fd_in);
+    trace_end(argc, raw_argv, glob_exit_code, start);
+    vfree(raw_argv);
+    if (fd_in != -1)
+        close(fd_in);
+    if (outer != NULL)
+        scope_end(outer);
+}
+
+/*
+ * 2.12
+ * runs the statements in a subshell environment. they run in the shell process, but with an
+ * environment overlay, and the functions, aliases and working directory are restored afterwards,
+ * so no change they make is seen outside.
+ */
+static void execute_isolated(struct darr_t *statements)
+{
+    int cwd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct env_vars_t *outer = scope_begin();
+    size_t functions_mark = function_scope_begin();
+    size_t aliases_mark = alias_scope_begin();
+    execute_list(statements);
+    /* 'return' only leaves the subshell */
+    returning = false;
+    alias_scope_end(aliases_mark);
+    function_scope_end(functions_mark);
+    scope_end(outer);
+    if (cwd != -1) {
+        if (fchdir(cwd) == -1)
+            valery_error("could not return to the working directory after subshell");
+        close(cwd);
+    }
+}
+
+static void subshell(struct SubshellExpr *expr)
+{
+    execute_isolated(expr->statements);
+}
+
+/*
+ * 2.6.3
+ * executes the statements of the substitution in a subshell environment with their output going
+ * into the capture buffer.
+ * @returns the output with trailing newlines removed, allocated on the ast arena
+ */
+static char *command_substitution(struct darr_t *statements, size_t *len)
+{
+    if (capture == NULL)
+        capture = capture_malloc();
+
+    bool outer_capturing = capturing;
+    size_t mark = capture_begin(capture);
+    capturing = true;
+    execute_isolated(statements);
+    capturing = outer_capturing;
 
-    glob_exit_code = valery_exec_program(argc, (char **)darr_raw_ret(argv));
+    char *output = capture_end(capture, mark, len);
+    char *result = ast_arena_alloc(*len + 1);
+    memcpy(result, output, *len + 1);
+    return result;
+}
+
+/* 2.5.2 $@ and $*, the positional parameters separated by spaces */
+static char *all_args(void)
+{
+    size_t total = 0;
+    for (int i = 0; i < args_count; i++)
+        total += strlen(args[i]) + 1;
+
+    char *result = ast_arena_alloc(total + 1);
+    char *pos = result;
+    for (int i = 0; i < args_count; i++) {
+        size_t len = strlen(args[i]);
+        memcpy(pos, args[i], len);
+        pos += len;
+        *pos++ = ' ';
+    }
+    *(pos == result ? pos : pos - 1) = 0;
+    return result;
+}
+
+/* returns the value of the parameter, or NULL if it is unset */
+static char *param_value(struct WordPart *part)
+{
+    switch (part->type) {
+        case WORD_POSITIONAL:
+            if (part->len == 0)
+                return "valery";
+            return part->len <= (size_t)args_count ? args[part->len - 1] : NULL;
+
+        case WORD_ARG_COUNT: {
+            char *count = ast_arena_alloc(12);
+            snprintf(count, 12, "%d", args_count);
+            return count;
+        }
+
+        case WORD_ALL_ARGS:
+            return all_args();
+
+        default:
+            return env_get_hashed(env->env_vars, part->str, part->len, part->hash);
+    }
+}
+
+/*
+ * runs the plan of a compiled word. every part is resolved first, so the result can be
+ * allocated once with the exact size.
+ * @returns the expanded word, allocated on the ast arena
+ */
+static char *expand_word(struct WordExpr *word, size_t *len)
+{
+    char *values[word->parts_len];
+    size_t lens[word->parts_len];
+    size_t total = 0;
+
+    for (size_t i = 0; i < word->parts_len; i++) {
+        struct WordPart *part = &word->parts[i];
+        switch (part->type) {
+            case WORD_LITERAL:
+                values[i] = part->str;
+                lens[i] = part->len;
+                break;
+
+            case WORD_PARAM:
+            case WORD_POSITIONAL:
+            case WORD_ARG_COUNT:
+            case WORD_ALL_ARGS:
+                values[i] = param_value(part);
+                if (part->fallback != NULL &&
+                    (values[i] == NULL || (part->fallback_if_empty && *values[i] == 0))) {
+                    values[i] = expand_word(part->fallback, &lens[i]);
+                    break;
+                }
+                if (values[i] == NULL)
+                    values[i] = "";
+                lens[i] = strlen(values[i]);
+                break;
+
+            case WORD_COMMAND_SUBST:
+                values[i] = command_substitution(part->statements, &lens[i]);
+                break;
+        }
+        total += lens[i];
+    }
+
+    char *result = ast_arena_alloc(total + 1);
+    char *pos = result;
+    for (size_t i = 0; i < word->parts_len; i++) {
+        memcpy(pos, values[i], lens[i]);
+        pos += lens[i];
+    }
+    *pos = 0;
+    *len = total;
+    return result;
 }
 
 static void and_if(struct BinaryExpr *expr)
 {
     evaluate(expr->left);
-    if (glob_exit_code == 0)
+    if (glob_exit_code == 0 && !returning)
         evaluate(expr->right);
 }
 
@@ -75,6 +370,30 @@ static void interpret_list(struct CommandExpr *expr)
 
 }
 
+static void return_command(struct ReturnExpr *expr)
+{
+    if (call_depth == 0) {
+        valery_runtime_error("return: can only return from a function");
+        glob_exit_code = 1;
+        return;
+    }
+    if (expr->code != NULL)
+        glob_exit_code = atoi(evaluate(expr->code)) & 0xff;
+    returning = true;
+}
+
+/* executes the statements in order, stopping early if one of them returns from a function */
+static void execute_list(struct darr_t *statements)
+{
+    int bound = darr_get_size(statements);
+    for (int i = 0; i < bound && !returning; i++) {
+        struct Stmt *stmt = darr_get(statements, i);
+        script_profile_begin(stmt->line);
+        execute(stmt);
+        script_profile_end();
+    }
+}
+
 static void execute(struct Stmt *stmt)
 {
     switch (stmt->type) {
@@ -102,6 +421,28 @@ static void *evaluate(struct Expr *expr)
             interpret_list((struct CommandExpr *)expr);
             break;
 
+        case EXPR_SUBSHELL:
+            subshell((struct SubshellExpr *)expr);
+            break;
+
+        case EXPR_FUNCTION:
+            function_define(((struct FunctionExpr *)expr)->function);
+            glob_exit_code = 0;
+            break;
+
+        case EXPR_RETURN:
+            return_command((struct ReturnExpr *)expr);
+            break;
+
+        case EXPR_GLOB:
+            /* only arguments of commands are expanded into paths */
+            return ((struct GlobExpr *)expr)->pattern->word;
+
+        case EXPR_WORD: {
+            size_t len;
+            return expand_word((struct WordExpr *)expr, &len);
+        }
+
         case EXPR_ENUM_COUNT:
             // ignore
             break;
@@ -115,9 +456,24 @@ int interpret(struct darr_t *statements)
 #ifdef DEBUG
     printf("\n--- interpreter start ---\n");
 #endif
-    int bound = darr_get_size(statements);
-    for (int i = 0; i < bound; i++)
-        execute((struct Stmt *)darr_get(statements, i));
+    execute_list(statements);
+    return glob_exit_code;
+}
 
-    return 0;
+void interpret_init(struct env_t *shell_env)
+{
+    env = shell_env;
+    lookup_init(env);
+    alias_init(env->aliases);
+}
+
+void interpret_free(void)
+{
+    capture_free(capture);
+    capture = NULL;
+    lookup_free();
+    alias_free();
+    function_free();
+    glob_free();
+    ast_arena_persist_release();
 }
@@ -15,6 +15,7 @@
  *  If not, see <https://www.gnu.org/licenses/>.
  */
 //SPEC: https://pubs.opengroup.org/onlinepubs/9699919799/utilities/V3_chap02.html#tag_18_10
+#define VALERY_MEM_TAG MEM_LEXER
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
@@ -68,6 +69,8 @@ const char *tokentype_str[T_ENUM_COUNT] = {
     "T_GREATER_EQUAL",
     "T_LESS",
     "T_LESS_EQUAL",
+    "T_DLESS",
+    "T_TLESS",
     "T_LBRACKET",
     "T_LBRACKET_LBRACKET",
     "T_RBRACKET",
@@ -98,6 +101,15 @@ static struct ht_t *identifiers = NULL;
 char *source_cpy;
 struct tokenlist_t *tl;
 
+/* indices of '<<' tokens whose body starts after the next newline */
+#define MAX_PENDING_HEREDOCS 16
+static size_t pending_heredocs[MAX_PENDING_HEREDOCS];
+static size_t pending_heredocs_len = 0;
+
+/* the line the token being scanned starts on, newlines before line_counted are counted */
+static size_t token_line;
+static char *line_counted;
+
 /* functions */
 
 /*
@@ -179,6 +191,10 @@ static struct token_t *token_malloc(enum tokentype_t type, char *lexeme, size_t
 {
     struct token_t *token = vmalloc(sizeof(struct token_t));
     token->type = type;
+    token->line = token_line;
+    token->lexeme = NULL;
+    token->literal = NULL;
+    token->literal_size = literal_size;
 
     if (lexeme != NULL) {
         token->lexeme = vmalloc(lexeme_size);
@@ -283,6 +299,47 @@ static void number_literal(void)
     add_token(T_NUMBER, NULL, 0, &literal, sizeof(literal));
 }
 
+/*
+ * 2.6.2 and 2.6.3
+ * if source_cpy points at '${' or '$(', moves it past the matching '}' or ')'.
+ * the expansion is left inside the word, the parser compiles it.
+ * @returns true if an expansion was skipped
+ */
+static bool skip_expansion(void)
+{
+    if (source_cpy[0] != '$' || (source_cpy[1] != '(' && source_cpy[1] != '{'))
+        return false;
+
+    char open = source_cpy[1];
+    char close = open == '(' ? ')' : '}';
+    int depth = 1;
+    char c;
+    source_cpy += 2;
+    while ((c = *source_cpy) != 0) {
+        if (c == '"') {
+            /* parentheses and braces inside a string do not count */
+            source_cpy++;
+            while (*source_cpy != 0 && *source_cpy != '"')
+                source_cpy++;
+            if (*source_cpy == 0)
+                break;
+        } else if (c == open) {
+            depth++;
+        } else if (c == close && --depth == 0) {
+            break;
+        }
+        source_cpy++;
+    }
+
+    if (*source_cpy == 0)
+        valery_exit_parse_error(open == '(' ? "command substitution not terminated"
+                                            : "parameter expansion not terminated");
+
+    /* move past the closing parenthesis or brace */
+    source_cpy++;
+    return true;
+}
+
 static void string_literal(void)
 {
     //TODO: this is rather ugly
@@ -291,28 +348,98 @@ static void string_literal(void)
     while ((c = *source_cpy) != 0) {
         if (c == '"')
             break;
-        source_cpy++;
+        if (!skip_expansion())
+            source_cpy++;
     }
 
     if (*source_cpy == 0)
         valery_exit_parse_error("string not terminated");
 
     size_t literal_size = source_cpy - literal_start;
+    char literal[literal_size + 1];
+    memcpy(literal, literal_start, literal_size);
+    literal[literal_size] = 0;
     /* close the string by moving past the last qoute */
     source_cpy++;
-    add_token(T_STRING, NULL, 0, literal_start, literal_size);
+    add_token(T_STRING, NULL, 0, literal, literal_size + 1);
+}
+
+/*
+ * 2.10.2 rule 7
+ * returns true if the word starting at str is on the form NAME=, which makes it an assignment
+ * when it comes before the command name.
+ */
+static bool is_assignment(char *str)
+{
+    if (!is_alpha(*str))
+        return false;
+    while (is_name(*str))
+        str++;
+    return *str == '=';
+}
+
+/*
+ * removes the quotes of the strings in the word of length len, but not the ones inside of
+ * expansions, as the parser reads those again.
+ * @returns the new length
+ */
+static size_t remove_quotes(char *str, size_t len)
+{
+    size_t out = 0;
+    int depth = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == '$' && i + 1 < len && (str[i + 1] == '(' || str[i + 1] == '{')) {
+            depth++;
+            str[out++] = str[i++];
+        } else if (depth > 0 && (str[i] == ')' || str[i] == '}')) {
+            depth--;
+        } else if (depth == 0 && str[i] == '"') {
+            continue;
+        }
+        str[out++] = str[i];
+    }
+    str[out] = 0;
+    return out;
+}
+
+/* moves source_cpy past the string source_cpy points at, quotes included */
+static void skip_string(void)
+{
+    source_cpy++;
+    while (*source_cpy != 0 && *source_cpy != '"') {
+        if (!skip_expansion())
+            source_cpy++;
+    }
+    if (*source_cpy == 0)
+        valery_exit_parse_error("string not terminated");
+    source_cpy++;
 }
 
 static void word(void)
 {
     char *identifier_start = source_cpy - 1;    // -1 because scan_token() incremented source_cpy
-    while (!is_terminal(*source_cpy))
-        source_cpy++;
+    /* the word may start with an expansion, which can contain terminal chars */
+    if (*identifier_start == '$') {
+        source_cpy--;
+        if (!skip_expansion())
+            source_cpy++;
+    }
+
+    /* the value of an assignment may be quoted, as in 'FOO="a b"' */
+    bool assignment = is_assignment(identifier_start);
+    while (!is_terminal(*source_cpy) || (assignment && *source_cpy == '"')) {
+        if (*source_cpy == '"')
+            skip_string();
+        else if (!skip_expansion())
+            source_cpy++;
+    }
 
     size_t len = source_cpy - identifier_start;
-    char identifier[len];
+    char identifier[len + 1];
     strncpy(identifier, identifier_start, len);
     identifier[len] = 0;
+    if (assignment)
+        len = remove_quotes(identifier, len);
 
     /*
      * 2.10.2
@@ -321,8 +448,74 @@ static void word(void)
      * where only a reserved word could be the next correct token, proceed as above. 
      */
     enum tokentype_t *is_reserved = ht_get(identifiers, identifier, len + 1);
+    enum tokentype_t type = is_reserved != NULL ? *is_reserved :
+                            assignment ? T_ASSIGNMENT_WORD : T_WORD;
     //add_token(is_reserved == NULL ? T_WORD : *is_reserved, identifier, len + 1, NULL, 0);
-    add_token(is_reserved == NULL ? T_WORD : *is_reserved, identifier, len + 1, identifier, len + 1);
+    add_token(type, identifier, len + 1, identifier, len + 1);
+}
+
+/*
+ * 2.7.4
+ * remembers the '<<' token just added so its body can be read once the current line is done.
+ */
+static void here_document(void)
+{
+    if (pending_heredocs_len == MAX_PENDING_HEREDOCS)
+        valery_exit_parse_error("too many here-documents on one line");
+
+    add_token_simple(T_DLESS);
+    pending_heredocs[pending_heredocs_len++] = tl->size - 1;
+}
+
+/*
+ * reads the bodies of all pending here-documents, in order, starting at source_cpy.
+ * each body is every line up to, but not including, the line consisting solely of the
+ * delimiter. the body is stored as the literal of the '<<' token.
+ */
+static void here_document_bodies(void)
+{
+    for (size_t i = 0; i < pending_heredocs_len; i++) {
+        struct token_t *op = tl->tokens[pending_heredocs[i]];
+        /* the delimiter is the word directly after '<<', the parser complains if it is missing */
+        if (pending_heredocs[i] + 1 >= tl->size)
+            continue;
+
+        struct token_t *delim_token = tl->tokens[pending_heredocs[i] + 1];
+        if (delim_token->literal == NULL)
+            continue;
+
+        char *delim = delim_token->literal;
+        size_t delim_len = strlen(delim);
+        char *body_start = source_cpy;
+        char *body_end = NULL;
+
+        while (*source_cpy != 0) {
+            char *line = source_cpy;
+            char *line_end = strchr(line, '\n');
+            if (line_end == NULL)
+                line_end = line + strlen(line);
+
+            source_cpy = *line_end == '\n' ? line_end + 1 : line_end;
+            if ((size_t)(line_end - line) == delim_len && strncmp(line, delim, delim_len) == 0) {
+                body_end = line;
+                break;
+            }
+        }
+
+        if (body_end == NULL) {
+            /* like bash, an unterminated here-document runs until the end of the input */
+            valery_error("here-document not terminated by delimiter");
+            body_end = source_cpy;
+        }
+
+        size_t body_len = body_end - body_start;
+        op->literal = vmalloc(body_len + 1);
+        memcpy(op->literal, body_start, body_len);
+        ((char *)op->literal)[body_len] = 0;
+        op->literal_size = body_len;
+    }
+
+    pending_heredocs_len = 0;
 }
 
 /* scans the source code until a non-ambigious token is determined */
@@ -346,12 +539,6 @@ static void scan_token(void)
         case ';':
             add_token_simple(T_SEMICOLON);
             break;
-        case '*':
-            add_token_simple(T_STAR);
-            break;
-        case '$':
-            add_token_simple(T_DOLLAR);
-            break;
 
         /* two character lexems */
         case '&':
@@ -361,6 +548,11 @@ static void scan_token(void)
             add_token_simple(match('=') ? T_EQUAL_EQUAL : T_EQUAL);
             break;
         case '.':
+            /* '.' and '..' on their own are tokens, longer words such as './a' or '.*' are not */
+            if (!is_terminal(source_cpy[0] == '.' ? source_cpy[1] : source_cpy[0])) {
+                word();
+                break;
+            }
             add_token_simple(match('.') ? T_DOT_DOT : T_DOT);
             break;
         case '|':
@@ -370,6 +562,13 @@ static void scan_token(void)
             add_token_simple(match('=') ? T_GREATER_EQUAL : T_GREATER);
             break;
         case '<':
+            if (match('<')) {
+                if (match('<'))
+                    add_token_simple(T_TLESS);
+                else
+                    here_document();
+                break;
+            }
             add_token_simple(match('=') ? T_LESS_EQUAL : T_LESS);
             break;
         case '!':
@@ -415,6 +614,8 @@ static void scan_token(void)
 
         case '\n':
             add_token_simple(T_NEWLINE);
+            if (pending_heredocs_len > 0)
+                here_document_bodies();
             break;
 
 
@@ -433,12 +634,21 @@ struct tokenlist_t *tokenize(char *source)
 {
     tl = tokenlist_malloc();            // define global struct tokenlist_t type
     source_cpy = source;                // global pointer into the source code for simplicity 
+    token_line = 1;
+    line_counted = source;
     init_identifiers();
 
     /* main lexical analysis loop */
     char c;
-    while ((c = *source_cpy) != 0)
+    while ((c = *source_cpy) != 0) {
+        for (; line_counted < source_cpy; line_counted++)
+            token_line += *line_counted == '\n';
         scan_token();                   // this function increments the source_cpy as needed
+    }
+
+    /* a here-document on the last line has no body to read, this reports it as unterminated */
+    if (pending_heredocs_len > 0)
+        here_document_bodies();
 
     /* add sentinel token */
     add_token(T_EOF, NULL, 0, NULL, 0);
@@ -449,10 +659,10 @@ struct tokenlist_t *tokenize(char *source)
 void tokenlist_free(struct tokenlist_t *tokenlist)
 {
     for (size_t i = 0; i < tokenlist->size; i++)
-        free(tokenlist->tokens[i]);
+        vfree(tokenlist->tokens[i]);
 
-    free(tokenlist->tokens);
-    free(tokenlist);
+    vfree(tokenlist->tokens);
+    vfree(tokenlist);
 }
 
 void tokenlist_print(struct tokenlist_t *tokenlist)
@@ -467,7 +677,7 @@ void tokenlist_print(struct tokenlist_t *tokenlist)
         if (token->literal != NULL) {
             if (token->type == T_NUMBER)
                 printf(" literal: '%ld'", *(int64_t *)token->literal);
-            else if (token->type == T_STRING)
+            else if (token->type == T_STRING || token->type == T_ASSIGNMENT_WORD)
                 printf(" literal: '%s'", (char *)token->literal);
         }
 
@@ -15,14 +15,21 @@
  *  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define VALERY_MEM_TAG MEM_PARSER
+#include <ctype.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lib/nicc/nicc.h"
 #include "valery/interpreter/ast.h"
 #include "valery/interpreter/lexer.h"
 #include "valery/interpreter/parser.h"
 #include "valery/interpreter/parser_utils.h"
+#include "valery/interpreter/impl/glob.h"
+#include "valery/interpreter/impl/alias.h"
 #include "valery/valery.h"
+#include "valery/env.h"
 
 
 /* spec */
@@ -67,7 +74,6 @@ static void *simple_command(void);
 //static void *io_redirect(void);
 //static void *io_file(void);
 //static void *filename(void);
-//static void *io_here(void);
 //static void *here_end(void);
 //static void *newline_list(void);
 static void *linebreak(void);
@@ -80,14 +86,25 @@ struct tokenlist_t *tokenlist;
 
 static struct Stmt *program(void);
 static struct Expr *and_if(void);
+static struct token_t *current(void);
 static struct Expr *command(void);
+static struct Expr *subshell(void);
+static struct Expr *function_definition(void);
+static struct Expr *return_command(void);
+static struct darr_t *compound_list(enum tokentype_t close, char *err_msg);
+static struct Assignment *assignment(struct token_t *token);
+static void io_here(struct CommandExpr *expr);
+static struct Expr *word(struct token_t *token);
+static struct WordExpr *word_compile(char *str, size_t len);
 
 static struct Stmt *program(void)
 {
-    struct ExpressionStmt *stmt = (struct ExpressionStmt *)stmt_alloc(STMT_EXPRESSION, NULL);
+    struct ExpressionStmt *stmt = (struct ExpressionStmt *)stmt_alloc(STMT_EXPRESSION, current());
     struct Expr *expr = and_if();
     stmt->expression = expr;
-    consume(T_NEWLINE, "newline expected");
+    /* the last line of the source does not need a trailing newline */
+    if (!check(T_EOF) && !match(T_SEMICOLON))
+        consume(T_NEWLINE, "newline expected");
     return (struct Stmt *)stmt;
 }
 
@@ -107,17 +124,408 @@ static struct Expr *and_if(void)
     return condition;
 }
 
+/* returns the token about to be parsed, the T_EOF sentinel at the latest */
+static struct token_t *current(void)
+{
+    return tokenlist->tokens[tokenlist->pos];
+}
+
+/* returns the type of the token n tokens after the current one */
+static enum tokentype_t peek(size_t n)
+{
+    if (tokenlist->pos + n >= tokenlist->size)
+        return T_EOF;
+    return tokenlist->tokens[tokenlist->pos + n]->type;
+}
+
 static struct Expr *command(void)
 {
+    /* the name of a function is not an alias, even if an alias of that name exists */
+    if (check(T_WORD) && peek(1) == T_LPAREN && peek(2) == T_RPAREN)
+        return function_definition();
+
+    alias_expand(tokenlist);
+    if (match(T_LPAREN))
+        return subshell();
+    if (match(T_RETURN))
+        return return_command();
+
     struct CommandExpr *expr = (struct CommandExpr *)expr_alloc(EXPR_COMMAND, NULL);
-    while (match(T_WORD, T_STRING)) {
-        struct token_t *prev = previous();
-        struct LiteralExpr *expr_lit = (struct LiteralExpr *)expr_alloc(EXPR_LITERAL, prev);
-        darr_append(expr->exprs, expr_lit);
+    /* 2.9.1 assignments are only recognized before the command name */
+    struct Assignment **tail = &expr->assignments;
+    while (match(T_ASSIGNMENT_WORD)) {
+        *tail = assignment(previous());
+        tail = &(*tail)->next;
+    }
+    if (expr->assignments != NULL)
+        alias_expand(tokenlist);
+
+    while (1) {
+        if (match(T_WORD, T_STRING, T_ASSIGNMENT_WORD)) {
+            darr_append(expr->exprs, word(previous()));
+        } else if (match(T_DLESS, T_TLESS)) {
+            io_here(expr);
+        } else {
+            break;
+        }
+    }
+    return (struct Expr *)expr;
+}
+
+/*
+ * compound_list: statements separated by newlines or ';', up to and including the close token.
+ */
+static struct darr_t *compound_list(enum tokentype_t close, char *err_msg)
+{
+    struct darr_t *statements = darr_malloc();
+    while (1) {
+        while (match(T_NEWLINE, T_SEMICOLON));
+        if (match(close))
+            break;
+        if (check(T_EOF))
+            valery_exit_parse_error(err_msg);
+
+        size_t start = tokenlist->pos;
+        struct ExpressionStmt *stmt = (struct ExpressionStmt *)stmt_alloc(STMT_EXPRESSION, current());
+        stmt->expression = and_if();
+        /* a token no command can start with */
+        if (tokenlist->pos == start)
+            valery_exit_parse_error(err_msg);
+        darr_append(statements, stmt);
+    }
+    return statements;
+}
+
+/* subshell: '(' compound_list ')' */
+static struct Expr *subshell(void)
+{
+    struct SubshellExpr *expr = (struct SubshellExpr *)expr_alloc(EXPR_SUBSHELL, NULL);
+    expr->statements = compound_list(T_RPAREN, "subshell not terminated, ')' expected");
+    return (struct Expr *)expr;
+}
+
+/*
+ * function_definition: fname '(' ')' linebreak function_body
+ * function_body: '{' compound_list '}' | subshell
+ * the body is parsed onto the persistent arena, so calling the function later runs the same
+ * nodes without tokenizing or parsing anything again.
+ */
+static struct Expr *function_definition(void)
+{
+    struct token_t *fname = consume(T_WORD, "function name expected");
+    consume(T_LPAREN, "'(' expected");
+    consume(T_RPAREN, "')' expected");
+    while (match(T_NEWLINE));
+
+    struct m_arena *outer = ast_arena_persist_begin();
+    struct function_t *function = ast_arena_alloc(sizeof(struct function_t));
+    size_t len = strlen(fname->literal);
+    function->name = ast_arena_alloc(len + 1);
+    memcpy(function->name, fname->literal, len + 1);
+    function->hash = env_hash(function->name, len);
+
+    if (match(T_LBRACE)) {
+        function->statements = compound_list(T_RBRACE, "function body not terminated, '}' expected");
+    } else if (match(T_LPAREN)) {
+        struct ExpressionStmt *stmt = (struct ExpressionStmt *)stmt_alloc(STMT_EXPRESSION, current());
+        stmt->expression = subshell();
+        function->statements = darr_malloc();
+        darr_append(function->statements, stmt);
+    } else {
+        valery_exit_parse_error("function body expected, '{' or '(' expected");
     }
+    ast_arena_persist_end(outer);
+
+    struct FunctionExpr *expr = (struct FunctionExpr *)expr_alloc(EXPR_FUNCTION, NULL);
+    expr->function = function;
+    return (struct Expr *)expr;
+}
+
+/* 'return [n]' */
+static struct Expr *return_command(void)
+{
+    struct ReturnExpr *expr = (struct ReturnExpr *)expr_alloc(EXPR_RETURN, NULL);
+    if (match(T_WORD, T_STRING))
+        expr->code = word(previous());
     return (struct Expr *)expr;
 }
 
+/* splits NAME=value, the lexer has already removed the quotes of the value */
+static struct Assignment *assignment(struct token_t *token)
+{
+    char *str = token->literal;
+    char *equal = strchr(str, '=');
+    struct Assignment *assignment = ast_arena_alloc(sizeof(struct Assignment));
+    assignment->next = NULL;
+
+    size_t name_len = equal - str;
+    assignment->name = ast_arena_alloc(name_len + 1);
+    memcpy(assignment->name, str, name_len);
+    assignment->name[name_len] = 0;
+
+    char *value = equal + 1;
+    size_t len = strlen(value);
+
+    /* 2.9.1 the value is expanded, but not split into fields or matched against paths */
+    if (memchr(value, '$', len) != NULL) {
+        assignment->value = (struct Expr *)word_compile(value, len);
+    } else {
+        struct LiteralExpr *literal = ast_arena_alloc(sizeof(struct LiteralExpr));
+        literal->head.type = EXPR_LITERAL;
+        literal->value = value;
+        literal->value_type = LIT_STRING;
+        assignment->value = (struct Expr *)literal;
+    }
+    return assignment;
+}
+
+static inline bool is_name_start(char c)
+{
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static inline bool is_name_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/*
+ * @returns the index of the close char matching the open char that comes right before start.
+ * strings are skipped, so their contents never count.
+ */
+static size_t matching_close(char *str, size_t len, size_t start, char open, char close)
+{
+    int depth = 1;
+    for (size_t i = start; i < len; i++) {
+        if (str[i] == '"') {
+            while (++i < len && str[i] != '"');
+        } else if (str[i] == open) {
+            depth++;
+        } else if (str[i] == close && --depth == 0) {
+            return i;
+        }
+    }
+
+    valery_exit_parse_error(open == '(' ? "command substitution not terminated"
+                                        : "parameter expansion not terminated");
+    return len;
+}
+
+/*
+ * the source inside '$(' ')' is tokenized and parsed here, once, so evaluating the
+ * substitution never has to look at the source again.
+ */
+static struct darr_t *substitution_parse(char *src, size_t len)
+{
+    char *source = vmalloc(len + 1);
+    memcpy(source, src, len);
+    source[len] = 0;
+
+    /* parse() overwrites the global tokenlist, so the current one is restored afterwards */
+    struct tokenlist_t *outer = tokenlist;
+    struct tokenlist_t *inner = tokenize(source);
+    /* the lines count from the word the substitution is in, not from the substitution */
+    size_t line = previous()->line - 1;
+    for (size_t i = 0; i < inner->size; i++)
+        inner->tokens[i]->line += line;
+    struct darr_t *statements = parse(inner);
+    tokenlist = outer;
+
+    /* the tokens have copies of everything they need from the source */
+    vfree(source);
+    return statements;
+}
+
+/* stores a NUL terminated copy of the parameter name and its hash in the part */
+static void param_name(struct WordPart *part, char *name, size_t len)
+{
+    part->type = WORD_PARAM;
+    part->str = ast_arena_alloc(len + 1);
+    memcpy(part->str, name, len);
+    part->str[len] = 0;
+    part->len = len;
+    part->hash = env_hash(part->str, len);
+}
+
+/* 2.5.2 '#', '@' and '*' are special parameters */
+static inline bool is_special_param(char c)
+{
+    return c == '#' || c == '@' || c == '*';
+}
+
+/*
+ * compiles the parameter of length len at str, which is a name, a number or a special parameter.
+ * @returns the length of the parameter, 0 if str does not start with one
+ */
+static size_t param_kind(struct WordPart *part, char *str, size_t len, bool braces)
+{
+    size_t param_len = 0;
+    if (len > 0 && is_name_start(str[0])) {
+        while (param_len < len && is_name_char(str[param_len]))
+            param_len++;
+        param_name(part, str, param_len);
+    } else if (len > 0 && isdigit((unsigned char)str[0])) {
+        /* 2.5.1 without braces only a single digit is a positional parameter */
+        part->type = WORD_POSITIONAL;
+        part->len = 0;
+        do {
+            part->len = part->len * 10 + (str[param_len++] - '0');
+        } while (braces && param_len < len && isdigit((unsigned char)str[param_len]));
+    } else if (len > 0 && is_special_param(str[0])) {
+        part->type = str[0] == '#' ? WORD_ARG_COUNT : WORD_ALL_ARGS;
+        param_len = 1;
+    }
+    return param_len;
+}
+
+/* compiles the inside of '${' '}': PARAM, PARAM:-word or PARAM-word */
+static void param_compile(struct WordPart *part, char *str, size_t len)
+{
+    size_t name_len = param_kind(part, str, len, true);
+    if (name_len == 0)
+        valery_exit_parse_error("bad substitution");
+    if (name_len == len)
+        return;
+
+    size_t rest = name_len;
+    if (str[rest] == ':' && rest + 1 < len && str[rest + 1] == '-') {
+        part->fallback_if_empty = true;
+        rest += 2;
+    } else if (str[rest] == '-') {
+        rest++;
+    } else {
+        valery_exit_parse_error("bad substitution");
+    }
+
+    part->fallback = word_compile(str + rest, len - rest);
+}
+
+/* appends a part to the plan under construction */
+static struct WordPart *word_part_add(struct WordPart **parts, size_t *parts_len, size_t *capacity)
+{
+    if (*parts_len == *capacity) {
+        *capacity *= 2;
+        *parts = vrealloc(*parts, *capacity * sizeof(struct WordPart));
+    }
+
+    struct WordPart *part = &(*parts)[(*parts_len)++];
+    part->str = NULL;
+    part->len = 0;
+    part->hash = 0;
+    part->fallback = NULL;
+    part->fallback_if_empty = false;
+    part->statements = NULL;
+    return part;
+}
+
+static void word_literal_add(struct WordPart **parts, size_t *parts_len, size_t *capacity,
+                             char *str, size_t len)
+{
+    struct WordPart *part = word_part_add(parts, parts_len, capacity);
+    part->type = WORD_LITERAL;
+    part->str = str;
+    part->len = len;
+}
+
+/*
+ * 2.6
+ * compiles a word into a plan of literal slices, parameters and command substitutions.
+ * a '$' that does not start an expansion is kept as a literal.
+ */
+static struct WordExpr *word_compile(char *str, size_t len)
+{
+    size_t capacity = 4;
+    size_t parts_len = 0;
+    struct WordPart *parts = vmalloc(capacity * sizeof(struct WordPart));
+    size_t literal_start = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        if (str[i] != '$' || i + 1 >= len) {
+            i++;
+            continue;
+        }
+
+        size_t end;
+        char next = str[i + 1];
+        if (next != '(' && next != '{' && !is_name_start(next) && !isdigit((unsigned char)next) &&
+            !is_special_param(next)) {
+            i++;
+            continue;
+        }
+
+        if (i > literal_start)
+            word_literal_add(&parts, &parts_len, &capacity, str + literal_start, i - literal_start);
+
+        struct WordPart *part = word_part_add(&parts, &parts_len, &capacity);
+        if (next == '(') {
+            size_t close = matching_close(str, len, i + 2, '(', ')');
+            part->type = WORD_COMMAND_SUBST;
+            part->statements = substitution_parse(str + i + 2, close - (i + 2));
+            end = close + 1;
+        } else if (next == '{') {
+            size_t close = matching_close(str, len, i + 2, '{', '}');
+            param_compile(part, str + i + 2, close - (i + 2));
+            end = close + 1;
+        } else {
+            end = i + 1 + param_kind(part, str + i + 1, len - (i + 1), false);
+        }
+
+        i = literal_start = end;
+    }
+
+    if (literal_start < len || parts_len == 0)
+        word_literal_add(&parts, &parts_len, &capacity, str + literal_start, len - literal_start);
+
+    struct WordExpr *expr = (struct WordExpr *)expr_alloc(EXPR_WORD, NULL);
+    expr->parts = ast_arena_alloc(parts_len * sizeof(struct WordPart));
+    memcpy(expr->parts, parts, parts_len * sizeof(struct WordPart));
+    expr->parts_len = parts_len;
+    vfree(parts);
+    return expr;
+}
+
+/*
+ * words without a '$' need no expansion and stay plain literals, unless they are unquoted and
+ * contain wildcards.
+ */
+static struct Expr *word(struct token_t *token)
+{
+    char *str = token->literal;
+    if (strchr(str, '$') == NULL) {
+        if (token->type == T_WORD && glob_has_wildcard(str)) {
+            struct GlobExpr *expr = (struct GlobExpr *)expr_alloc(EXPR_GLOB, token);
+            expr->pattern = glob_compile(str);
+            return (struct Expr *)expr;
+        }
+        return expr_alloc(EXPR_LITERAL, token);
+    }
+
+    return (struct Expr *)word_compile(str, strlen(str));
+}
+
+/*
+ * io_here: DLESS here_end | TLESS word
+ * the body of a here-document was read by the lexer and stored on the '<<' token.
+ */
+static void io_here(struct CommandExpr *expr)
+{
+    struct token_t *op = previous();
+    if (!match(T_WORD, T_STRING))
+        valery_exit_parse_error(op->type == T_DLESS ? "here-document delimiter expected"
+                                                    : "here-string word expected");
+
+    if (op->type == T_DLESS) {
+        expr->here = op->literal != NULL ? op->literal : "";
+        expr->here_len = op->literal != NULL ? op->literal_size : 0;
+        expr->here_string = NULL;
+    } else {
+        /* the word of a here-string is expanded like any other word */
+        expr->here_string = word(previous());
+        expr->here = NULL;
+    }
+}
+
 struct darr_t *parse(struct tokenlist_t *tl)
 {
     tokenlist = tl;
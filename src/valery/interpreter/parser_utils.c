@@ -14,6 +14,7 @@
  *  You should have received a copy of the GNU General Public License along with this program.
  *  If not, see <https://www.gnu.org/licenses/>.
  */
+#define VALERY_MEM_TAG MEM_PARSER
 #include <stdbool.h>                    // bool type
 #include <stdarg.h>                     // va_start, va_arg, va_end 
 
@@ -26,6 +27,7 @@
 extern struct tokenlist_t *tokenlist;   // defined in parser.c, TODO: globals are le bad
 struct m_arena *ast_arena = NULL;       // the memory arena to alloc abstract syntax tree nodes onto
                                         // ex: Stmt or Expr
+static struct m_arena *persist_arena = NULL;    // nodes that live as long as the shell
 
 bool check_single(enum tokentype_t type)
 {
@@ -107,7 +109,39 @@ struct Expr *expr_alloc(enum ExprType type, struct token_t *token)
 
         case EXPR_COMMAND:
             expr = m_arena_alloc(ast_arena, sizeof(struct CommandExpr));
+            ((struct CommandExpr *)expr)->assignments = NULL;
             ((struct CommandExpr *)expr)->exprs = darr_malloc();   /* TODO: put on arena */
+            ((struct CommandExpr *)expr)->here = NULL;
+            ((struct CommandExpr *)expr)->here_len = 0;
+            ((struct CommandExpr *)expr)->here_string = NULL;
+            ((struct CommandExpr *)expr)->function = NULL;
+            ((struct CommandExpr *)expr)->function_version = 0;
+            break;
+
+        case EXPR_GLOB:
+            expr = m_arena_alloc(ast_arena, sizeof(struct GlobExpr));
+            ((struct GlobExpr *)expr)->pattern = NULL;
+            break;
+
+        case EXPR_WORD:
+            expr = m_arena_alloc(ast_arena, sizeof(struct WordExpr));
+            ((struct WordExpr *)expr)->parts = NULL;
+            ((struct WordExpr *)expr)->parts_len = 0;
+            break;
+
+        case EXPR_SUBSHELL:
+            expr = m_arena_alloc(ast_arena, sizeof(struct SubshellExpr));
+            ((struct SubshellExpr *)expr)->statements = NULL;
+            break;
+
+        case EXPR_FUNCTION:
+            expr = m_arena_alloc(ast_arena, sizeof(struct FunctionExpr));
+            ((struct FunctionExpr *)expr)->function = NULL;
+            break;
+
+        case EXPR_RETURN:
+            expr = m_arena_alloc(ast_arena, sizeof(struct ReturnExpr));
+            ((struct ReturnExpr *)expr)->code = NULL;
             break;
     }
 
@@ -124,10 +158,16 @@ struct Stmt *stmt_alloc(enum StmtType type, struct token_t *token)
             break;
     }
     stmt->type = type;
+    stmt->line = token != NULL ? token->line : 0;
     return stmt;
 }
 
 
+void *ast_arena_alloc(size_t size)
+{
+    return m_arena_alloc(ast_arena, size);
+}
+
 void ast_arena_init()
 {
     ast_arena = m_arena_init(GB_SIZE_T(16), 4096);
@@ -142,3 +182,25 @@ void ast_arena_release()
 {
     m_arena_release(ast_arena);
 }
+
+struct m_arena *ast_arena_persist_begin(void)
+{
+    if (persist_arena == NULL)
+        persist_arena = m_arena_init(GB_SIZE_T(1), 4096);
+
+    struct m_arena *previous = ast_arena;
+    ast_arena = persist_arena;
+    return previous;
+}
+
+void ast_arena_persist_end(struct m_arena *previous)
+{
+    ast_arena = previous;
+}
+
+void ast_arena_persist_release(void)
+{
+    if (persist_arena != NULL)
+        m_arena_release(persist_arena);
+    persist_arena = NULL;
+}
@@ -17,8 +17,15 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE             // st_mtim
+#define VALERY_MEM_TAG MEM_ENV
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "valery/valery.h"
 #include "valery/env.h"
@@ -26,6 +33,189 @@
 #include "lib/vstring.h"
 
 
+/* types */
+/*
+ * the snapshot file is this header followed by the records.
+ * a record is a type byte followed by its NUL terminated strings:
+ * SNAPSHOT_ENV: key and value, in the order they appear in the config.
+ * PATH is not stored unwrapped, it may come from the environment valery was started with.
+ */
+struct snapshot_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t records;
+    uint64_t rc_size;
+    int64_t rc_mtime_sec;
+    int64_t rc_mtime_nsec;
+    uint64_t rc_hash;           /* of the contents of the config */
+    uint64_t payload_size;
+    uint64_t payload_hash;      /* of the records, catches a truncated or corrupt snapshot */
+};
+
+/* the records of a snapshot while the config is parsed */
+struct snapshot_t {
+    char *buf;
+    size_t len;
+    size_t capacity;
+    uint32_t records;
+};
+
+
+/* FNV-1a that can be continued, start with SNAPSHOT_HASH_SEED */
+static uint64_t snapshot_hash(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static void snapshot_append(struct snapshot_t *snap, const void *data, size_t len)
+{
+    if (snap->len + len > snap->capacity) {
+        snap->capacity = MAX(snap->capacity * 2, snap->len + len);
+        snap->buf = vrealloc(snap->buf, snap->capacity);
+    }
+    memcpy(snap->buf + snap->len, data, len);
+    snap->len += len;
+}
+
+static void snapshot_add(struct snapshot_t *snap, char type, char *key, char *value)
+{
+    snapshot_append(snap, &type, 1);
+    snapshot_append(snap, key, strlen(key) + 1);
+    snapshot_append(snap, value, strlen(value) + 1);
+    snap->records++;
+}
+
+static void path_add(struct paths_t *p, char *path)
+{
+    if (p->size == p->capacity - 1)
+        path_increase(p, p->capacity * 2);
+
+    strncpy(p->paths[p->size++], path, MAX_ENV_LEN);
+}
+
+/* hashes the contents of the file, returns 1 if it could not be read */
+static int file_hash(const char *path, uint64_t *hash)
+{
+    char buf[KB(64)];
+    ssize_t n;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 1;
+
+    *hash = SNAPSHOT_HASH_SEED;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        *hash = snapshot_hash(*hash, buf, n);
+    close(fd);
+    return n == -1;
+}
+
+/*
+ * sets the environment from the snapshot if it was made from the config as it is now.
+ * a snapshot whose config only has a new mtime is still used if the contents hash the same.
+ * returns 0 if the snapshot was used, else 1.
+ */
+static int snapshot_load(const char *snapshot_path, const char *config_path, struct stat *rc_st,
+                         struct env_vars_t *env_vars)
+{
+    struct stat st;
+    int fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return 1;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct snapshot_header_t)) {
+        close(fd);
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    int rc = 1;
+    struct snapshot_header_t header;
+    memcpy(&header, map, sizeof(header));
+    char *payload = map + sizeof(header);
+    char *end = map + size;
+
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION ||
+        header.payload_size != size - sizeof(header) ||
+        header.payload_hash != snapshot_hash(SNAPSHOT_HASH_SEED, payload, header.payload_size) ||
+        header.rc_size != (uint64_t)rc_st->st_size)
+        goto done;
+
+    if (header.rc_mtime_sec != rc_st->st_mtim.tv_sec ||
+        header.rc_mtime_nsec != rc_st->st_mtim.tv_nsec) {
+        uint64_t hash;
+        if (file_hash(config_path, &hash) != 0 || hash != header.rc_hash)
+            goto done;
+
+        /* the contents are unchanged, so only the mtime in the header needs updating */
+        header.rc_mtime_sec = rc_st->st_mtim.tv_sec;
+        header.rc_mtime_nsec = rc_st->st_mtim.tv_nsec;
+        fd = open(snapshot_path, O_WRONLY | O_CLOEXEC);
+        if (fd != -1) {
+            (void)!pwrite(fd, &header, sizeof(header), 0);
+            close(fd);
+        }
+    }
+
+    /* the records were hashed, but a NUL must still end the last string so we stay inside */
+    if (header.payload_size > 0 && end[-1] != 0)
+        goto done;
+
+    for (char *r = payload; r < end;) {
+        char type = *r++;
+        char *key = r;
+        r += strlen(r) + 1;
+        if (type != SNAPSHOT_ENV || r >= end)
+            goto done;
+        char *value = r;
+        r += strlen(r) + 1;
+        env_set(env_vars, key, value);
+    }
+    rc = 0;
+
+done:
+    munmap(map, size);
+    return rc;
+}
+
+/* writes the snapshot to a temporary file first, so a reader never sees half a snapshot */
+static void snapshot_write(const char *snapshot_path, struct stat *rc_st, uint64_t rc_hash,
+                           struct snapshot_t *snap)
+{
+    char tmp_path[MAX_ENV_LEN];
+    snprintf(tmp_path, MAX_ENV_LEN, "%s.tmp", snapshot_path);
+
+    struct snapshot_header_t header = {
+        .magic = SNAPSHOT_MAGIC,
+        .version = SNAPSHOT_VERSION,
+        .records = snap->records,
+        .rc_size = rc_st->st_size,
+        .rc_mtime_sec = rc_st->st_mtim.tv_sec,
+        .rc_mtime_nsec = rc_st->st_mtim.tv_nsec,
+        .rc_hash = rc_hash,
+        .payload_size = snap->len,
+        .payload_hash = snapshot_hash(SNAPSHOT_HASH_SEED, snap->buf, snap->len)
+    };
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return;
+    bool ok = write(fd, &header, sizeof(header)) == sizeof(header) &&
+              write(fd, snap->buf, snap->len) == (ssize_t)snap->len;
+    close(fd);
+    if (!ok || rename(tmp_path, snapshot_path) == -1)
+        unlink(tmp_path);
+}
+
 int parse_config(struct env_vars_t *env_vars, struct paths_t *p)
 {
     /*
@@ -37,21 +227,34 @@ int parse_config(struct env_vars_t *env_vars, struct paths_t *p)
 
     FILE *fp;
     char config_path[MAX_ENV_LEN];
+    char snapshot_path[MAX_ENV_LEN];
     char buf[MAX_ENV_LEN];
     char key[MAX_ENV_LEN];
     char val[MAX_ENV_LEN];
     int found_pos;
     int rc;
+    struct stat rc_st;
 
     rc = get_config_path(config_path, env_get(env_vars, "HOME"));
     if (rc == 1)
         return 1;
 
+    if (stat(config_path, &rc_st) == -1)
+        return 1;
+    snprintf(snapshot_path, MAX_ENV_LEN, "%s/%s", env_get(env_vars, "HOME"), SNAPSHOT_NAME);
+    if (snapshot_load(snapshot_path, config_path, &rc_st, env_vars) == 0) {
+        unwrap_paths(p, env_get(env_vars, "PATH"));
+        return 0;
+    }
+
     fp = fopen(config_path, "r");
     if (fp == NULL)
         return 1;
 
+    struct snapshot_t snap = { 0 };
+    uint64_t rc_hash = SNAPSHOT_HASH_SEED;
     while (fgets(buf, MAX_ENV_LEN, fp)) {
+        rc_hash = snapshot_hash(rc_hash, buf, strlen(buf));
         /* parse line */
         if (buf[0] == '#')
             continue;
@@ -66,12 +269,15 @@ int parse_config(struct env_vars_t *env_vars, struct paths_t *p)
             val[str_len - found_pos - 2] = '\0';
 
             env_set(env_vars, key, val);
+            snapshot_add(&snap, SNAPSHOT_ENV, key, val);
         }
 
     }
 
     fclose(fp);
-    unwrap_paths(p, (char *) env_get(env_vars, "PATH"));
+    unwrap_paths(p, env_get(env_vars, "PATH"));
+    snapshot_write(snapshot_path, &rc_st, rc_hash, &snap);
+    vfree(snap.buf);
     return 0;
 }
 
@@ -93,14 +299,15 @@ void unwrap_paths(struct paths_t *p, char *PATHS)
         return;
     }
 
+    /* strtok() writes into the string, so it must not be the value stored in the environment */
+    char paths_cpy[strlen(PATHS) + 1];
+    strcpy(paths_cpy, PATHS);
+
     const char delim[] = ":";
-    char *path = strtok(PATHS, delim);
+    char *path = strtok(paths_cpy, delim);
     
     while (path != NULL) {
-        if (p->size == p->capacity - 1)
-            path_increase(p, p->capacity * 2);
-       
-        strncpy(p->paths[p->size++], path, MAX_ENV_LEN);
+        path_add(p, path);
         path = strtok(NULL, delim);
     }
 }
@@ -0,0 +1,159 @@
+/*
+ *  Counts the memory allocated through vmalloc(), vcalloc() and vrealloc() per subsystem when
+ *  valery is built with VALERY_MEMSTATS. The size of every live allocation is kept in a table
+ *  by address, so vfree() knows how much to subtract and from which subsystem.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "valery/valery.h"
+#include "valery/memstats.h"
+#include "valery/table.h"
+
+
+/* types */
+struct memstats_entry_t {
+    void *ptr;
+    size_t size;
+    enum mem_tag_t tag;
+};
+
+
+static const char *tag_names[MEM_TAG_COUNT] = {
+    [MEM_OTHER] = "other",
+    [MEM_LEXER] = "lexer",
+    [MEM_PARSER] = "parser",
+    [MEM_INTERPRETER] = "interpreter",
+    [MEM_ENV] = "env",
+    [MEM_HISTORY] = "history",
+    [MEM_PROMPT] = "prompt",
+};
+
+/* the completion and segment threads allocate as well */
+static pthread_mutex_t memstats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct memstats_t stats[MEM_TAG_COUNT];
+static size_t total_live = 0;
+static size_t total_peak = 0;
+
+/* allocated with calloc() and free(), as counting itself would never end */
+static struct table_t entries = { .item_size = sizeof(struct memstats_entry_t),
+                                  .starting_capacity = MEMSTATS_STARTING_CAPACITY,
+                                  .uncounted = true };
+
+
+static uint64_t ptr_hash(void *ptr)
+{
+    uint64_t hash = (uint64_t)(uintptr_t)ptr * 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 32);
+}
+
+static bool ptr_eq(const void *item, const void *key)
+{
+    return ((const struct memstats_entry_t *)item)->ptr == key;
+}
+
+static void untrack(struct memstats_entry_t *entry)
+{
+    stats[entry->tag].live -= entry->size;
+    total_live -= entry->size;
+    table_rm(&entries, entry);
+}
+
+void memstats_alloc(void *ptr, size_t size, enum mem_tag_t tag, bool resized)
+{
+    pthread_mutex_lock(&memstats_lock);
+    bool added;
+    struct memstats_entry_t *entry = table_put(&entries, ptr_hash(ptr), ptr, ptr_eq, &added);
+    /* there is no memory for a larger table, the allocation is not counted then */
+    if (entry == NULL) {
+        pthread_mutex_unlock(&memstats_lock);
+        return;
+    }
+    /* the last allocation at this address was freed without vfree() */
+    if (!added) {
+        stats[entry->tag].live -= entry->size;
+        total_live -= entry->size;
+    }
+    *entry = (struct memstats_entry_t){ .ptr = ptr, .size = size, .tag = tag };
+
+    struct memstats_t *s = &stats[tag];
+    if (resized)
+        s->reallocs++;
+    else
+        s->allocs++;
+    s->live += size;
+    s->peak = MAX(s->peak, s->live);
+    total_live += size;
+    total_peak = MAX(total_peak, total_live);
+    pthread_mutex_unlock(&memstats_lock);
+}
+
+void memstats_free(void *ptr, bool resized)
+{
+    pthread_mutex_lock(&memstats_lock);
+    struct memstats_entry_t *entry = table_get(&entries, ptr_hash(ptr), ptr, ptr_eq);
+    if (entry != NULL) {
+        if (!resized)
+            stats[entry->tag].frees++;
+        untrack(entry);
+    }
+    pthread_mutex_unlock(&memstats_lock);
+}
+
+static void memstats_print_row(FILE *out, const char *name, struct memstats_t *s)
+{
+    fprintf(out, "%-12s %12zu %12zu %10llu %10llu %10llu\n", name, s->live, s->peak,
+            (unsigned long long)s->allocs, (unsigned long long)s->reallocs,
+            (unsigned long long)s->frees);
+}
+
+void memstats_print(FILE *out)
+{
+    pthread_mutex_lock(&memstats_lock);
+    struct memstats_t copy[MEM_TAG_COUNT];
+    memcpy(copy, stats, sizeof(copy));
+    struct memstats_t total = { .live = total_live, .peak = total_peak };
+    pthread_mutex_unlock(&memstats_lock);
+
+    fprintf(out, "%-12s %12s %12s %10s %10s %10s\n", "subsystem", "live bytes", "peak bytes",
+            "allocs", "reallocs", "frees");
+    for (int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+        struct memstats_t *s = &copy[tag];
+        total.allocs += s->allocs;
+        total.reallocs += s->reallocs;
+        total.frees += s->frees;
+        if (s->peak != 0 || s->allocs != 0 || s->reallocs != 0 || s->frees != 0)
+            memstats_print_row(out, tag_names[tag], s);
+    }
+    memstats_print_row(out, "total", &total);
+}
+
+void memstats_clear(void)
+{
+    pthread_mutex_lock(&memstats_lock);
+    for (int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+        stats[tag].allocs = stats[tag].reallocs = stats[tag].frees = 0;
+        stats[tag].peak = stats[tag].live;
+    }
+    total_peak = total_live;
+    pthread_mutex_unlock(&memstats_lock);
+}
@@ -0,0 +1,132 @@
+/*
+ *  Times the phases of running a command line. Every line gets a breakdown on stderr, and a
+ *  histogram per phase over all lines is printed when the shell exits.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // clock_gettime
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "valery/profile.h"
+
+#define NS_PER_US 1000
+
+
+/* types */
+struct profile_hist_t {
+    uint64_t buckets[PROFILE_BUCKETS];
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+
+bool profile_enabled = false;
+
+static const char *phase_names[PROFILE_PHASE_COUNT] = {
+    [PROFILE_TOKENIZE] = "tokenize",
+    [PROFILE_PARSE] = "parse",
+    [PROFILE_INTERPRET] = "interpret",
+    [PROFILE_SPAWN] = "spawn",
+    [PROFILE_WAIT] = "wait",
+};
+
+/* the current line, spawn and wait may happen any number of times per line */
+static uint64_t line_ns[PROFILE_PHASE_COUNT];
+static uint64_t line_count[PROFILE_PHASE_COUNT];
+
+static struct profile_hist_t hists[PROFILE_PHASE_COUNT];
+
+
+void profile_init(void)
+{
+    char *value = getenv(PROFILE_ENV);
+    if (value != NULL && *value != 0 && strcmp(value, "0") != 0)
+        profile_enabled = true;
+}
+
+uint64_t profile_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+void profile_add(enum profile_phase_t phase, uint64_t start)
+{
+    line_ns[phase] += profile_now() - start;
+    line_count[phase]++;
+}
+
+static void hist_add(struct profile_hist_t *hist, uint64_t ns)
+{
+    uint64_t us = ns / NS_PER_US;
+    int bucket = 0;
+    while (us > 1 && bucket < PROFILE_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->total_ns += ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+}
+
+void profile_line_end(void)
+{
+    if (!profile_enabled)
+        return;
+
+    fprintf(stderr, "profile:");
+    for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+        if (line_count[phase] == 0)
+            continue;
+        fprintf(stderr, " %s %.1fus", phase_names[phase], (double)line_ns[phase] / NS_PER_US);
+        if (line_count[phase] > 1)
+            fprintf(stderr, " (x%llu)", (unsigned long long)line_count[phase]);
+        hist_add(&hists[phase], line_ns[phase]);
+    }
+    fputc('\n', stderr);
+
+    memset(line_ns, 0, sizeof(line_ns));
+    memset(line_count, 0, sizeof(line_count));
+}
+
+void profile_report(FILE *out)
+{
+    if (!profile_enabled)
+        return;
+
+    for (int phase = 0; phase < PROFILE_PHASE_COUNT; phase++) {
+        struct profile_hist_t *hist = &hists[phase];
+        if (hist->count == 0)
+            continue;
+        fprintf(out, "%s: %llu lines, mean %.1fus, max %.1fus\n", phase_names[phase],
+                (unsigned long long)hist->count, (double)hist->total_ns / hist->count / NS_PER_US,
+                (double)hist->max_ns / NS_PER_US);
+        for (int i = 0; i < PROFILE_BUCKETS; i++) {
+            if (hist->buckets[i] != 0)
+                fprintf(out, "  < %llu us\t%llu\n", 1ULL << (i + 1),
+                        (unsigned long long)hist->buckets[i]);
+        }
+    }
+}
@@ -17,7 +17,11 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-
+#define _GNU_SOURCE             // sigset_t
+#define VALERY_MEM_TAG MEM_PROMPT
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +31,9 @@
 #include "valery/valery.h"
 #include "valery/prompt.h"
 #include "valery/histfile.h"
+#include "valery/completion.h"
+#include "valery/event.h"
+#include "valery/segment.h"
 #include "lib/vstring.h"
 
 
@@ -35,6 +42,11 @@
 #define cursor_left(n) printf("\033[%dD", (n))
 #define cursor_goto(x) printf("\033[%d", (x))
 #define flush_line() printf("\33[2K\r")
+#define faint_on() printf("\033[2m")
+#define faint_off() printf("\033[0m")
+
+/* returned instead of a char when ctrl+c was pressed */
+#define PROMPT_INTERRUPTED (EOF - 1)
 
 
 /* types */
@@ -46,6 +58,7 @@ enum keycode_t {
     ARROW_RIGHT = 67,
     ARROW_LEFT = 68,
 
+    TAB = 9,
     BACKSPACE = 127
 };
 
@@ -76,26 +89,117 @@ static inline void prompt_term_end(struct termconf_t *termconf)
     tcsetattr(STDIN_FILENO, TCSANOW, &termconf->original);
 }
 
-static void prompt_start(struct prompt_t *prompt)
+static void prompt_update(struct prompt_t *prompt, char *ps1);
+
+static void prompt_read_input(void *arg, int fd)
+{
+    struct prompt_t *prompt = arg;
+    ssize_t n = read(fd, prompt->input, PROMPT_INPUT_BUF_SIZE);
+    if (n == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0) {
+        prompt->input_eof = true;
+        return;
+    }
+    prompt->input_pos = 0;
+    prompt->input_len = n;
+}
+
+/* a segment of PS1 got a fresh value */
+static void prompt_redraw(void *arg, int fd)
+{
+    (void)fd;
+    struct prompt_t *prompt = arg;
+    segment_clear_fd();
+    env_update_ps1(prompt->env);
+    prompt_update(prompt, prompt->env->ps1);
+}
+
+/* fresh segments that arrive after the deadline are left for the next prompt */
+static void prompt_deadline(void *arg, int fd)
+{
+    struct prompt_t *prompt = arg;
+    event_rm_fd(segment_fd());
+    event_rm_timer(fd);
+    prompt->deadline_timer = -1;
+}
+
+static void prompt_signal(void *arg, int signo)
+{
+    struct prompt_t *prompt = arg;
+    if (signo == SIGINT)
+        prompt->interrupted = true;
+    else if (signo == SIGWINCH)
+        prompt_update(prompt, prompt->env->ps1);
+}
+
+static void prompt_start(struct prompt_t *prompt, struct env_t *env)
 {
     prompt_term_init(prompt->termconf);
     prompt->buf_size = 0;
     prompt->cursor_position = 0;
+    prompt->suggestion = NULL;
+    prompt->env = env;
+    prompt->interrupted = false;
+    prompt->input_eof = false;
+
+    /* a ctrl+c pressed while the last command ran was not meant for this prompt */
+    event_run_once(0);
+    event_on_signal(SIGINT, prompt_signal, prompt);
+    event_on_signal(SIGWINCH, prompt_signal, prompt);
+    prompt->input_polled = event_add_fd(STDIN_FILENO, prompt_read_input, prompt) == 0;
+
+    char *deadline = env_get(env->env_vars, "PS1_DEADLINE");
+    long ms = deadline != NULL ? strtol(deadline, NULL, 10) : SEGMENT_DEFAULT_DEADLINE_MS;
+    prompt->deadline_timer = -1;
+    if (ms > 0 && event_add_fd(segment_fd(), prompt_redraw, prompt) == 0)
+        prompt->deadline_timer = event_add_timer(ms, prompt_deadline, prompt);
+}
+
+static void prompt_end(struct prompt_t *prompt)
+{
+    event_rm_fd(STDIN_FILENO);
+    event_rm_fd(segment_fd());
+    event_rm_timer(prompt->deadline_timer);
+    event_on_signal(SIGINT, NULL, NULL);
+    event_on_signal(SIGWINCH, NULL, NULL);
+    prompt_term_end(prompt->termconf);
+}
+
+/*
+ * returns the next char typed in, EOF, or PROMPT_INTERRUPTED if ctrl+c was pressed. while
+ * waiting, the event loop redraws the prompt when needed.
+ */
+static int prompt_getchar(struct prompt_t *prompt)
+{
+    while (prompt->input_pos == prompt->input_len && !prompt->interrupted && !prompt->input_eof) {
+        /* nothing is flushed for us, stdio is not used to read */
+        fflush(stdout);
+        if (prompt->input_polled)
+            event_run_once(-1);
+        else
+            prompt_read_input(prompt, STDIN_FILENO);
+    }
+    if (prompt->interrupted)
+        return PROMPT_INTERRUPTED;
+    if (prompt->input_pos == prompt->input_len)
+        return EOF;
+    return (unsigned char)prompt->input[prompt->input_pos++];
 }
 
 /* returns the type of arrow consumed from the terminal input buffer */
-static int get_arrow_type(void)
+static int get_arrow_type(struct prompt_t *prompt)
 {
     /*
        Arrow keys takes up three chars in the buffer.
        Only last char codes for up or down, so consume
        second char value.
      */
-    if (getchar() == ARROW_KEY_2)
-        return getchar();
+    if (prompt_getchar(prompt) == ARROW_KEY_2)
+        return prompt_getchar(prompt);
    
     /* consume and discard next char */
-    getchar();
+    prompt_getchar(prompt);
     return -1;
 }
 
@@ -130,19 +234,101 @@ static void prompt_update(struct prompt_t *prompt, char *ps1)
 {
     flush_line();
     prompt_print(prompt, ps1);
+    /* the rest of the suggestion is shown faint after the buffer, with the cursor before it */
+    if (prompt->suggestion != NULL) {
+        int len = strlen(prompt->suggestion + prompt->buf_size);
+        faint_on();
+        printf("%s", prompt->suggestion + prompt->buf_size);
+        faint_off();
+        if (len > 0)
+            cursor_left(len);
+    }
     /* move the terminal cursor to its corresponding position */
     if (prompt->cursor_position != prompt->buf_size)
         cursor_left(prompt->buf_size - prompt->cursor_position);
 }
 
+/* suggests a command from the history while the cursor is at the end of a non empty line */
+static void prompt_suggest(struct prompt_t *prompt, struct hist_t *hist)
+{
+    prompt->suggestion = NULL;
+    if (prompt->buf_size == 0 || prompt->cursor_position != prompt->buf_size)
+        return;
+    const char *suggestion = hist_suggest(hist, prompt->buf, prompt->buf_size);
+    if (suggestion != NULL && suggestion[prompt->buf_size] != 0)
+        prompt->suggestion = suggestion;
+}
+
 static void increase_buf_capacity(struct prompt_t *prompt)
 {
     prompt->buf_capacity = prompt->buf_capacity * 2;
     prompt->buf = vrealloc(prompt->buf, prompt->buf_capacity * sizeof(char));
 }
 
-void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1)
+/* inserts len chars from str at the cursor and moves the cursor past them */
+static void prompt_insert(struct prompt_t *prompt, const char *str, unsigned int len)
+{
+    while (prompt->buf_size + len >= prompt->buf_capacity)
+        increase_buf_capacity(prompt);
+
+    memmove(prompt->buf + prompt->cursor_position + len, prompt->buf + prompt->cursor_position,
+            prompt->buf_size - prompt->cursor_position);
+    memcpy(prompt->buf + prompt->cursor_position, str, len);
+    prompt->buf_size += len;
+    prompt->cursor_position += len;
+}
+
+/*
+ * returns true if the word starting at start is where a command name is expected, that is
+ * first on the line or right after one of the operators that start a new command.
+ */
+static bool is_command_position(struct prompt_t *prompt, unsigned int start)
+{
+    while (start > 0 && (prompt->buf[start - 1] == ' ' || prompt->buf[start - 1] == '\t'))
+        start--;
+    if (start == 0)
+        return true;
+    char c = prompt->buf[start - 1];
+    return c == '|' || c == '&' || c == ';' || c == '(' || c == '`';
+}
+
+/*
+ * completes the command name or path under the cursor. the first tab extends the word as far
+ * as it is unambiguous, a second tab in a row lists what it could be.
+ * words in command position are completed as command names unless they contain a '/'.
+ */
+static void prompt_complete(struct prompt_t *prompt, bool listing)
 {
+    char extension[MAX_COMMAND_LEN];
+    unsigned int start = prompt->cursor_position;
+    while (start > 0 && strchr(" \t|&;(`<>", prompt->buf[start - 1]) == NULL)
+        start--;
+
+    char *word = prompt->buf + start;
+    size_t len = prompt->cursor_position - start;
+    bool command = is_command_position(prompt, start) && memchr(word, '/', len) == NULL;
+    struct completion_t c = command ? complete_command(word, len, extension, sizeof(extension))
+                                    : complete_path(word, len, extension, sizeof(extension));
+    if (c.len > 0 || c.unique) {
+        prompt_insert(prompt, extension, c.len);
+        if (c.unique)
+            prompt_insert(prompt, c.directory ? "/" : " ", 1);
+        return;
+    }
+
+    if (!listing || c.candidates < 2)
+        return;
+    putchar('\n');
+    size_t listed = command ? completion_list(word, len, COMPLETION_MAX_LISTED, stdout)
+                            : completion_list_paths(word, len, COMPLETION_MAX_LISTED, stdout);
+    if (listed < c.candidates)
+        printf("... and %zu more\n", c.candidates - listed);
+}
+
+void prompt(struct prompt_t *prompt, struct hist_t *hist, struct env_t *env)
+{
+    char *ps1 = env->ps1;
+    bool last_was_tab = false;
     int ch;
     int arrow_type;
     enum readfrom_t read_from;
@@ -150,10 +336,10 @@ void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1)
 
     /* reset position in history to bottom of queue */
     hist_reset_pos(hist);
-    prompt_start(prompt);
+    prompt_start(prompt, env);
     prompt_print(prompt, ps1);
 
-    while (EOF != (ch = getchar()) && ch != '\n') {
+    while (EOF != (ch = prompt_getchar(prompt)) && ch != '\n' && ch != PROMPT_INTERRUPTED) {
 #ifdef DEBUG_PROMPT
         prompt_debug(prompt);
 #endif
@@ -163,6 +349,10 @@ void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1)
         }
 
         switch (ch) {
+            case TAB:
+                prompt_complete(prompt, last_was_tab);
+                break;
+
             case BACKSPACE:
                 if (prompt->cursor_position > 0) {
                     vstr_remove_idx(prompt->buf, prompt->buf_capacity, prompt->cursor_position);
@@ -172,7 +362,13 @@ void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1)
                 break;
 
             case ARROW_KEY:
-                arrow_type = get_arrow_type();
+                arrow_type = get_arrow_type(prompt);
+                /* right at the end of the line accepts the suggestion */
+                if (arrow_type == ARROW_RIGHT && prompt->suggestion != NULL) {
+                    const char *rest = prompt->suggestion + prompt->buf_size;
+                    prompt_insert(prompt, rest, strlen(rest));
+                    break;
+                }
                 if (arrow_type == ARROW_LEFT || arrow_type == ARROW_RIGHT) {
                     move_cursor_horizontally(prompt, arrow_type);
                     break;
@@ -189,8 +385,9 @@ void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1)
                     break;
                 } else if (read_from == READ_FROM_HIST) {
                     prompt->buf_size = strlen(prompt->buf);
-                    /* chop off newline character */
-                    prompt->buf[--prompt->buf_size] = 0;
+                    /* chop off newline character, a line at the end of the file may not have one */
+                    if (prompt->buf_size > 0 && prompt->buf[prompt->buf_size - 1] == '\n')
+                        prompt->buf[--prompt->buf_size] = 0;
                     prompt->cursor_position = prompt->buf_size;
                 } else if (read_from == READ_FROM_MEMORY) {
                     prompt->buf_size = strlen(prompt->buf);
@@ -209,9 +406,25 @@ void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1)
                     prompt->cursor_position++;
                 }
         }
+        last_was_tab = ch == TAB;
+        prompt_suggest(prompt, hist);
         prompt_update(prompt, ps1);
     }
 
+    /* the line is entered as typed, so the suggestion should not stay on the screen */
+    if (ch == PROMPT_INTERRUPTED)
+        prompt->cursor_position = prompt->buf_size;
+    if (prompt->suggestion != NULL || ch == PROMPT_INTERRUPTED) {
+        prompt->suggestion = NULL;
+        prompt_update(prompt, ps1);
+    }
+    /* ctrl+c throws the line away */
+    if (ch == PROMPT_INTERRUPTED) {
+        printf("^C");
+        prompt->buf_size = 0;
+        prompt->cursor_position = 0;
+    }
+
     //TODO: fix this
     /* add newline and sentinel byte */
     if (prompt->buf_size + 1 > prompt->buf_capacity)
@@ -220,7 +433,7 @@ void prompt(struct prompt_t *prompt, struct hist_t *hist, char *ps1)
     prompt->buf[prompt->buf_size++] = '\n';
     prompt->buf[prompt->buf_size] = 0;
     putchar('\n');
-    prompt_term_end(prompt->termconf);
+    prompt_end(prompt);
 }
 
 struct prompt_t *prompt_malloc(void)
@@ -231,14 +444,21 @@ struct prompt_t *prompt_malloc(void)
     prompt->buf_capacity = MAX_COMMAND_LEN;
     prompt->buf_size = 0;
     prompt->cursor_position = 0;
+    prompt->input_pos = 0;
+    prompt->input_len = 0;
+    prompt->input_polled = false;
+    prompt->input_eof = false;
+    prompt->env = NULL;
+    prompt->interrupted = false;
+    prompt->deadline_timer = -1;
 
     return prompt;
 }
 
 void prompt_free(struct prompt_t *prompt)
 {
-    free(prompt->buf);
-    free(prompt->termconf);
-    free(prompt);
+    vfree(prompt->buf);
+    vfree(prompt->termconf);
+    vfree(prompt);
 }
 
@@ -0,0 +1,297 @@
+/*
+ *  Attributes the wall time, cpu time and started processes of a script to the lines of its
+ *  statements, for 'valery --profile-script'. A statement includes everything it calls, so the
+ *  line calling a function is charged for its body as well, and the stacks of lines are kept
+ *  with their self time for flame graphs.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "valery/valery.h"
+#include "valery/profile.h"
+#include "valery/script_profile.h"
+#include "valery/table.h"
+
+#define NS_PER_US 1000
+
+
+/* types */
+struct script_line_t {
+    uint64_t runs;
+    uint64_t wall_ns;       /* including the statements it called */
+    uint64_t self_ns;       /* excluding them */
+    uint64_t cpu_us;        /* of the shell and of the programs it waited for */
+    uint64_t forks;
+};
+
+/* a statement that is running */
+struct script_frame_t {
+    size_t line;
+    uint64_t start_ns;
+    uint64_t start_cpu_us;
+    uint64_t start_forks;
+    uint64_t child_ns;      /* the wall time of the statements it called */
+};
+
+/* the self time of one stack of lines, outermost first */
+struct script_stack_t {
+    size_t *lines;
+    size_t depth;
+    uint64_t self_ns;
+};
+
+
+bool script_profile_enabled = false;
+
+static const char *script_name;
+static const char **line_starts = NULL;     /* index 0 is unused, lines count from 1 */
+static size_t lines_len = 0;
+static struct script_line_t *line_stats = NULL;
+
+static uint64_t start_ns;
+static uint64_t start_cpu_us;
+static uint64_t forks = 0;
+
+static struct script_frame_t *frames = NULL;
+static size_t frames_len = 0;
+static size_t frames_capacity = 0;
+
+static struct table_t stacks = TABLE_INIT(struct script_stack_t,
+                                          SCRIPT_PROFILE_STARTING_CAPACITY);
+
+
+static uint64_t timeval_us(struct timeval tv)
+{
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* children only count once they are waited for, which every statement does before it ends */
+static uint64_t cpu_now(void)
+{
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    return timeval_us(self.ru_utime) + timeval_us(self.ru_stime) +
+           timeval_us(children.ru_utime) + timeval_us(children.ru_stime);
+}
+
+void script_profile_init(const char *path, const char *source)
+{
+    const char *slash = strrchr(path, '/');
+    script_name = slash != NULL ? slash + 1 : path;
+
+    lines_len = 1;
+    for (const char *c = source; *c != 0; c++)
+        lines_len += *c == '\n';
+    line_starts = vmalloc((lines_len + 1) * sizeof(const char *));
+    line_starts[0] = NULL;
+    line_starts[1] = source;
+    size_t line = 2;
+    for (const char *c = source; *c != 0; c++) {
+        if (*c == '\n')
+            line_starts[line++] = c + 1;
+    }
+    line_stats = vcalloc(lines_len + 1, sizeof(struct script_line_t));
+
+    start_ns = profile_now();
+    start_cpu_us = cpu_now();
+    script_profile_enabled = true;
+}
+
+void script_profile_push(size_t line)
+{
+    if (frames_len == frames_capacity) {
+        frames_capacity = frames_capacity == 0 ? SCRIPT_PROFILE_STARTING_CAPACITY
+                                               : frames_capacity * 2;
+        frames = vrealloc(frames, frames_capacity * sizeof(struct script_frame_t));
+    }
+    frames[frames_len++] = (struct script_frame_t){ .line = line, .start_ns = profile_now(),
+                                                    .start_cpu_us = cpu_now(),
+                                                    .start_forks = forks };
+}
+
+/* the stack is frames[0] to frames[depth - 1] */
+static uint64_t stack_hash(size_t depth)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < depth; i++)
+        hash = (hash ^ frames[i].line) * 1099511628211ULL;
+    return hash;
+}
+
+/* the key is the depth of the stack of frames */
+static bool stack_eq(const void *item, const void *key)
+{
+    const struct script_stack_t *stack = item;
+    size_t depth = *(const size_t *)key;
+    if (stack->depth != depth)
+        return false;
+    for (size_t i = 0; i < depth; i++) {
+        if (stack->lines[i] != frames[i].line)
+            return false;
+    }
+    return true;
+}
+
+static void stack_add(size_t depth, uint64_t self_ns)
+{
+    bool added;
+    struct script_stack_t *stack = table_put(&stacks, stack_hash(depth), &depth, stack_eq,
+                                             &added);
+    if (added) {
+        stack->lines = vmalloc(depth * sizeof(size_t));
+        for (size_t i = 0; i < depth; i++)
+            stack->lines[i] = frames[i].line;
+        stack->depth = depth;
+    }
+    stack->self_ns += self_ns;
+}
+
+void script_profile_pop(void)
+{
+    if (frames_len == 0)
+        return;
+
+    struct script_frame_t *frame = &frames[frames_len - 1];
+    uint64_t wall_ns = profile_now() - frame->start_ns;
+    uint64_t self_ns = wall_ns - frame->child_ns;
+    stack_add(frames_len, self_ns);
+    frames_len--;
+    if (frames_len > 0)
+        frames[frames_len - 1].child_ns += wall_ns;
+
+    if (frame->line == 0 || frame->line > lines_len)
+        return;
+    struct script_line_t *stats = &line_stats[frame->line];
+    stats->runs++;
+    stats->self_ns += self_ns;
+    /* a line that recursively calls itself is already charged by its outermost run */
+    for (size_t i = 0; i < frames_len; i++) {
+        if (frames[i].line == frame->line)
+            return;
+    }
+    stats->wall_ns += wall_ns;
+    stats->cpu_us += cpu_now() - frame->start_cpu_us;
+    stats->forks += forks - frame->start_forks;
+}
+
+void script_profile_spawned(void)
+{
+    forks++;
+}
+
+/*
+ * copies the source of line without leading whitespace into buf, cut at
+ * SCRIPT_PROFILE_TEXT_MAX bytes. ';' is replaced in frames, where it separates them.
+ * @returns false for blank lines and comments, which only hold empty statements
+ */
+static bool line_text(size_t line, char buf[SCRIPT_PROFILE_TEXT_MAX + 1], bool frame)
+{
+    size_t len = 0;
+    if (line != 0 && line <= lines_len) {
+        const char *c = line_starts[line];
+        while (*c == ' ' || *c == '\t')
+            c++;
+        for (; c[len] != 0 && c[len] != '\n' && len < SCRIPT_PROFILE_TEXT_MAX; len++)
+            buf[len] = frame && c[len] == ';' ? ',' : c[len];
+    }
+    buf[len] = 0;
+    return len > 0 && buf[0] != '#';
+}
+
+static int wall_cmp(const void *a, const void *b)
+{
+    uint64_t x = line_stats[*(const size_t *)a].wall_ns;
+    uint64_t y = line_stats[*(const size_t *)b].wall_ns;
+    return (x < y) - (x > y);
+}
+
+void script_profile_report(FILE *out, size_t top)
+{
+    if (!script_profile_enabled)
+        return;
+
+    uint64_t total_ns = profile_now() - start_ns;
+    fprintf(out, "profile of %s: %.3fms wall, %.3fms cpu, %llu processes started\n", script_name,
+            (double)total_ns / 1000000, (cpu_now() - start_cpu_us) / 1000.0,
+            (unsigned long long)forks);
+
+    char text[SCRIPT_PROFILE_TEXT_MAX + 1];
+    size_t *sorted = vmalloc(lines_len * sizeof(size_t));
+    size_t len = 0;
+    for (size_t line = 1; line <= lines_len; line++) {
+        if (line_stats[line].runs != 0 && line_text(line, text, false))
+            sorted[len++] = line;
+    }
+    qsort(sorted, len, sizeof(size_t), wall_cmp);
+
+    fprintf(out, "%6s %8s %12s %6s %12s %12s %6s  %s\n", "line", "runs", "wall", "%", "self",
+            "cpu", "forks", "source");
+    for (size_t i = 0; i < top && i < len; i++) {
+        struct script_line_t *s = &line_stats[sorted[i]];
+        line_text(sorted[i], text, false);
+        fprintf(out, "%6zu %8llu %10.3fms %5.1f%% %10.3fms %10.3fms %6llu  %s\n", sorted[i],
+                (unsigned long long)s->runs, (double)s->wall_ns / 1000000,
+                total_ns == 0 ? 0.0 : 100.0 * s->wall_ns / total_ns,
+                (double)s->self_ns / 1000000, s->cpu_us / 1000.0,
+                (unsigned long long)s->forks, text);
+    }
+    vfree(sorted);
+}
+
+void script_profile_collapsed(FILE *out)
+{
+    char text[SCRIPT_PROFILE_TEXT_MAX + 1];
+    struct script_stack_t *stack;
+    for (size_t i = 0; (stack = table_next(&stacks, &i)) != NULL;) {
+        if (stack->self_ns < NS_PER_US ||
+            !line_text(stack->lines[stack->depth - 1], text, true))
+            continue;
+
+        fputs(script_name, out);
+        for (size_t j = 0; j < stack->depth; j++) {
+            line_text(stack->lines[j], text, true);
+            fprintf(out, ";%zu: %s", stack->lines[j], text);
+        }
+        fprintf(out, " %llu\n", (unsigned long long)(stack->self_ns / NS_PER_US));
+    }
+}
+
+void script_profile_free(void)
+{
+    struct script_stack_t *stack;
+    for (size_t i = 0; (stack = table_next(&stacks, &i)) != NULL;)
+        vfree(stack->lines);
+    table_free(&stacks);
+
+    vfree(frames);
+    frames = NULL;
+    frames_len = frames_capacity = 0;
+
+    vfree(line_starts);
+    vfree(line_stats);
+    line_starts = NULL;
+    line_stats = NULL;
+    lines_len = 0;
+    forks = 0;
+    script_profile_enabled = false;
+}
@@ -0,0 +1,180 @@
+/*
+ *  Computes the slow parts of PS1 in the background, so the prompt is drawn without waiting
+ *  for them and redrawn when they are ready.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // PATH_MAX
+#define VALERY_MEM_TAG MEM_PROMPT
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "valery/valery.h"
+#include "valery/git.h"
+#include "valery/segment.h"
+
+
+/* types */
+struct segment_t {
+    char pwd[PATH_MAX];     /* the directory value was computed in, empty if never */
+    char value[SEGMENT_MAX];
+};
+
+
+/* guards everything below that is shared between the prompt and the segment thread */
+static pthread_mutex_t segment_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t segment_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t segment_thread;
+static bool segment_running = false;
+static bool stop_requested = false;
+static bool request_pending = false;
+static bool requested[SEGMENT_COUNT];
+static char request_pwd[PATH_MAX];
+static struct segment_t segments[SEGMENT_COUNT];
+/* what segment_get() last returned */
+static char rendered[SEGMENT_COUNT][SEGMENT_MAX];
+
+static int notify_fd = -1;
+
+
+/* only called from one thread at a time, git.c keeps its cache without locking */
+static void segment_compute(enum segment_kind_t kind, const char *pwd, char value[SEGMENT_MAX])
+{
+    const char *res = NULL;
+    switch (kind) {
+        case SEGMENT_GIT:
+            res = git_prompt(pwd, false);
+            break;
+        case SEGMENT_GIT_DIRTY:
+            res = git_prompt(pwd, true);
+            break;
+        case SEGMENT_COUNT:
+            break;
+    }
+    snprintf(value, SEGMENT_MAX, "%s", res == NULL ? "" : res);
+}
+
+static void *segment_worker(void *arg)
+{
+    (void)arg;
+    char pwd[PATH_MAX];
+    char value[SEGMENT_MAX];
+    bool wanted[SEGMENT_COUNT];
+
+    pthread_mutex_lock(&segment_lock);
+    while (1) {
+        while (!request_pending && !stop_requested)
+            pthread_cond_wait(&segment_cond, &segment_lock);
+        if (stop_requested)
+            break;
+        request_pending = false;
+        memcpy(pwd, request_pwd, PATH_MAX);
+        memcpy(wanted, requested, sizeof(wanted));
+        memset(requested, 0, sizeof(requested));
+        pthread_mutex_unlock(&segment_lock);
+
+        bool changed = false;
+        for (int kind = 0; kind < SEGMENT_COUNT; kind++) {
+            if (!wanted[kind])
+                continue;
+            segment_compute(kind, pwd, value);
+
+            pthread_mutex_lock(&segment_lock);
+            memcpy(segments[kind].pwd, pwd, PATH_MAX);
+            memcpy(segments[kind].value, value, SEGMENT_MAX);
+            /* a newer request is computed next, the prompt is only redrawn for that one */
+            if (!request_pending && strcmp(rendered[kind], value) != 0)
+                changed = true;
+            pthread_mutex_unlock(&segment_lock);
+        }
+
+        if (changed)
+            (void)!eventfd_write(notify_fd, 1);
+        pthread_mutex_lock(&segment_lock);
+    }
+    pthread_mutex_unlock(&segment_lock);
+    return NULL;
+}
+
+void segment_init(void)
+{
+    notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (notify_fd == -1)
+        return;
+    if (pthread_create(&segment_thread, NULL, segment_worker, NULL) != 0) {
+        valery_error("could not start the segment thread, the prompt waits for every segment");
+        close(notify_fd);
+        notify_fd = -1;
+        return;
+    }
+    segment_running = true;
+}
+
+void segment_free(void)
+{
+    if (segment_running) {
+        pthread_mutex_lock(&segment_lock);
+        stop_requested = true;
+        pthread_cond_signal(&segment_cond);
+        pthread_mutex_unlock(&segment_lock);
+        pthread_join(segment_thread, NULL);
+        segment_running = false;
+    }
+    if (notify_fd != -1)
+        close(notify_fd);
+    notify_fd = -1;
+    git_free();
+}
+
+const char *segment_get(enum segment_kind_t kind, const char *pwd)
+{
+    if (pwd == NULL)
+        pwd = "";
+    if (!segment_running) {
+        segment_compute(kind, pwd, rendered[kind]);
+        return rendered[kind];
+    }
+
+    pthread_mutex_lock(&segment_lock);
+    struct segment_t *segment = &segments[kind];
+    /* the value from another directory would be wrong, not just old */
+    snprintf(rendered[kind], SEGMENT_MAX, "%s",
+             strcmp(segment->pwd, pwd) == 0 ? segment->value : "");
+    snprintf(request_pwd, PATH_MAX, "%s", pwd);
+    requested[kind] = true;
+    request_pending = true;
+    pthread_cond_signal(&segment_cond);
+    pthread_mutex_unlock(&segment_lock);
+    return rendered[kind];
+}
+
+int segment_fd(void)
+{
+    return notify_fd;
+}
+
+void segment_clear_fd(void)
+{
+    eventfd_t count;
+    if (notify_fd != -1)
+        (void)!eventfd_read(notify_fd, &count);
+}
@@ -0,0 +1,117 @@
+/*
+ *  Accounts the resources every started program used, per command name.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // strdup
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "valery/valery.h"
+#include "valery/env.h"
+#include "valery/stats.h"
+#include "valery/table.h"
+
+
+/* entries are never removed */
+static struct table_t entries = TABLE_INIT(struct stats_entry_t, STATS_STARTING_CAPACITY);
+
+
+static bool stats_eq(const void *item, const void *key)
+{
+    return strcmp(((const struct stats_entry_t *)item)->name, key) == 0;
+}
+
+static uint64_t timeval_us(struct timeval tv)
+{
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void stats_record(const char *name, struct rusage *usage)
+{
+    bool added;
+    struct stats_entry_t *entry = table_put(&entries, env_hash(name, strlen(name)), name,
+                                            stats_eq, &added);
+    if (added)
+        entry->name = strdup(name);
+
+    entry->runs++;
+    entry->user_us += timeval_us(usage->ru_utime);
+    entry->sys_us += timeval_us(usage->ru_stime);
+    entry->max_rss_kb = MAX(entry->max_rss_kb, usage->ru_maxrss);
+    entry->ctx_switches += usage->ru_nvcsw + usage->ru_nivcsw;
+}
+
+static int cpu_cmp(const void *a, const void *b)
+{
+    const struct stats_entry_t *x = a;
+    const struct stats_entry_t *y = b;
+    uint64_t x_cpu = x->user_us + x->sys_us;
+    uint64_t y_cpu = y->user_us + y->sys_us;
+    return (x_cpu < y_cpu) - (x_cpu > y_cpu);
+}
+
+static int rss_cmp(const void *a, const void *b)
+{
+    const struct stats_entry_t *x = a;
+    const struct stats_entry_t *y = b;
+    return (x->max_rss_kb < y->max_rss_kb) - (x->max_rss_kb > y->max_rss_kb);
+}
+
+static void stats_print_sorted(FILE *out, struct stats_entry_t *sorted, size_t len, size_t top)
+{
+    fprintf(out, "%8s %12s %12s %12s %10s  %s\n", "runs", "user", "sys", "max rss", "ctxsw",
+            "command");
+    for (size_t i = 0; i < top && i < len; i++) {
+        struct stats_entry_t *e = &sorted[i];
+        fprintf(out, "%8llu %10.3fms %10.3fms %10ldkB %10llu  %s\n", (unsigned long long)e->runs,
+                e->user_us / 1000.0, e->sys_us / 1000.0, e->max_rss_kb,
+                (unsigned long long)e->ctx_switches, e->name);
+    }
+}
+
+void stats_print(FILE *out, size_t top)
+{
+    if (entries.len == 0)
+        return;
+
+    struct stats_entry_t *sorted = vmalloc(entries.len * sizeof(struct stats_entry_t));
+    size_t len = 0;
+    struct stats_entry_t *entry;
+    for (size_t i = 0; (entry = table_next(&entries, &i)) != NULL;)
+        sorted[len++] = *entry;
+
+    fprintf(out, "top by cpu time:\n");
+    qsort(sorted, len, sizeof(struct stats_entry_t), cpu_cmp);
+    stats_print_sorted(out, sorted, len, top);
+
+    fprintf(out, "\ntop by memory:\n");
+    qsort(sorted, len, sizeof(struct stats_entry_t), rss_cmp);
+    stats_print_sorted(out, sorted, len, top);
+    vfree(sorted);
+}
+
+void stats_free(void)
+{
+    struct stats_entry_t *entry;
+    for (size_t i = 0; (entry = table_next(&entries, &i)) != NULL;)
+        vfree(entry->name);
+    table_free(&entries);
+}
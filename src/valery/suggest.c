@@ -0,0 +1,144 @@
+/*
+ *  Suggests the command from the history that the line being typed most likely ends up as,
+ *  ranked by how often and how recently it was used.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define VALERY_MEM_TAG MEM_HISTORY
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "valery/valery.h"
+#include "valery/suggest.h"
+
+
+static uint32_t node_new(struct suggest_t *suggest, char c)
+{
+    if (suggest->nodes_len == suggest->nodes_capacity) {
+        suggest->nodes_capacity *= 2;
+        suggest->nodes = vrealloc(suggest->nodes,
+                                  suggest->nodes_capacity * sizeof(struct suggest_node_t));
+    }
+    suggest->nodes[suggest->nodes_len] = (struct suggest_node_t){
+        .first_child = SUGGEST_NONE, .next_sibling = SUGGEST_NONE, .best = SUGGEST_NONE,
+        .entry = SUGGEST_NONE, .c = c
+    };
+    return suggest->nodes_len++;
+}
+
+static uint32_t child_find(struct suggest_t *suggest, uint32_t node, char c)
+{
+    uint32_t child = suggest->nodes[node].first_child;
+    while (child != SUGGEST_NONE && suggest->nodes[child].c != c)
+        child = suggest->nodes[child].next_sibling;
+    return child;
+}
+
+static uint32_t entry_new(struct suggest_t *suggest, const char *command, size_t len)
+{
+    if (suggest->entries_len == suggest->entries_capacity) {
+        suggest->entries_capacity *= 2;
+        suggest->entries = vrealloc(suggest->entries,
+                                    suggest->entries_capacity * sizeof(struct suggest_entry_t));
+    }
+    char *copy = vmalloc(len + 1);
+    memcpy(copy, command, len);
+    copy[len] = 0;
+    suggest->entries[suggest->entries_len] = (struct suggest_entry_t){ .command = copy,
+                                                                       .score = -INFINITY };
+    return suggest->entries_len++;
+}
+
+/* log2(2^a + 2^b) without leaving the log domain, the exponents are far too large for a double */
+static double log2_add(double a, double b)
+{
+    double hi = a > b ? a : b;
+    double lo = a > b ? b : a;
+    if (lo == -INFINITY)
+        return hi;
+    return hi + log2(1.0 + exp2(lo - hi));
+}
+
+void suggest_add(struct suggest_t *suggest, const char *command, size_t len, int64_t time)
+{
+    if (len == 0)
+        return;
+
+    uint32_t path[len + 1];
+    uint32_t node = 0;
+    path[0] = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint32_t child = child_find(suggest, node, command[i]);
+        if (child == SUGGEST_NONE) {
+            child = node_new(suggest, command[i]);
+            suggest->nodes[child].next_sibling = suggest->nodes[node].first_child;
+            suggest->nodes[node].first_child = child;
+        }
+        node = child;
+        path[i + 1] = node;
+    }
+
+    if (suggest->nodes[node].entry == SUGGEST_NONE)
+        suggest->nodes[node].entry = entry_new(suggest, command, len);
+    uint32_t entry = suggest->nodes[node].entry;
+    struct suggest_entry_t *e = &suggest->entries[entry];
+    e->score = log2_add(e->score, (double)time / SUGGEST_HALF_LIFE);
+
+    /* scores only ever grow, so the entry is the best of every subtree it beats */
+    for (size_t i = 0; i <= len; i++) {
+        struct suggest_node_t *n = &suggest->nodes[path[i]];
+        if (n->best == SUGGEST_NONE || n->best == entry ||
+            suggest->entries[n->best].score < e->score)
+            n->best = entry;
+    }
+}
+
+const char *suggest_get(struct suggest_t *suggest, const char *prefix, size_t len)
+{
+    uint32_t node = 0;
+    for (size_t i = 0; i < len && node != SUGGEST_NONE; i++)
+        node = child_find(suggest, node, prefix[i]);
+    if (node == SUGGEST_NONE || suggest->nodes[node].best == SUGGEST_NONE)
+        return NULL;
+    return suggest->entries[suggest->nodes[node].best].command;
+}
+
+struct suggest_t *suggest_malloc(void)
+{
+    struct suggest_t *suggest = vmalloc(sizeof(struct suggest_t));
+    suggest->nodes_len = 0;
+    suggest->nodes_capacity = SUGGEST_STARTING_CAPACITY;
+    suggest->nodes = vmalloc(suggest->nodes_capacity * sizeof(struct suggest_node_t));
+    suggest->entries_len = 0;
+    suggest->entries_capacity = SUGGEST_STARTING_CAPACITY;
+    suggest->entries = vmalloc(suggest->entries_capacity * sizeof(struct suggest_entry_t));
+    /* the root, the empty prefix */
+    node_new(suggest, 0);
+    return suggest;
+}
+
+void suggest_free(struct suggest_t *suggest)
+{
+    if (suggest == NULL)
+        return;
+    for (uint32_t i = 0; i < suggest->entries_len; i++)
+        vfree(suggest->entries[i].command);
+    vfree(suggest->entries);
+    vfree(suggest->nodes);
+    vfree(suggest);
+}
@@ -0,0 +1,181 @@
+/*
+ *  The hash table the caches and counters of the shell keep their items in. The environment and
+ *  the aliases have their own table in env.c, as it keeps its entries in insertion order.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "valery/valery.h"
+#include "valery/table.h"
+
+
+/* a key that hashes to TABLE_SLOT_EMPTY is stored under another hash */
+static uint64_t slot_hash(uint64_t hash)
+{
+    return hash == TABLE_SLOT_EMPTY ? 1 : hash;
+}
+
+static char *item_at(struct table_t *table, size_t i)
+{
+    return table->items + i * table->item_size;
+}
+
+static void *table_calloc(struct table_t *table, size_t nitems, size_t size)
+{
+    if (table->uncounted)
+        return calloc(nitems, size);
+#ifdef VALERY_MEMSTATS
+    return _vcalloc(nitems, size, table->tag);
+#else
+    return vcalloc(nitems, size);
+#endif
+}
+
+static void table_dealloc(struct table_t *table, void *ptr)
+{
+    if (table->uncounted)
+        free(ptr);
+    else
+        vfree(ptr);
+}
+
+/* returns the slot that holds key, or the empty slot it would be added in */
+static size_t table_find(struct table_t *table, uint64_t hash, const void *key, table_eq_t eq)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+    for (; table->hashes[i] != TABLE_SLOT_EMPTY; i = (i + 1) & mask) {
+        if (table->hashes[i] == hash && eq(item_at(table, i), key))
+            break;
+    }
+    return i;
+}
+
+static bool table_grow(struct table_t *table)
+{
+    size_t capacity = table->capacity == 0 ? table->starting_capacity : table->capacity * 2;
+    uint64_t *hashes = table_calloc(table, capacity, sizeof(uint64_t));
+    char *items = table_calloc(table, capacity, table->item_size);
+    if (hashes == NULL || items == NULL) {
+        table_dealloc(table, hashes);
+        table_dealloc(table, items);
+        return false;
+    }
+
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->hashes[i] == TABLE_SLOT_EMPTY)
+            continue;
+        size_t j = table->hashes[i] & mask;
+        while (hashes[j] != TABLE_SLOT_EMPTY)
+            j = (j + 1) & mask;
+        hashes[j] = table->hashes[i];
+        memcpy(items + j * table->item_size, item_at(table, i), table->item_size);
+    }
+    table_dealloc(table, table->hashes);
+    table_dealloc(table, table->items);
+    table->hashes = hashes;
+    table->items = items;
+    table->capacity = capacity;
+    return true;
+}
+
+void *table_get(struct table_t *table, uint64_t hash, const void *key, table_eq_t eq)
+{
+    if (table->len == 0)
+        return NULL;
+
+    size_t i = table_find(table, slot_hash(hash), key, eq);
+    return table->hashes[i] == TABLE_SLOT_EMPTY ? NULL : item_at(table, i);
+}
+
+void *table_put(struct table_t *table, uint64_t hash, const void *key, table_eq_t eq,
+                bool *added)
+{
+    hash = slot_hash(hash);
+    *added = false;
+    if (table->capacity > 0) {
+        size_t i = table_find(table, hash, key, eq);
+        if (table->hashes[i] != TABLE_SLOT_EMPTY)
+            return item_at(table, i);
+    }
+
+    if ((table->len + 1) * 2 > table->capacity && !table_grow(table))
+        return NULL;
+    size_t i = table_find(table, hash, key, eq);
+    table->hashes[i] = hash;
+    memset(item_at(table, i), 0, table->item_size);
+    table->len++;
+    *added = true;
+    return item_at(table, i);
+}
+
+void table_rm(struct table_t *table, void *item)
+{
+    size_t mask = table->capacity - 1;
+    size_t hole = ((char *)item - table->items) / table->item_size;
+    size_t i = hole;
+    while (1) {
+        i = (i + 1) & mask;
+        if (table->hashes[i] == TABLE_SLOT_EMPTY)
+            break;
+        size_t home = table->hashes[i] & mask;
+        /* the item can fill the hole if the hole lies between its home slot and it */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->hashes[hole] = table->hashes[i];
+            memcpy(item_at(table, hole), item_at(table, i), table->item_size);
+            hole = i;
+        }
+    }
+    table->hashes[hole] = TABLE_SLOT_EMPTY;
+    table->len--;
+}
+
+void table_filter(struct table_t *table, bool (*keep)(void *item, void *arg), void *arg)
+{
+    /*
+     * removing an item may move a later one into its slot, so the slot is checked again.
+     * an item moved from the start of the table to the end has already been kept.
+     */
+    for (size_t i = 0; i < table->capacity;) {
+        if (table->hashes[i] != TABLE_SLOT_EMPTY && !keep(item_at(table, i), arg))
+            table_rm(table, item_at(table, i));
+        else
+            i++;
+    }
+}
+
+void *table_next(struct table_t *table, size_t *i)
+{
+    for (; *i < table->capacity; (*i)++) {
+        if (table->hashes[*i] != TABLE_SLOT_EMPTY)
+            return item_at(table, (*i)++);
+    }
+    return NULL;
+}
+
+void table_free(struct table_t *table)
+{
+    table_dealloc(table, table->hashes);
+    table_dealloc(table, table->items);
+    table->hashes = NULL;
+    table->items = NULL;
+    table->len = table->capacity = 0;
+}
@@ -0,0 +1,87 @@
+/*
+ *  Records every executed command, its expanded argv, exit code and duration into a ring
+ *  buffer that the trace builtin can dump, and optionally streams them to a file descriptor.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // dprintf
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "valery/profile.h"
+#include "valery/trace.h"
+
+#define NS_PER_MS 1000000.0
+
+
+bool trace_enabled = false;
+
+static struct trace_entry_t entries[TRACE_CAPACITY];
+/* the amount of entries ever recorded, the next one goes into entries[seq % TRACE_CAPACITY] */
+static uint64_t seq = 0;
+static int stream_fd = -1;
+
+
+/* joins argv by spaces into dst, cut off at TRACE_ARGV_MAX - 1 chars */
+static void argv_join(char dst[TRACE_ARGV_MAX], int argc, char **argv)
+{
+    size_t len = 0;
+    for (int i = 0; i < argc && len < TRACE_ARGV_MAX - 1; i++) {
+        if (i > 0)
+            dst[len++] = ' ';
+        size_t arg_len = strnlen(argv[i], TRACE_ARGV_MAX - 1 - len);
+        memcpy(dst + len, argv[i], arg_len);
+        len += arg_len;
+    }
+    dst[len] = 0;
+}
+
+#define TRACE_FORMAT "+ %-6llu %9.3fms  %3d  %s\n"
+#define TRACE_ARGS(e) (unsigned long long)(e)->seq, (e)->duration_ns / NS_PER_MS, (e)->exit_code, \
+                      (e)->argv
+
+void trace_record(int argc, char **argv, int exit_code, uint64_t start)
+{
+    struct trace_entry_t *entry = &entries[seq & (TRACE_CAPACITY - 1)];
+    entry->seq = seq++;
+    entry->duration_ns = profile_now() - start;
+    entry->exit_code = exit_code;
+    argv_join(entry->argv, argc, argv);
+
+    if (stream_fd != -1 && dprintf(stream_fd, TRACE_FORMAT, TRACE_ARGS(entry)) < 0)
+        stream_fd = -1;
+}
+
+void trace_dump(FILE *out)
+{
+    uint64_t first = seq > TRACE_CAPACITY ? seq - TRACE_CAPACITY : 0;
+    for (uint64_t i = first; i < seq; i++) {
+        struct trace_entry_t *entry = &entries[i & (TRACE_CAPACITY - 1)];
+        fprintf(out, TRACE_FORMAT, TRACE_ARGS(entry));
+    }
+}
+
+void trace_clear(void)
+{
+    seq = 0;
+}
+
+void trace_stream(int fd)
+{
+    stream_fd = fd;
+}
@@ -16,72 +16,86 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
-
+#define _GNU_SOURCE             // sigset_t
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
-#include <signal.h>
 
 #include "valery/env.h"
 #include "valery/prompt.h"
+#include "valery/completion.h"
+#include "valery/watch.h"
+#include "valery/event.h"
+#include "valery/profile.h"
+#include "valery/script_profile.h"
+#include "valery/stats.h"
+#include "valery/segment.h"
 #include "valery/interpreter/lexer.h"
 #include "valery/interpreter/parser.h"
 #include "valery/interpreter/interpreter.h"
 #include "valery/interpreter/parser_utils.h"
+#include "valery/interpreter/impl/glob.h"
 #include "builtins/builtins.h"
 
 
-static volatile int received_sigint = 0;
-
-
-static inline void catch_sigint(int signal)
-{
-    if (signal == SIGINT)
-        received_sigint = 1;
-}
-
 static int valery_interpret(char *source)
 {
     ast_arena_init();
+    uint64_t start = profile_begin();
     struct tokenlist_t *tl = tokenize(source);
+    profile_end(PROFILE_TOKENIZE, start);
 #ifdef DEBUG_INTERPRETER
     tokenlist_print(tl);
 #endif
 
+    start = profile_begin();
     struct darr_t *statements = parse(tl);
+    profile_end(PROFILE_PARSE, start);
     darr_get_size(statements);
 
 #ifdef DEBUG_INTERPRETER
     ast_print(statements);
 
 #endif
+    start = profile_begin();
     int rc = interpret(statements);
+    profile_end(PROFILE_INTERPRET, start);
+    profile_line_end();
     //tokenlist_free(tl);
+    glob_cache_clear();
     ast_arena_release();
     return rc;
 }
 
 static int valery(char *source)
 {
+    profile_init();
     struct env_t *env = env_init();
+    /* watching directories only pays off when the shell outlives a single command line */
+    if (source == NULL) {
+        /* before any thread is started, so only the event loop receives the signals */
+        event_init();
+        watch_init();
+    }
+    interpret_init(env);
 
     if (source != NULL) {
+        builtins_init(env, NULL);
         valery_interpret(source);
     } else {
         /* interactive mode */
         struct hist_t *hist = hist_init(env_get(env->env_vars, "HOME"));
         struct prompt_t *p = prompt_malloc();
-        signal(SIGINT, catch_sigint);
+        builtins_init(env, hist);
+        completion_init(env->paths);
+        segment_init();
 
         /* main loop */
         while (1) {
             env_update(env);
-            prompt(p, hist, env->ps1);
-            /* skip exec if ctrl+c is caught */
-            if (received_sigint) {
-                received_sigint = 0;
-                signal(SIGINT, catch_sigint);
-                continue;
-            }
+            completion_refresh(env_get(env->env_vars, "PWD"));
+            prompt(p, hist, env);
             hist_save(hist, p->buf);
             if (strcmp(p->buf, "\n") == 0)
                 continue;
@@ -89,25 +103,97 @@ static int valery(char *source)
                 break;
 
             /* loop enters here means "ordinary" commands were typed in */
-            valery_interpret(p->buf);
+            hist_finish(hist, valery_interpret(p->buf));
         }
 
         /* free and write to file before exiting */
         hist_write(hist);
         hist_free(hist);
         prompt_free(p);
+        completion_free();
     }
 
+    profile_report(stderr);
+    stats_free();
+    interpret_free();
+    segment_free();
+    watch_free();
+    event_free();
     env_free(env);
     return 0;
 }
 
+/* @returns the contents of the file at path, or NULL if it could not be read */
+static char *read_file(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return NULL;
+
+    size_t len = 0;
+    size_t capacity = KB(4);
+    char *source = vmalloc(capacity);
+    size_t n;
+    while ((n = fread(source + len, 1, capacity - len - 1, fp)) > 0) {
+        len += n;
+        if (len + 1 == capacity) {
+            capacity *= 2;
+            source = vrealloc(source, capacity);
+        }
+    }
+    bool failed = ferror(fp);
+    fclose(fp);
+    if (failed) {
+        vfree(source);
+        return NULL;
+    }
+    source[len] = 0;
+    return source;
+}
+
+/*
+ * runs the script at path with every statement measured, then prints the hottest lines to
+ * stderr and writes the collapsed stacks next to the script.
+ */
+static int valery_profile_script(const char *path)
+{
+    char *source = read_file(path);
+    if (source == NULL) {
+        fprintf(stderr, "valery: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    script_profile_init(path, source);
+    int rc = valery(source);
+    script_profile_report(stderr, SCRIPT_PROFILE_DEFAULT_TOP);
+
+    char folded_path[strlen(path) + sizeof(SCRIPT_PROFILE_FOLDED_SUFFIX)];
+    sprintf(folded_path, "%s%s", path, SCRIPT_PROFILE_FOLDED_SUFFIX);
+    FILE *folded = fopen(folded_path, "w");
+    if (folded != NULL) {
+        script_profile_collapsed(folded);
+        fclose(folded);
+        fprintf(stderr, "collapsed stacks written to %s\n", folded_path);
+    } else {
+        fprintf(stderr, "valery: %s: %s\n", folded_path, strerror(errno));
+    }
+
+    script_profile_free();
+    vfree(source);
+    return rc;
+}
+
 int main(int argc, char *argv[])
 {
     //TODO: proper arg parsing
+    if (argc > 1 && strcmp(argv[1], "--profile") == 0) {
+        profile_enabled = true;
+        argc--;
+        argv++;
+    }
     if (argc > 1) {
         if (strcmp(argv[1], "--help") == 0) {
-            help();
+            help(stdout);
             return 0;
         }
         if (strcmp(argv[1], "--license") == 0) {
@@ -121,6 +207,13 @@ int main(int argc, char *argv[])
             }
             return valery(argv[2]);
         }
+        if (strcmp(argv[1], "--profile-script") == 0) {
+            if (argc == 2) {
+                printf("valery: '--profile-script' option requires an argument\n");
+                return 1;
+            }
+            return valery_profile_script(argv[2]);
+        }
     }
 
     return valery(NULL);
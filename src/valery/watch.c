@@ -0,0 +1,194 @@
+/*
+ *  Tells interested parts of the shell when watched directories change. One thread reads
+ *  all inotify events and hands them to the callbacks registered for the watch descriptor.
+ *
+ *  Copyright (C) 2022 Nicolai Brand
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE             // pipe2
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "valery/valery.h"
+#include "valery/watch.h"
+
+
+/* types */
+struct watch_t {
+    int wd;
+    uint32_t mask;          /* the events this watcher asked for, the kernel merges the masks */
+    watch_callback_t callback;
+    void *arg;
+};
+
+
+/* guards the watches, held while callbacks run */
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct watch_t *watches = NULL;
+static size_t watches_len = 0;
+static size_t watches_capacity = 0;
+
+static int inotify_fd = -1;
+static int stop_pipe[2] = { -1, -1 };
+static pthread_t watch_thread;
+static bool watch_running = false;
+
+
+/* removes watch i by moving the last watch into its place */
+static void watch_remove_idx(size_t i)
+{
+    watches[i] = watches[--watches_len];
+}
+
+static bool wd_in_use(int wd)
+{
+    for (size_t i = 0; i < watches_len; i++) {
+        if (watches[i].wd == wd)
+            return true;
+    }
+    return false;
+}
+
+static void watch_dispatch(struct inotify_event *event)
+{
+    pthread_mutex_lock(&watch_lock);
+    /* events were lost, and they could have been for any watch */
+    if (event->mask & IN_Q_OVERFLOW) {
+        for (size_t i = 0; i < watches_len; i++)
+            watches[i].callback(watches[i].arg, event->mask);
+        pthread_mutex_unlock(&watch_lock);
+        return;
+    }
+    for (size_t i = 0; i < watches_len; i++) {
+        if (watches[i].wd == event->wd && (event->mask & (watches[i].mask | IN_IGNORED)))
+            watches[i].callback(watches[i].arg, event->mask);
+    }
+    /* the kernel has dropped the watch, f.ex. because the directory was removed */
+    if (event->mask & IN_IGNORED) {
+        for (size_t i = 0; i < watches_len;) {
+            if (watches[i].wd == event->wd)
+                watch_remove_idx(i);
+            else
+                i++;
+        }
+    }
+    pthread_mutex_unlock(&watch_lock);
+}
+
+static void *watch_worker(void *arg)
+{
+    (void)arg;
+    char buf[WATCH_EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        { .fd = inotify_fd, .events = POLLIN },
+        { .fd = stop_pipe[0], .events = POLLIN }
+    };
+
+    while (1) {
+        if (poll(fds, 2, -1) == -1)
+            continue;
+        if (fds[1].revents != 0)
+            break;
+
+        ssize_t n = read(inotify_fd, buf, sizeof(buf));
+        if (n <= 0)
+            continue;
+        for (char *p = buf; p < buf + n;) {
+            struct inotify_event *event = (struct inotify_event *)p;
+            watch_dispatch(event);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return NULL;
+}
+
+void watch_init(void)
+{
+    inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotify_fd == -1)
+        return;
+    if (pipe2(stop_pipe, O_CLOEXEC) == -1 ||
+        pthread_create(&watch_thread, NULL, watch_worker, NULL) != 0) {
+        valery_error("could not start the watch thread, directory listings will not be cached");
+        close(inotify_fd);
+        inotify_fd = -1;
+        return;
+    }
+    watch_running = true;
+}
+
+void watch_free(void)
+{
+    if (watch_running) {
+        (void)!write(stop_pipe[1], "", 1);
+        pthread_join(watch_thread, NULL);
+        watch_running = false;
+    }
+    if (inotify_fd != -1)
+        close(inotify_fd);
+    if (stop_pipe[0] != -1) {
+        close(stop_pipe[0]);
+        close(stop_pipe[1]);
+    }
+    inotify_fd = -1;
+    stop_pipe[0] = stop_pipe[1] = -1;
+
+    vfree(watches);
+    watches = NULL;
+    watches_len = watches_capacity = 0;
+}
+
+int watch_add(const char *path, uint32_t mask, watch_callback_t callback, void *arg)
+{
+    if (!watch_running)
+        return -1;
+
+    pthread_mutex_lock(&watch_lock);
+    /* IN_MASK_ADD so a second watcher of the same path does not replace the mask of the first */
+    int wd = inotify_add_watch(inotify_fd, path, mask | IN_MASK_ADD);
+    if (wd != -1) {
+        if (watches_len == watches_capacity) {
+            watches_capacity = watches_capacity == 0 ? WATCH_STARTING_CAPACITY : watches_capacity * 2;
+            watches = vrealloc(watches, watches_capacity * sizeof(struct watch_t));
+        }
+        watches[watches_len++] = (struct watch_t){ .wd = wd, .mask = mask, .callback = callback,
+                                                      .arg = arg };
+    }
+    pthread_mutex_unlock(&watch_lock);
+    return wd;
+}
+
+void watch_rm(int wd, watch_callback_t callback, void *arg)
+{
+    if (wd == -1)
+        return;
+
+    pthread_mutex_lock(&watch_lock);
+    for (size_t i = 0; i < watches_len; i++) {
+        if (watches[i].wd == wd && watches[i].callback == callback && watches[i].arg == arg) {
+            watch_remove_idx(i);
+            break;
+        }
+    }
+    /* fails harmlessly if the kernel already dropped the watch */
+    if (!wd_in_use(wd))
+        inotify_rm_watch(inotify_fd, wd);
+    pthread_mutex_unlock(&watch_lock);
+}
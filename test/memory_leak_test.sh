@@ -6,7 +6,13 @@ heap="in use at exit: 0 bytes in 0 blocks"
 failed=0
 
 for test_vector in "ls -la" "echo a && echo b && echo c && echo d && echo e" "ls | wc -l" \
-    "ls -la | grep . | grep . | wc -l" "echo \$PS1" "1 && 2 && 3 && 4 && 5 && 6 && 7 && 8 && 9 && 10"
+    "ls -la | grep . | grep . | wc -l" "echo \$PS1" "1 && 2 && 3 && 4 && 5 && 6 && 7 && 8 && 9 && 10" \
+    "cat <<<hello" "$(printf 'cat <<EOF\nhello\nworld\nEOF')" "echo \$(pwd) \$(echo a)" \
+    "echo \$HOME \${UID} \${UNSET:-fallback} x\$(pwd)y" \
+    "ls src/*/*.c include/*/" "FOO=\"a b\" printenv FOO; (cd /tmp; X=1; echo \$X); echo \${X:-unset}" \
+    "alias ll=\"ls -l\"; alias; unalias ll; alias" \
+    "f() { echo \$1 \$#; return 2; echo no; }; g() { f a b && echo no; f \$@; }; g c" \
+    "X=0; echo \$(cd /; X=1); pwd; echo \$X"
 do
     echo "VALERY TEST: '$test_vector' started."
     if ./valery -c "$test_vector" >/dev/null
@@ -22,4 +28,24 @@ do
     [ $? -eq 1 ] && echo "VALERY TEST: '$test_vector' MEMORY LEAK DETECTED." && failed=1 && cat "$f"
 done
 
+# the semantics of these vectors are only checked here, so their output has to match exactly
+check_output()
+{
+    output=$(./valery -c "$1" 2>/dev/null)
+    if [ "$output" = "$2" ]
+    then
+        echo "VALERY TEST: '$1' OUTPUT MATCHED."
+    else
+        echo "VALERY TEST: '$1' WRONG OUTPUT, expected:" && echo "$2" && echo "got:" && \
+            echo "$output" && failed=1
+    fi
+}
+
+check_output "FOO=\"a b\" printenv FOO; (cd /tmp; X=1; echo \$X); echo \${X:-unset}" \
+    "$(printf 'a b\n1\nunset')"
+check_output "alias ll=\"ls -l\"; alias ll; unalias ll; alias ll" "alias ll='ls -l'"
+check_output "f() { echo \$1 \$#; return 2; echo no; }; g() { f a b && echo no; f \$@; }; g c" \
+    "$(printf 'a 2\nc 1')"
+check_output "X=0; echo \$(cd /; X=1); pwd; echo \$X" "$(printf '\n%s\n0' "$(pwd)")"
+
 exit $failed